@@ -0,0 +1,273 @@
+/*****************************************************************************
+* | File        :   epd_bench.c
+* | Function    :   Benchmark of the 4bpp host write strategies
+* | Info        :
+*   Built against the simulated controller (LIB=SIM) by "make bench".
+*   Every strategy is run on every panel size in a child process, so the
+*   peak memory of one run does not leak into the next. Times are the
+*   simulated SPI/GPIO/busy times, not the time this machine needed.
+*
+*   usage: epd_bench [-s strategy] [-p WxH] [-n repeat]
+*----------------
+* |	This version:   V1.0
+* | Date        :   2026-10-17
+* | Info        :   Basic version
+*
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../lib/Config/DEV_Config.h"
+#include "../lib/e-Paper/EPD_IT8951.h"
+
+#define BENCH_VCOM 1500
+
+typedef struct {
+    UWORD W;
+    UWORD H;
+} Bench_Panel;
+
+typedef struct {
+    int Ok;                     //uploaded memory matches the frame buffer
+    double Sim_ms;              //simulated upload time, averaged over the repeats
+    double Host_ms;             //CPU time of this process, averaged
+    uint64_t Bus_Bytes;         //SPI bytes per upload, preambles and commands included
+    uint64_t CS_Transactions;   //per upload
+    double Busy_ms;             //simulated HRDY wait per upload
+    long Peak_KB;               //growth of the peak RSS during the uploads, ~128KB granularity
+    uint64_t Errors;            //protocol errors reported by the simulator
+} Bench_Result;
+
+static const char *Strategy_Name[IT8951_WRITE_STRATEGY_NUM] = {
+    "packed", "per_row", "telegram", "whole_image", "one_chunk",
+};
+
+static const Bench_Panel Default_Panel[] = {
+    {800, 600}, {1200, 825}, {1872, 1404},
+};
+
+static double Bench_Cpu_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static long Bench_MaxRSS_KB(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+/******************************************************************************
+function :	Check the controller memory against a 4bpp frame buffer
+parameter:  even pixel in the low nibble, the controller keeps it as n<<4
+******************************************************************************/
+static int Bench_Verify(const UBYTE *Frame_Buf, UWORD W, UWORD H, UWORD Panel_W, UDOUBLE Addr)
+{
+    const UBYTE *Mem = SIM_IT8951_Memory(Addr);
+    if(Mem == NULL)
+        return 0;
+    for(UDOUBLE y = 0; y < H; y++) {
+        for(UDOUBLE x = 0; x < W; x++) {
+            UBYTE Nibble = (Frame_Buf[y * (W / 2) + x / 2] >> ((x & 1) * 4)) & 0x0F;
+            if(Mem[y * Panel_W + x] != (Nibble << 4))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/******************************************************************************
+function :	One strategy on one panel, runs in the child process
+parameter:
+******************************************************************************/
+static void Bench_Run(IT8951_Write_Strategy Strategy, Bench_Panel Panel, int Repeat, Bench_Result *Result)
+{
+    memset(Result, 0, sizeof(*Result));
+
+    //Through the environment, so the default panel is never allocated
+    char Panel_Env[16];
+    snprintf(Panel_Env, sizeof(Panel_Env), "%ux%u", Panel.W, Panel.H);
+    setenv("IT8951_SIM_PANEL", Panel_Env, 1);
+    DEV_Module_Init();
+    IT8951_Dev_Info Dev_Info = EPD_IT8951_Init(BENCH_VCOM);
+    UDOUBLE Addr = Dev_Info.Memory_Addr_L | ((UDOUBLE)Dev_Info.Memory_Addr_H << 16);
+
+    UWORD W = Dev_Info.Panel_W - Dev_Info.Panel_W % 4;
+    UWORD H = Dev_Info.Panel_H;
+    UDOUBLE Size = (UDOUBLE)W / 2 * H;
+    UBYTE *Frame_Buf = malloc(Size);
+    if(Frame_Buf == NULL) {
+        Result->Errors = 1;
+        DEV_Module_Exit();
+        return;
+    }
+    //Gradient with some noise, so misplaced words can not go unnoticed
+    UDOUBLE Seed = 0x12345678;
+    for(UDOUBLE i = 0; i < Size; i++) {
+        Seed = Seed * 1103515245 + 12345;
+        Frame_Buf[i] = (UBYTE)((i * 2 / W) ^ (Seed >> 16));
+    }
+
+    //Warm-up with the bufferless uploader: the image memory gets touched once,
+    //so the peak memory below is what the measured strategy allocates itself
+    Write_Strategy = IT8951_WRITE_PACKED;
+    EPD_IT8951_4bp_Write(Frame_Buf, 0, 0, W, H, Addr, true);
+
+    Write_Strategy = Strategy;
+    EPD_IT8951_WaitForDisplayReady();
+    SIM_IT8951_Reset_Stats();
+    long RSS_Start = Bench_MaxRSS_KB();
+    double Cpu_Start = Bench_Cpu_ms();
+    uint64_t Sim_Start = SIM_IT8951_Now_ns();
+
+    for(int i = 0; i < Repeat; i++)
+        EPD_IT8951_4bp_Write(Frame_Buf, 0, 0, W, H, Addr, true);
+
+    uint64_t Sim_End = SIM_IT8951_Now_ns();
+    double Cpu_End = Bench_Cpu_ms();
+    SIM_IT8951_Stats Stats;
+    SIM_IT8951_Get_Stats(&Stats);
+
+    Result->Sim_ms = (Sim_End - Sim_Start) / 1e6 / Repeat;
+    Result->Host_ms = (Cpu_End - Cpu_Start) / Repeat;
+    Result->Bus_Bytes = (Stats.Bytes_Written + Stats.Bytes_Read) / Repeat;
+    Result->CS_Transactions = Stats.CS_Transactions / Repeat;
+    Result->Busy_ms = Stats.Busy_Wait_ns / 1e6 / Repeat;
+    Result->Peak_KB = Bench_MaxRSS_KB() - RSS_Start;
+    Result->Errors = Stats.Errors;
+    Result->Ok = Bench_Verify(Frame_Buf, W, H, Dev_Info.Panel_W, Addr);
+
+    free(Frame_Buf);
+    DEV_Module_Exit();
+}
+
+static int Bench_Fork(IT8951_Write_Strategy Strategy, Bench_Panel Panel, int Repeat, Bench_Result *Result)
+{
+    int fd[2];
+    if(pipe(fd) < 0)
+        return -1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+    if(pid == 0) {
+        close(fd[0]);
+        //The driver's Debug output would mix with the table
+        if(freopen("/dev/null", "w", stdout) == NULL)
+            _exit(1);
+        Bench_Run(Strategy, Panel, Repeat, Result);
+        _exit(write(fd[1], Result, sizeof(*Result)) == sizeof(*Result) ? 0 : 1);
+    }
+
+    close(fd[1]);
+    ssize_t n = read(fd[0], Result, sizeof(*Result));
+    close(fd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if(n != sizeof(*Result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return 0;
+}
+
+static void Bench_Usage(const char *Name)
+{
+    fprintf(stderr, "usage: %s [-s strategy] [-p WxH] [-n repeat]\n", Name);
+    fprintf(stderr, "strategies:");
+    for(int i = 0; i < IT8951_WRITE_STRATEGY_NUM; i++)
+        fprintf(stderr, " %s", Strategy_Name[i]);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int Only_Strategy = -1;
+    Bench_Panel Panel_Arg;
+    const Bench_Panel *Panels = Default_Panel;
+    int Panel_Num = sizeof(Default_Panel) / sizeof(Default_Panel[0]);
+    int Repeat = 1;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:p:n:h")) != -1) {
+        switch(opt) {
+        case 's':
+            for(int i = 0; i < IT8951_WRITE_STRATEGY_NUM; i++)
+                if(strcmp(optarg, Strategy_Name[i]) == 0)
+                    Only_Strategy = i;
+            if(Only_Strategy < 0) {
+                Bench_Usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'p': {
+            unsigned int w, h;
+            if(sscanf(optarg, "%ux%u", &w, &h) != 2 || w < 4 || h < 1 || w > 4096 || h > 4096) {
+                Bench_Usage(argv[0]);
+                return 2;
+            }
+            Panel_Arg.W = w;
+            Panel_Arg.H = h;
+            Panels = &Panel_Arg;
+            Panel_Num = 1;
+            break;
+        }
+        case 'n':
+            Repeat = atoi(optarg);
+            if(Repeat < 1)
+                Repeat = 1;
+            break;
+        default:
+            Bench_Usage(argv[0]);
+            return 2;
+        }
+    }
+
+    printf("SPI clock %.2f MHz, %d upload(s) per run, simulated times\n",
+        SIM_IT8951_SPI_HZ / 1e6, Repeat);
+    if(getenv("IT8951_SIM_SPI_HZ"))
+        printf("(IT8951_SIM_SPI_HZ=%s overrides the clock above)\n", getenv("IT8951_SIM_SPI_HZ"));
+    printf("%-10s %-12s %10s %10s %12s %8s %9s %9s %8s %s\n",
+        "panel", "strategy", "upload ms", "MB/s", "bus bytes", "CS", "busy ms", "host ms", "peak KB", "result");
+
+    int Failed = 0;
+    for(int p = 0; p < Panel_Num; p++) {
+        for(int s = 0; s < IT8951_WRITE_STRATEGY_NUM; s++) {
+            if(Only_Strategy >= 0 && s != Only_Strategy)
+                continue;
+
+            char Panel_Name[16];
+            snprintf(Panel_Name, sizeof(Panel_Name), "%ux%u", Panels[p].W, Panels[p].H);
+
+            Bench_Result r;
+            if(Bench_Fork(s, Panels[p], Repeat, &r) < 0) {
+                printf("%-10s %-12s run failed\n", Panel_Name, Strategy_Name[s]);
+                Failed++;
+                continue;
+            }
+
+            double Payload = (double)(Panels[p].W - Panels[p].W % 4) / 2 * Panels[p].H;
+            const char *Verdict = (r.Ok && r.Errors == 0) ? "ok" : (r.Errors ? "protocol error" : "wrong image");
+            if(!r.Ok || r.Errors)
+                Failed++;
+
+            printf("%-10s %-12s %10.1f %10.3f %12llu %8llu %9.1f %9.1f %8ld %s\n",
+                Panel_Name, Strategy_Name[s], r.Sim_ms,
+                r.Sim_ms > 0 ? Payload / (r.Sim_ms * 1000.0) : 0.0,
+                (unsigned long long)r.Bus_Bytes, (unsigned long long)r.CS_Transactions,
+                r.Busy_ms, r.Host_ms, r.Peak_KB, Verdict);
+        }
+    }
+
+    return Failed ? 1 : 0;
+}
@@ -29,12 +29,21 @@
 ******************************************************************************/
 #include "DEV_Config.h"
 #include <fcntl.h>
+#include <time.h>
 
 #if LGPIO
+#include <pthread.h>
 int GPIO_Handle;
 int SPI_Handle;
+
+//BUSY edges reported by the lgpio alert thread
+static pthread_mutex_t Alert_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Alert_Cond;
+static int Alert_Pin = -1;
 #endif
 
+static UDOUBLE SPI_Speed_Hz = 0;
+
 /******************************************************************************
 function:	GPIO Write
 parameter:
@@ -48,6 +57,8 @@ void DEV_Digital_Write(UWORD Pin, UBYTE Value)
     lgGpioWrite(GPIO_Handle, Pin, Value);
 #elif GPIOD
     GPIOD_Write(Pin, Value);
+#elif SIM
+    SIM_IT8951_Digital_Write(Pin, Value);
 #endif
 }
 
@@ -65,10 +76,190 @@ UBYTE DEV_Digital_Read(UWORD Pin)
     Read_Value = lgGpioRead(GPIO_Handle,Pin);
 #elif GPIOD
     Read_Value = GPIOD_Read(Pin);
+#elif SIM
+    Read_Value = SIM_IT8951_Digital_Read(Pin);
 #endif
 	return Read_Value;
 }
 
+#define DEV_WAIT_SPIN_MIN_NS    2000
+#define DEV_WAIT_SPIN_MAX_NS    50000
+#define DEV_WAIT_SPIN_INIT_NS   10000
+#define DEV_WAIT_SLICE_MS       100     //longest sleep without looking at the pin
+
+static DEV_Wait_Stats Wait_Stats = {.Spin_ns = DEV_WAIT_SPIN_INIT_NS};
+
+#if LGPIO
+static void DEV_Alert_Callback(int Num_Alerts, lgGpioAlert_p Alerts, void *Userdata)
+{
+    pthread_mutex_lock(&Alert_Mutex);
+    pthread_cond_broadcast(&Alert_Cond);
+    pthread_mutex_unlock(&Alert_Mutex);
+}
+
+/******************************************************************************
+function:	Wait for an lgpio alert on Pin
+parameter:
+Info:
+    0: pin reads Value, 1: timeout, -1: no alert claimed on Pin.
+    The level is checked under the mutex the alert thread signals with,
+    so an edge between the read and the wait can not get lost.
+******************************************************************************/
+static int DEV_Alert_Wait(UWORD Pin, UBYTE Value, UDOUBLE Timeout_ms)
+{
+    if(Pin != Alert_Pin)
+        return -1;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += Timeout_ms / 1000;
+    ts.tv_nsec += (Timeout_ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    int Ret = 0;
+    pthread_mutex_lock(&Alert_Mutex);
+    while(lgGpioRead(GPIO_Handle, Pin) != Value) {
+        if(pthread_cond_timedwait(&Alert_Cond, &Alert_Mutex, &ts) == ETIMEDOUT) {
+            Ret = (lgGpioRead(GPIO_Handle, Pin) == Value) ? 0 : 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&Alert_Mutex);
+    return Ret;
+}
+#endif
+
+/******************************************************************************
+function:	Poll a pin with a growing sleep
+parameter:
+Info:
+    Used where no edge events are available (BCM, or when the event request
+    failed). Under SIM a busy read already moves the clock to the end of the wait.
+******************************************************************************/
+static UBYTE DEV_Digital_Poll(UWORD Pin, UBYTE Value, uint64_t Deadline_ns)
+{
+#ifndef SIM
+    UDOUBLE Sleep_us = 10;
+#endif
+    while(DEV_Digital_Read(Pin) != Value) {
+        if(Deadline_ns != 0 && DEV_Clock_ns() >= Deadline_ns)
+            return 1;
+#ifndef SIM
+        usleep(Sleep_us);
+        if(Sleep_us < 1000)
+            Sleep_us *= 2;
+#endif
+    }
+    return 0;
+}
+
+/******************************************************************************
+function:	Sleep until a pin reads Value
+parameter:
+Info:
+    Blocks in slices of DEV_WAIT_SLICE_MS, so a missed edge costs one slice
+    and not the whole wait.
+******************************************************************************/
+static UBYTE DEV_Digital_Block(UWORD Pin, UBYTE Value, uint64_t Deadline_ns)
+{
+    for(;;) {
+        UDOUBLE Slice_ms = DEV_WAIT_SLICE_MS;
+        if(Deadline_ns != 0) {
+            uint64_t Now = DEV_Clock_ns();
+            if(Now >= Deadline_ns)
+                return (DEV_Digital_Read(Pin) == Value) ? 0 : 1;
+            if(Deadline_ns - Now < (uint64_t)Slice_ms * 1000000)
+                Slice_ms = (Deadline_ns - Now + 999999) / 1000000;
+        }
+
+        int Ret = -1;
+#if LGPIO
+        Ret = DEV_Alert_Wait(Pin, Value, Slice_ms);
+#elif GPIOD
+        Ret = GPIOD_Wait(Pin, Value, Slice_ms);
+#endif
+        if(Ret == 0)
+            return 0;
+        if(Ret < 0)
+            return DEV_Digital_Poll(Pin, Value, Deadline_ns);
+    }
+}
+
+/******************************************************************************
+function:	Wait for a pin level
+parameter:
+    Pin        : GPIO
+    Value      : level to wait for
+    Timeout_ms : 0 waits forever
+Info:
+    Returns 0 once the pin reads Value, 1 on timeout.
+    Spins first: most HRDY waits are over within a few us, well below the
+    wake-up latency of a sleep. The spin budget follows the waits seen so
+    far. Longer waits sleep on a GPIOD line event or an lgpio alert, so the
+    CPU is free for other threads during uploads and refreshes.
+******************************************************************************/
+UBYTE DEV_Digital_Wait(UWORD Pin, UBYTE Value, UDOUBLE Timeout_ms)
+{
+    if(DEV_Digital_Read(Pin) == Value)
+        return 0;
+
+    uint64_t Start = DEV_Clock_ns();
+    uint64_t Deadline = (Timeout_ms != 0) ? Start + (uint64_t)Timeout_ms * 1000000 : 0;
+    uint64_t Spin = Wait_Stats.Spin_ns;
+    uint64_t Now = Start;
+    UBYTE Ret = 0;
+    UBYTE Blocked = 0;
+
+    while(DEV_Digital_Read(Pin) != Value) {
+        Now = DEV_Clock_ns();
+        if(Now - Start >= Spin) {
+            Blocked = 1;
+            Ret = DEV_Digital_Block(Pin, Value, Deadline);
+            Now = DEV_Clock_ns();
+            break;
+        }
+    }
+
+    uint64_t Elapsed = Now - Start;
+    Wait_Stats.Waits++;
+    Wait_Stats.Wait_ns += Elapsed;
+    if(Elapsed > Wait_Stats.Max_Wait_ns)
+        Wait_Stats.Max_Wait_ns = Elapsed;
+    if(Ret)
+        Wait_Stats.Timeouts++;
+
+    //Grow the budget when waits end in the spin, or would have with a
+    //little more of it; shrink it when they are long enough to sleep through
+    if(!Blocked || Elapsed < 2 * Spin)
+        Spin += Spin / 8;
+    else
+        Spin -= Spin / 4;
+    if(Spin < DEV_WAIT_SPIN_MIN_NS)
+        Spin = DEV_WAIT_SPIN_MIN_NS;
+    if(Spin > DEV_WAIT_SPIN_MAX_NS)
+        Spin = DEV_WAIT_SPIN_MAX_NS;
+    Wait_Stats.Spin_ns = Spin;
+    if(Blocked)
+        Wait_Stats.Blocks++;
+
+    return Ret;
+}
+
+void DEV_Get_Wait_Stats(DEV_Wait_Stats *Stats)
+{
+    *Stats = Wait_Stats;
+}
+
+void DEV_Reset_Wait_Stats(void)
+{
+    uint64_t Spin = Wait_Stats.Spin_ns;
+    memset(&Wait_Stats, 0, sizeof(Wait_Stats));
+    Wait_Stats.Spin_ns = Spin;
+}
+
 /******************************************************************************
 function:	SPI Write
 parameter:
@@ -82,15 +273,61 @@ void DEV_SPI_WriteByte(UBYTE Value)
     lgSpiWrite(SPI_Handle,(char*)&Value, 1);
 #elif GPIOD
 	DEV_HARDWARE_SPI_TransferByte(Value);
+#elif SIM
+    SIM_IT8951_TransferByte(Value);
 #endif
 }
 
-// New function: Write a buffer over SPI in one bulk transfer.
-void DEV_SPI_WriteBuffer(uint8_t *buffer, UDOUBLE length)
+#if LGPIO
+/******************************************************************************
+function:	Largest lgSpiWrite() that spidev accepts
+parameter:
+Info:
+    lgpio goes through spidev, which rejects more than bufsiz bytes per call
+******************************************************************************/
+static UDOUBLE DEV_SPI_MaxWrite(void)
 {
-    // bcm2835_spi_transfern() performs a full-duplex transfer.
-    // For write-only operations, the returned data is ignored.
-    bcm2835_spi_transfern((char *)buffer, length);
+    static UDOUBLE Bufsiz = 0;
+    if(Bufsiz == 0) {
+        unsigned long Value = 0;
+        FILE *fp = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+        if(fp != NULL) {
+            if(fscanf(fp, "%lu", &Value) != 1)
+                Value = 0;
+            fclose(fp);
+        }
+        Bufsiz = (Value == 0) ? 4096 : Value;
+    }
+    return Bufsiz;
+}
+#endif
+
+/******************************************************************************
+function:	SPI Write buffer
+parameter:
+Info:
+    Bulk write, the data clocked back is dropped
+******************************************************************************/
+void DEV_SPI_WriteBuffer(const uint8_t *buffer, UDOUBLE length)
+{
+#ifdef BCM
+    bcm2835_spi_writenb((char *)buffer, length);
+#elif  LGPIO
+    UDOUBLE Max = DEV_SPI_MaxWrite();
+    while(length > 0) {
+        UDOUBLE Len = (length > Max) ? Max : length;
+        if(lgSpiWrite(SPI_Handle, (const char *)buffer, Len) != (int)Len) {
+            Debug("lgSpiWrite failed\r\n");
+            return;
+        }
+        buffer += Len;
+        length -= Len;
+    }
+#elif GPIOD
+    DEV_HARDWARE_SPI_Write(buffer, length);
+#elif SIM
+    SIM_IT8951_WriteBuffer(buffer, length);
+#endif
 }
 
 /******************************************************************************
@@ -107,10 +344,70 @@ UBYTE DEV_SPI_ReadByte()
     lgSpiRead(SPI_Handle, (char*)&Read_Value, 1);
 #elif GPIOD
 	Read_Value = DEV_HARDWARE_SPI_TransferByte(0x00);
+#elif SIM
+    Read_Value = SIM_IT8951_TransferByte(0x00);
 #endif
 	return Read_Value;
 }
 
+/******************************************************************************
+function:	Set the SPI clock
+parameter:
+    Hz : requested clock
+Info:
+    Returns the clock actually used. The BCM2835 only divides the core clock
+    by an even number, so the result can be below the request.
+******************************************************************************/
+UDOUBLE DEV_SPI_SetSpeed(UDOUBLE Hz)
+{
+    if(Hz == 0)
+        return SPI_Speed_Hz;
+#ifdef BCM
+    UDOUBLE Divider = (BCM2835_CORE_CLK_HZ + Hz - 1) / Hz;
+    Divider = (Divider + 1) & ~1u;
+    if(Divider < 2)
+        Divider = 2;
+    if(Divider > 65534)
+        Divider = 65534;
+    bcm2835_spi_setClockDivider(Divider);
+    SPI_Speed_Hz = BCM2835_CORE_CLK_HZ / Divider;
+#elif  LGPIO
+    lgSpiClose(SPI_Handle);
+    SPI_Handle = lgSpiOpen(0, 0, Hz, 0);
+    SPI_Speed_Hz = Hz;
+#elif GPIOD
+    DEV_HARDWARE_SPI_setSpeed(Hz);
+    SPI_Speed_Hz = Hz;
+#elif SIM
+    SIM_IT8951_Set_SPI_Clock(Hz);
+    SPI_Speed_Hz = Hz;
+#endif
+    Debug("SPI clock %u Hz\r\n", SPI_Speed_Hz);
+    return SPI_Speed_Hz;
+}
+
+UDOUBLE DEV_SPI_GetSpeed(void)
+{
+    return SPI_Speed_Hz;
+}
+
+/******************************************************************************
+function:	Monotonic time in ns
+parameter:
+Info:
+    Simulated time with LIB=SIM, so measurements match what the panel sees
+******************************************************************************/
+uint64_t DEV_Clock_ns(void)
+{
+#if SIM
+    return SIM_IT8951_Now_ns();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
 /******************************************************************************
 function:	Time delay for ms
 parameter:
@@ -127,6 +424,8 @@ void DEV_Delay_ms(UDOUBLE xms)
 	for(i=0; i < xms; i++) {
 		usleep(1000);
 	}
+#elif SIM
+    SIM_IT8951_Delay_ns((uint64_t)xms * 1000000);
 #endif
 }
 
@@ -144,13 +443,16 @@ void DEV_Delay_us(UDOUBLE xus)
     lguSleep(xus/1000000.0);
 #elif GPIOD
 	usleep(xus);
+#elif SIM
+    SIM_IT8951_Delay_ns((uint64_t)xus * 1000);
 #endif
 }
 
 
 /**
- * GPIO Mode
+ * GPIO Mode, the simulator has no pins to configure
 **/
+#if BCM || LGPIO || GPIOD
 static void DEV_GPIO_Mode(UWORD Pin, UWORD Mode)
 {
 #ifdef BCM
@@ -177,7 +479,37 @@ static void DEV_GPIO_Mode(UWORD Pin, UWORD Mode)
 	}
 #endif
 }
+#endif
+
 
+#if LGPIO
+/**
+ * BUSY as an alert input, DEV_Digital_Wait() sleeps on its edges
+**/
+static int DEV_GPIO_Alert(UWORD Pin)
+{
+    static int Cond_Ready = 0;
+    if(!Cond_Ready) {
+        pthread_condattr_t Attr;
+        pthread_condattr_init(&Attr);
+        pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&Alert_Cond, &Attr);
+        pthread_condattr_destroy(&Attr);
+        Cond_Ready = 1;
+    }
+
+    if(lgGpioClaimAlert(GPIO_Handle, LFLAGS, LG_BOTH_EDGES, Pin, -1) < 0) {
+        Debug("BUSY alert failed, polling the pin\r\n");
+        return -1;
+    }
+    if(lgGpioSetAlertsFunc(GPIO_Handle, Pin, DEV_Alert_Callback, NULL) < 0) {
+        Debug("BUSY alert callback failed, polling the pin\r\n");
+        return -1;
+    }
+    Alert_Pin = Pin;
+    return 0;
+}
+#endif
 
 /**
  * GPIO Init
@@ -192,18 +524,22 @@ static void DEV_GPIO_Init(void)
 	DEV_Digital_Write(EPD_CS_PIN, HIGH);
 
 #elif LGPIO
-	DEV_GPIO_Mode(EPD_BUSY_PIN, 0);
+	if(DEV_GPIO_Alert(EPD_BUSY_PIN) != 0)
+		DEV_GPIO_Mode(EPD_BUSY_PIN, 0);
 	DEV_GPIO_Mode(EPD_RST_PIN, 1);
     DEV_GPIO_Mode(EPD_CS_PIN, 1);
 
     DEV_Digital_Write(EPD_CS_PIN, 1);
 
 #elif GPIOD
-	DEV_GPIO_Mode(EPD_BUSY_PIN, 0);
-	DEV_GPIO_Mode(EPD_RST_PIN, 1);
-    DEV_GPIO_Mode(EPD_CS_PIN, 1);
+	int Out_Pins[2] = {EPD_RST_PIN, EPD_CS_PIN};
+	if(GPIOD_Events(EPD_BUSY_PIN) != 0)
+		DEV_GPIO_Mode(EPD_BUSY_PIN, 0);
+	GPIOD_Direction_Bulk(Out_Pins, 2, GPIOD_OUT);
 
     DEV_Digital_Write(EPD_CS_PIN, 1);
+#elif SIM
+    DEV_Digital_Write(EPD_CS_PIN, HIGH);
 #endif
 	
 }
@@ -232,6 +568,7 @@ UBYTE DEV_Module_Init(void)
 	bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);                  //spi mode 0
 	//bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_16);   //For RPi3/3B/3B+
 	bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_32);   //For RPi 4
+	SPI_Speed_Hz = BCM2835_CORE_CLK_HZ / BCM2835_SPI_CLOCK_DIVIDER_32;
 	/* SPI clock reference link：*/
 	/*http://www.airspayce.com/mikem/bcm2835/group__constants.html#gaf2e0ca069b8caef24602a02e8a00884e*/
 
@@ -279,6 +616,7 @@ UBYTE DEV_Module_Init(void)
         }
     }
     SPI_Handle = lgSpiOpen(0, 0, 12500000, 0);
+    SPI_Speed_Hz = 12500000;
     DEV_GPIO_Init();
 #elif GPIOD
 	printf("Write and read /dev/spidev0.0 \r\n");
@@ -286,6 +624,11 @@ UBYTE DEV_Module_Init(void)
 	DEV_GPIO_Init();
 	DEV_HARDWARE_SPI_begin("/dev/spidev0.0");
     DEV_HARDWARE_SPI_setSpeed(12500000);
+    SPI_Speed_Hz = 12500000;
+#elif SIM
+    SIM_IT8951_Init();
+    SPI_Speed_Hz = SIM_IT8951_Get_SPI_Clock();
+    DEV_GPIO_Init();
 #endif
 
     Debug("/***********************************/ \r\n");
@@ -319,5 +662,7 @@ void DEV_Module_Exit(void)
     GPIOD_Unexport(EPD_RST_PIN);
     GPIOD_Unexport(EPD_BUSY_PIN);
     GPIOD_Unexport_GPIO();
+#elif SIM
+    SIM_IT8951_Exit();
 #endif
 }
@@ -66,6 +66,8 @@
 #elif GPIOD
     #include "RPI_gpiod.h"
     #include "dev_hardware_SPI.h"
+#elif SIM
+    #include "dev_sim_IT8951.h"
 #endif
 
 
@@ -89,6 +91,18 @@
 #define UWORD   uint16_t
 #define UDOUBLE uint32_t
 
+/**
+ * Pin wait statistics, see DEV_Digital_Wait()
+**/
+typedef struct {
+    uint64_t Waits;         //Calls that found the pin at the wrong level
+    uint64_t Blocks;        //Waits that outlasted the spin phase and slept
+    uint64_t Timeouts;
+    uint64_t Wait_ns;       //Total time spent waiting
+    uint64_t Max_Wait_ns;   //Longest single wait
+    uint64_t Spin_ns;       //Current spin budget
+} DEV_Wait_Stats;
+
 
 
 
@@ -96,11 +110,17 @@
 /*------------------------------------------------------------------------------------------------------*/
 void DEV_Digital_Write(UWORD Pin, UBYTE Value);
 UBYTE DEV_Digital_Read(UWORD Pin);
+UBYTE DEV_Digital_Wait(UWORD Pin, UBYTE Value, UDOUBLE Timeout_ms);
+void DEV_Get_Wait_Stats(DEV_Wait_Stats *Stats);
+void DEV_Reset_Wait_Stats(void);
 
 void DEV_SPI_WriteByte(UBYTE Value);
-// New: Write a buffer in a single bulk SPI transfer.
-void DEV_SPI_WriteBuffer(uint8_t *buffer, UDOUBLE length);
+void DEV_SPI_WriteBuffer(const uint8_t *buffer, UDOUBLE length);
 UBYTE DEV_SPI_ReadByte();
+UDOUBLE DEV_SPI_SetSpeed(UDOUBLE Hz);
+UDOUBLE DEV_SPI_GetSpeed(void);
+
+uint64_t DEV_Clock_ns(void);
 
 void DEV_Delay_ms(UDOUBLE xms);
 void DEV_Delay_us(UDOUBLE xus);
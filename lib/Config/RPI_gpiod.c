@@ -36,12 +36,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <gpiod.h>
 
 struct gpiod_chip *gpiochip;
 struct gpiod_line *gpioline;
 int ret;
 
+/*
+ * Lines are requested once and the handles kept,
+ * so a read or write is a single ioctl without a line lookup.
+ */
+#if GPIOD_V1
+static struct gpiod_line *GPIOD_Lines[GPIOD_PIN_NUM];
+#else
+static struct gpiod_line_request *GPIOD_Requests[GPIOD_PIN_NUM];
+static struct gpiod_edge_event_buffer *GPIOD_Event_Buffer;
+#endif
+static char GPIOD_Edges[GPIOD_PIN_NUM];
+
 int GPIOD_Export()
 {   
     char buffer[NUM_MAXBUF];
@@ -76,17 +89,145 @@ int GPIOD_Export()
     return 0;
 }
 
+static int GPIOD_Requested(int Pin)
+{
+    if (Pin < 0 || Pin >= GPIOD_PIN_NUM)
+        return 0;
+#if GPIOD_V1
+    return GPIOD_Lines[Pin] != NULL;
+#else
+    return GPIOD_Requests[Pin] != NULL;
+#endif
+}
+
+/*
+ * Requests Num lines in one call, as GPIOD_IN, GPIOD_OUT (low) or GPIOD_EVENTS
+ */
+static int GPIOD_Request(const int *Pins, int Num, int Dir)
+{
+    int i;
+
+    if (Num < 1 || Num > GPIOD_PIN_NUM)
+        return -1;
+    for (i = 0; i < Num; i++)
+    {
+        if (Pins[i] < 0 || Pins[i] >= GPIOD_PIN_NUM || GPIOD_Requested(Pins[i]))
+        {
+            GPIOD_Debug( "Export Failed: Pin%d\n", Pins[i]);
+            return -1;
+        }
+    }
+
+#if GPIOD_V1
+    struct gpiod_line_bulk bulk;
+    struct gpiod_line_request_config config;
+    unsigned int offsets[GPIOD_LINE_BULK_MAX_LINES];
+    int values[GPIOD_LINE_BULK_MAX_LINES] = {0};
+
+    if (Num > GPIOD_LINE_BULK_MAX_LINES)
+        return -1;
+    for (i = 0; i < Num; i++)
+        offsets[i] = Pins[i];
+    ret = gpiod_chip_get_lines(gpiochip, offsets, Num, &bulk);
+    if (ret != 0)
+    {
+        GPIOD_Debug( "Export Failed: Pin%d\n", Pins[0]);
+        return -1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.consumer = "gpio";
+    if (Dir == GPIOD_OUT)
+        config.request_type = GPIOD_LINE_REQUEST_DIRECTION_OUTPUT;
+    else if (Dir == GPIOD_EVENTS)
+        config.request_type = GPIOD_LINE_REQUEST_EVENT_BOTH_EDGES;
+    else
+        config.request_type = GPIOD_LINE_REQUEST_DIRECTION_INPUT;
+    ret = gpiod_line_request_bulk(&bulk, &config, values);
+    if (ret != 0)
+    {
+        GPIOD_Debug( "Export Failed: Pin%d\n", Pins[0]);
+        return -1;
+    }
+
+    for (i = 0; i < Num; i++)
+        GPIOD_Lines[Pins[i]] = gpiod_line_bulk_get_line(&bulk, i);
+#else
+    struct gpiod_line_settings *settings = gpiod_line_settings_new();
+    struct gpiod_line_config *line_cfg = gpiod_line_config_new();
+    struct gpiod_request_config *req_cfg = gpiod_request_config_new();
+    struct gpiod_line_request *request = NULL;
+    unsigned int offsets[GPIOD_PIN_NUM];
+
+    for (i = 0; i < Num; i++)
+        offsets[i] = Pins[i];
+    if (settings != NULL && line_cfg != NULL && req_cfg != NULL)
+    {
+        if (Dir == GPIOD_OUT)
+        {
+            gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_OUTPUT);
+            gpiod_line_settings_set_output_value(settings, GPIOD_LINE_VALUE_INACTIVE);
+        }
+        else
+        {
+            gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_INPUT);
+            if (Dir == GPIOD_EVENTS)
+                gpiod_line_settings_set_edge_detection(settings, GPIOD_LINE_EDGE_BOTH);
+        }
+        gpiod_request_config_set_consumer(req_cfg, "gpio");
+        if (gpiod_line_config_add_line_settings(line_cfg, offsets, Num, settings) == 0)
+            request = gpiod_chip_request_lines(gpiochip, req_cfg, line_cfg);
+    }
+    if (settings != NULL)
+        gpiod_line_settings_free(settings);
+    if (line_cfg != NULL)
+        gpiod_line_config_free(line_cfg);
+    if (req_cfg != NULL)
+        gpiod_request_config_free(req_cfg);
+    if (request == NULL)
+    {
+        GPIOD_Debug( "Export Failed: Pin%d\n", Pins[0]);
+        return -1;
+    }
+
+    if (Dir == GPIOD_EVENTS && GPIOD_Event_Buffer == NULL)
+        GPIOD_Event_Buffer = gpiod_edge_event_buffer_new(GPIOD_EVENT_NUM);
+    for (i = 0; i < Num; i++)
+        GPIOD_Requests[Pins[i]] = request;
+#endif
+
+    for (i = 0; i < Num; i++)
+    {
+        GPIOD_Edges[Pins[i]] = (Dir == GPIOD_EVENTS);
+        GPIOD_Debug("Pin%d:%s\r\n", Pins[i], Dir == GPIOD_OUT ? "Output" : "input");
+    }
+    return 0;
+}
+
 int GPIOD_Unexport(int Pin)
 {
-    gpioline = gpiod_chip_get_line(gpiochip, Pin);
-    if (gpioline == NULL)
+    if (!GPIOD_Requested(Pin))
     {
-        GPIOD_Debug( "Export Failed: Pin%d\n", Pin);
+        GPIOD_Debug( "Unexport Failed: Pin%d\n", Pin);
         return -1;
     }
 
-    gpiod_line_release(gpioline);
-    
+#if GPIOD_V1
+    gpiod_line_release(GPIOD_Lines[Pin]);
+    GPIOD_Lines[Pin] = NULL;
+#else
+    //a bulk request goes when its last pin does
+    struct gpiod_line_request *request = GPIOD_Requests[Pin];
+    int i;
+    GPIOD_Requests[Pin] = NULL;
+    for (i = 0; i < GPIOD_PIN_NUM; i++)
+        if (GPIOD_Requests[i] == request)
+            break;
+    if (i == GPIOD_PIN_NUM)
+        gpiod_line_request_release(request);
+#endif
+    GPIOD_Edges[Pin] = 0;
+
     GPIOD_Debug( "Unexport: Pin%d\r\n", Pin);
     
     return 0;
@@ -94,54 +235,123 @@ int GPIOD_Unexport(int Pin)
 
 int GPIOD_Unexport_GPIO(void)
 {
-    gpiod_line_release(gpioline);
+    int i;
+
+    for (i = 0; i < GPIOD_PIN_NUM; i++)
+        if (GPIOD_Requested(i))
+            GPIOD_Unexport(i);
+#if !GPIOD_V1
+    if (GPIOD_Event_Buffer != NULL)
+    {
+        gpiod_edge_event_buffer_free(GPIOD_Event_Buffer);
+        GPIOD_Event_Buffer = NULL;
+    }
+#endif
     gpiod_chip_close(gpiochip);
+    gpiochip = NULL;
 
     return 0;
 }
 
 int GPIOD_Direction(int Pin, int Dir)
 {
-    gpioline = gpiod_chip_get_line(gpiochip, Pin);
-    if (gpioline == NULL)
-    {
-        GPIOD_Debug( "Export Failed: Pin%d\n", Pin);
+    return GPIOD_Request(&Pin, 1, Dir == GPIOD_IN ? GPIOD_IN : GPIOD_OUT);
+}
+
+/*
+ * All pins in one request, e.g. the outputs at startup
+ */
+int GPIOD_Direction_Bulk(const int *Pins, int Num, int Dir)
+{
+    return GPIOD_Request(Pins, Num, Dir == GPIOD_IN ? GPIOD_IN : GPIOD_OUT);
+}
+
+/*
+ * Input with both edge events, GPIOD_Wait() sleeps on them.
+ * The value stays readable with GPIOD_Read().
+ */
+int GPIOD_Events(int Pin)
+{
+    return GPIOD_Request(&Pin, 1, GPIOD_EVENTS);
+}
+
+/*
+ * Sleeps until the pin reads Value.
+ * 0: done, 1: timeout, -1: the pin was not requested with GPIOD_Events()
+ */
+int GPIOD_Wait(int Pin, int Value, int Timeout_ms)
+{
+    struct timespec now, end, left;
+    int value;
+
+    if (!GPIOD_Requested(Pin) || !GPIOD_Edges[Pin])
         return -1;
-    }
 
-    if(Dir == GPIOD_IN)
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += Timeout_ms / 1000;
+    end.tv_nsec += (Timeout_ms % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L)
     {
-        ret = gpiod_line_request_input(gpioline, "gpio");
-        if (ret != 0)
-        {
-            GPIOD_Debug( "Export Failed: Pin%d\n", Pin);
-            return -1;
-        }        
-        GPIOD_Debug("Pin%d:intput\r\n", Pin);
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
     }
-    else
+
+    for (;;)
     {
-        ret = gpiod_line_request_output(gpioline, "gpio", 0);
-        if (ret != 0)
+        //events queued before this wait only cost one more look at the pin
+        value = GPIOD_Read(Pin);
+        if (value < 0)
+            return -1;
+        if (value == Value)
+            return 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = end.tv_sec - now.tv_sec;
+        left.tv_nsec = end.tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0)
         {
-            GPIOD_Debug( "Export Failed: Pin%d\n", Pin);
+            left.tv_sec--;
+            left.tv_nsec += 1000000000L;
+        }
+        if (left.tv_sec < 0)
+            return 1;
+
+#if GPIOD_V1
+        struct gpiod_line_event event;
+        value = gpiod_line_event_wait(GPIOD_Lines[Pin], &left);
+        if (value < 0)
+            return -1;
+        if (value == 0)
+            return (GPIOD_Read(Pin) == Value) ? 0 : 1;
+        if (gpiod_line_event_read(GPIOD_Lines[Pin], &event) != 0)
             return -1;
-        }        
-        GPIOD_Debug("Pin%d:Output\r\n", Pin);
+#else
+        value = gpiod_line_request_wait_edge_events(GPIOD_Requests[Pin],
+                    (int64_t)left.tv_sec * 1000000000LL + left.tv_nsec);
+        if (value < 0)
+            return -1;
+        if (value == 0)
+            return (GPIOD_Read(Pin) == Value) ? 0 : 1;
+        if (GPIOD_Event_Buffer == NULL ||
+            gpiod_line_request_read_edge_events(GPIOD_Requests[Pin], GPIOD_Event_Buffer, GPIOD_EVENT_NUM) < 0)
+            return -1;
+#endif
     }
-    return 0;
 }
 
 int GPIOD_Read(int Pin)
 {
-    gpioline = gpiod_chip_get_line(gpiochip, Pin);
-    if (gpioline == NULL)
+    if (!GPIOD_Requested(Pin))
     {
-        GPIOD_Debug( "Export Failed: Pin%d\n", Pin);
+        GPIOD_Debug( "Read Failed: Pin%d not exported\n", Pin);
         return -1;
     }
 
-    ret = gpiod_line_get_value(gpioline);
+#if GPIOD_V1
+    ret = gpiod_line_get_value(GPIOD_Lines[Pin]);
+#else
+    ret = gpiod_line_request_get_value(GPIOD_Requests[Pin], Pin);
+#endif
     if (ret < 0)
     {
         GPIOD_Debug( "failed to read value!\n");
@@ -153,14 +363,18 @@ int GPIOD_Read(int Pin)
 
 int GPIOD_Write(int Pin, int value)
 {
-    gpioline = gpiod_chip_get_line(gpiochip, Pin);
-    if (gpioline == NULL)
+    if (!GPIOD_Requested(Pin))
     {
-        GPIOD_Debug( "Export Failed: Pin%d\n", Pin);
+        GPIOD_Debug( "Write Failed: Pin%d not exported\n", Pin);
         return -1;
-    }     
+    }
 
-    ret = gpiod_line_set_value(gpioline, value);
+#if GPIOD_V1
+    ret = gpiod_line_set_value(GPIOD_Lines[Pin], value);
+#else
+    ret = gpiod_line_request_set_value(GPIOD_Requests[Pin], Pin,
+              value ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE);
+#endif
     if (ret != 0)
     {
         GPIOD_Debug( "failed to write value! : Pin%d\n", Pin);
@@ -34,8 +34,19 @@
 #include <stdio.h>
 #include <gpiod.h>
 
+//libgpiod v2 dropped the line bulk API
+#ifdef GPIOD_LINE_BULK_MAX_LINES
+	#define GPIOD_V1 1
+#else
+	#define GPIOD_V1 0
+#endif
+
 #define GPIOD_IN  0
 #define GPIOD_OUT 1
+#define GPIOD_EVENTS 2
+
+#define GPIOD_PIN_NUM   64  //cached line handles, by offset
+#define GPIOD_EVENT_NUM 16  //edge events read at once (v2)
 
 #define GPIOD_LOW  0
 #define GPIOD_HIGH 1
@@ -82,7 +93,10 @@ int GPIOD_Export();
 int GPIOD_Unexport(int Pin);
 int GPIOD_Unexport_GPIO(void);
 int GPIOD_Direction(int Pin, int Dir);
+int GPIOD_Direction_Bulk(const int *Pins, int Num, int Dir);
 int GPIOD_Read(int Pin);
 int GPIOD_Write(int Pin, int value);
+int GPIOD_Events(int Pin);
+int GPIOD_Wait(int Pin, int Value, int Timeout_ms);
 
 #endif
\ No newline at end of file
@@ -38,6 +38,7 @@
 #include <unistd.h> 
 #include <stdio.h> 
 #include <stdlib.h> 
+#include <string.h>
 #include <getopt.h> 
 #include <fcntl.h> 
 #include <sys/ioctl.h> 
@@ -57,6 +58,27 @@ static uint8_t bits = 8;
 
 struct spi_ioc_transfer tr;
 
+/******************************************************************************
+function:   Read the spidev message size limit
+parameter:
+Info:
+    spidev rejects an SPI_IOC_MESSAGE whose transfers add up to more than
+    bufsiz bytes (default 4096, raise with spidev.bufsiz= in cmdline.txt)
+******************************************************************************/
+static uint32_t DEV_HARDWARE_SPI_ReadBufsiz(void)
+{
+    unsigned long bufsiz = 0;
+    FILE *fp = fopen(SPI_BUFSIZ_PATH, "r");
+    if(fp != NULL) {
+        if(fscanf(fp, "%lu", &bufsiz) != 1)
+            bufsiz = 0;
+        fclose(fp);
+    }
+    if(bufsiz == 0)
+        bufsiz = SPI_BUFSIZ_DEFAULT;
+    DEV_HARDWARE_SPI_Debug("spidev bufsiz = %lu\r\n", bufsiz);
+    return bufsiz;
+}
 
 /******************************************************************************
 function:   SPI port initialization
@@ -80,6 +102,7 @@ void DEV_HARDWARE_SPI_begin(char *SPI_device)
         DEV_HARDWARE_SPI_Debug("open : %s\r\n", SPI_device);
     }
     hardware_SPI.mode = 0;
+    hardware_SPI.bufsiz = DEV_HARDWARE_SPI_ReadBufsiz();
     
     ret = ioctl(hardware_SPI.fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
     if (ret == -1) {
@@ -112,6 +135,7 @@ void DEV_HARDWARE_SPI_beginSet(char *SPI_device, SPIMode mode, uint32_t speed)
     } else {
         DEV_HARDWARE_SPI_Debug("open : %s\r\n", SPI_device);
     }
+    hardware_SPI.bufsiz = DEV_HARDWARE_SPI_ReadBufsiz();
     
     ret = ioctl(hardware_SPI.fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
     if (ret == -1) 
@@ -364,3 +388,47 @@ int DEV_HARDWARE_SPI_Transfer(uint8_t *buf, uint32_t len)
     return 1;
 }
 
+/******************************************************************************
+function: The SPI port writes a buffer, nothing is read back
+parameter:
+    buf :   Sent data
+    len :   Number of bytes
+Info:
+    Chains up to SPI_SEGMENTS_MAX transfers per SPI_IOC_MESSAGE, as many as
+    fit in bufsiz, so a large bufsiz means few syscalls per frame.
+    CS is driven by the caller, the gaps between messages do not matter.
+    Return 1 success
+    Return -1 failed
+******************************************************************************/
+int DEV_HARDWARE_SPI_Write(const uint8_t *buf, uint32_t len)
+{
+    struct spi_ioc_transfer seg[SPI_SEGMENTS_MAX];
+    uint32_t bufsiz = hardware_SPI.bufsiz ? hardware_SPI.bufsiz : SPI_BUFSIZ_DEFAULT;
+    uint32_t seg_max = bufsiz < SPI_SEGMENT_MAX ? bufsiz : SPI_SEGMENT_MAX;
+
+    while(len > 0) {
+        uint32_t n = 0, total = 0;
+
+        memset(seg, 0, sizeof(seg));
+        while(n < SPI_SEGMENTS_MAX && len > 0 && total < bufsiz) {
+            uint32_t l = len < seg_max ? len : seg_max;
+            if(l > bufsiz - total)
+                l = bufsiz - total;
+            seg[n].tx_buf = (unsigned long)buf;
+            seg[n].len = l;
+            seg[n].speed_hz = hardware_SPI.speed;
+            seg[n].bits_per_word = bits;
+            buf += l;
+            len -= l;
+            total += l;
+            n++;
+        }
+
+        if(ioctl(hardware_SPI.fd, SPI_IOC_MESSAGE(n), seg) < (int)total) {
+            DEV_HARDWARE_SPI_Debug("can't send spi message\r\n");
+            return -1;
+        }
+    }
+    return 1;
+}
+
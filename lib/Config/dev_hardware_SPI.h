@@ -47,6 +47,11 @@
 #define SPI_MODE_2      (SPI_CPOL|0)
 #define SPI_MODE_3      (SPI_CPOL|SPI_CPHA)
 
+#define SPI_BUFSIZ_PATH     "/sys/module/spidev/parameters/bufsiz"
+#define SPI_BUFSIZ_DEFAULT  4096        //spidev default, bytes per SPI_IOC_MESSAGE
+#define SPI_SEGMENT_MAX     65532       //bytes per spi_ioc_transfer, below the DMA limit
+#define SPI_SEGMENTS_MAX    16          //spi_ioc_transfers chained in one SPI_IOC_MESSAGE
+
 typedef enum{
     SPI_MODE0 = SPI_MODE_0,  /*!< CPOL = 0, CPHA = 0 */
     SPI_MODE1 = SPI_MODE_1,  /*!< CPOL = 0, CPHA = 1 */
@@ -94,6 +99,7 @@ typedef struct SPIStruct {
     uint32_t speed;
     uint16_t mode;
     uint16_t delay;
+    uint32_t bufsiz;    //spidev limit for the bytes of one SPI_IOC_MESSAGE
     int fd; //
 } HARDWARE_SPI;
 
@@ -108,6 +114,7 @@ int DEV_HARDWARE_SPI_setSpeed(uint32_t speed);
 
 uint8_t DEV_HARDWARE_SPI_TransferByte(uint8_t buf);
 int DEV_HARDWARE_SPI_Transfer(uint8_t *buf, uint32_t len);
+int DEV_HARDWARE_SPI_Write(const uint8_t *buf, uint32_t len);
 
 void DEV_HARDWARE_SPI_SetDataInterval(uint16_t us);
 int DEV_HARDWARE_SPI_SetBusMode(BusMode mode);
@@ -0,0 +1,711 @@
+/*****************************************************************************
+* | File        :   dev_sim_IT8951.c
+* | Function    :   Simulated IT8951 controller (LIB=SIM)
+* | Info        :
+*----------------
+* |	This version:   V1.0
+* | Date        :   2026-10-17
+* | Info        :   Basic version
+*
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documnetation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to  whom the Software is
+# furished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS OR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+******************************************************************************/
+#include "dev_sim_IT8951.h"
+#include "DEV_Config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//I80 command codes and registers, kept in sync with EPD_IT8951.h
+#define SIM_CMD_SYS_RUN        0x0001
+#define SIM_CMD_STANDBY        0x0002
+#define SIM_CMD_SLEEP          0x0003
+#define SIM_CMD_REG_RD         0x0010
+#define SIM_CMD_REG_WR         0x0011
+#define SIM_CMD_MEM_BST_END    0x0015
+#define SIM_CMD_LD_IMG         0x0020
+#define SIM_CMD_LD_IMG_AREA    0x0021
+#define SIM_CMD_LD_IMG_END     0x0022
+#define SIM_CMD_DPY_AREA       0x0034
+#define SIM_CMD_DPY_BUF_AREA   0x0037
+#define SIM_CMD_VCOM           0x0039
+#define SIM_CMD_GET_DEV_INFO   0x0302
+
+#define SIM_REG_I80CPCR        0x0004
+#define SIM_REG_LISAR          0x0208
+#define SIM_REG_UP1SR          0x1138
+#define SIM_REG_LUTAFSR        0x1224
+#define SIM_REG_BGVR           0x1250
+#define SIM_REG_SPACE          0x1400
+
+#define SIM_PREAMBLE_CMD       0x6000
+#define SIM_PREAMBLE_WRITE     0x0000
+#define SIM_PREAMBLE_READ      0x1000
+
+#define SIM_LDIMG_B_ENDIAN     1
+#define SIM_READ_QUEUE_LEN     32
+
+//Controller timing, ns
+#define SIM_CMD_READY_NS       2000     //HRDY low after a command or argument word
+#define SIM_LD_END_READY_NS    20000    //HRDY low after LD_IMG_END
+#define SIM_SPI_CALL_NS        500      //Host overhead per SPI call
+#define SIM_GPIO_NS            100      //Host overhead per GPIO access
+
+typedef enum {
+    SIM_STATE_IDLE = 0,     //waiting for a command
+    SIM_STATE_ARGS,         //collecting command arguments
+    SIM_STATE_LOAD,         //receiving pixel data
+} SIM_STATE;
+
+static struct {
+    //panel and memory
+    uint16_t Panel_W;
+    uint16_t Panel_H;
+    uint8_t *Memory;
+    uint8_t *Panel;
+    char LUT_Version[16];
+    uint8_t A2_Mode;
+    uint16_t VCOM;
+    uint16_t Reg[SIM_REG_SPACE / 2];
+
+    //host interface
+    uint8_t CS_Low;
+    uint8_t RST;
+    uint32_t Byte_Index;
+    uint16_t Preamble;
+    uint16_t Word;
+    uint16_t Read_Queue[SIM_READ_QUEUE_LEN];
+    uint32_t Read_Len;
+    uint32_t Read_Pos;
+
+    //command decoding
+    SIM_STATE State;
+    uint16_t Command;
+    uint16_t Args[8];
+    uint32_t Arg_Num;
+    uint32_t Arg_Index;
+
+    //image load
+    uint32_t Load_Addr;
+    uint16_t Load_X, Load_Y, Load_W, Load_H;
+    uint8_t Load_BPP;
+    uint8_t Load_Endian;
+    uint32_t Load_Row;
+    uint32_t Load_Col;
+    uint32_t Load_Row_Pixels;   //pixels per row including word padding
+
+    //timing
+    uint64_t Now_ns;
+    uint64_t HRDY_Until_ns;
+    uint64_t LUT_Until_ns;
+    uint32_t SPI_Hz;
+    uint32_t SPI_Max_Hz;        //MISO data is corrupted above this clock, 0 = no limit
+    uint32_t GPIO_ns;
+    SIM_Refresh_Time Refresh[SIM_IT8951_MODE_NUM];
+    const char *PGM_Path;
+
+    SIM_IT8951_Stats Stats;
+} sim;
+
+/******************************************************************************
+function:   Clock helpers
+******************************************************************************/
+static void SIM_Advance(uint64_t ns)
+{
+    sim.Now_ns += ns;
+}
+
+static uint64_t SIM_Byte_ns(void)
+{
+    return 8000000000ULL / sim.SPI_Hz;
+}
+
+static void SIM_Set_HRDY_Busy(uint64_t ns)
+{
+    sim.HRDY_Until_ns = sim.Now_ns + ns;
+}
+
+static void SIM_Error(const char *What)
+{
+    sim.Stats.Errors++;
+    SIM_IT8951_Debug("SIM error: %s (cmd 0x%04x)\r\n", What, sim.Command);
+    (void)What;
+}
+
+/******************************************************************************
+function:   Register file
+******************************************************************************/
+static uint16_t SIM_Read_Reg(uint16_t Addr)
+{
+    if(Addr == SIM_REG_LUTAFSR)
+        return (sim.Now_ns < sim.LUT_Until_ns) ? 0x0001 : 0x0000;
+    if(Addr >= SIM_REG_SPACE) {
+        SIM_Error("register read out of range");
+        return 0;
+    }
+    return sim.Reg[Addr / 2];
+}
+
+static void SIM_Write_Reg(uint16_t Addr, uint16_t Value)
+{
+    if(Addr >= SIM_REG_SPACE) {
+        SIM_Error("register write out of range");
+        return;
+    }
+    sim.Reg[Addr / 2] = Value;
+}
+
+static uint32_t SIM_LISAR(void)
+{
+    return sim.Reg[SIM_REG_LISAR / 2] | ((uint32_t)sim.Reg[(SIM_REG_LISAR + 2) / 2] << 16);
+}
+
+static void SIM_Queue_Read(const uint16_t *Words, uint32_t Len)
+{
+    if(Len > SIM_READ_QUEUE_LEN)
+        Len = SIM_READ_QUEUE_LEN;
+    memcpy(sim.Read_Queue, Words, Len * sizeof(uint16_t));
+    sim.Read_Len = Len;
+}
+
+static void SIM_Queue_String(uint16_t *Words, const char *Str)
+{
+    //8 words, little endian bytes in host memory as the driver reads them back
+    char Buf[16] = {0};
+    memcpy(Buf, Str, strnlen(Str, sizeof(Buf) - 1));
+    for(int i = 0; i < 8; i++)
+        Words[i] = (uint8_t)Buf[2 * i] | ((uint16_t)(uint8_t)Buf[2 * i + 1] << 8);
+}
+
+/******************************************************************************
+function:   Display an area of image memory on the panel
+******************************************************************************/
+static void SIM_Display(uint16_t X, uint16_t Y, uint16_t W, uint16_t H, uint16_t Mode, uint32_t Addr)
+{
+    int One_BPP = (sim.Reg[(SIM_REG_UP1SR + 2) / 2] & (1 << 2)) != 0;
+    uint16_t BGVR = sim.Reg[SIM_REG_BGVR / 2];
+    uint64_t Area = (uint64_t)W * H;
+    uint64_t Panel_Area = (uint64_t)sim.Panel_W * sim.Panel_H;
+
+    if(Mode >= SIM_IT8951_MODE_NUM || (uint32_t)X + W > sim.Panel_W || (uint32_t)Y + H > sim.Panel_H) {
+        SIM_Error("display area out of range");
+        return;
+    }
+
+    for(uint32_t j = Y; j < (uint32_t)Y + H; j++) {
+        for(uint32_t i = X; i < (uint32_t)X + W; i++) {
+            uint8_t Value;
+            uint32_t Offset = Addr + j * sim.Panel_W + (One_BPP ? i / 8 : i);
+            if(Offset >= SIM_IT8951_MEMORY_SIZE) {
+                SIM_Error("display reads outside image memory");
+                return;
+            }
+            if(One_BPP)
+                Value = ((sim.Memory[Offset] >> (i % 8)) & 1) ? (BGVR >> 8) : (BGVR & 0xFF);
+            else
+                Value = sim.Memory[Offset];
+
+            if(Mode == 0)
+                Value = 0xF0;                           //INIT clears to white
+            else if(Mode == 1 || Mode == sim.A2_Mode)
+                Value = (Value >= 0x80) ? 0xF0 : 0x00;  //DU and A2 are black/white only
+            sim.Panel[j * sim.Panel_W + i] = Value & 0xF0;
+        }
+    }
+
+    uint64_t Refresh_ns = ((uint64_t)sim.Refresh[Mode].Base_ms +
+        (uint64_t)sim.Refresh[Mode].Area_ms * Area / Panel_Area) * 1000000ULL;
+    //LUT engines run in parallel, the controller is free once the longest one ends
+    if(sim.Now_ns + Refresh_ns > sim.LUT_Until_ns)
+        sim.LUT_Until_ns = sim.Now_ns + Refresh_ns;
+
+    sim.Stats.Refreshes++;
+    sim.Stats.Refresh_ns += Refresh_ns;
+
+    if(sim.PGM_Path != NULL)
+        SIM_IT8951_Dump_PGM(sim.PGM_Path);
+}
+
+/******************************************************************************
+function:   Image load
+******************************************************************************/
+static void SIM_Load_Start(uint16_t Arg, uint16_t X, uint16_t Y, uint16_t W, uint16_t H)
+{
+    static const uint8_t BPP[4] = {2, 3, 4, 8};
+    sim.Load_Endian = (Arg >> 8) & 0x1;
+    sim.Load_BPP = BPP[(Arg >> 4) & 0x3];
+    sim.Load_X = X;
+    sim.Load_Y = Y;
+    sim.Load_W = W;
+    sim.Load_H = H;
+    sim.Load_Row = 0;
+    sim.Load_Col = 0;
+    sim.Load_Addr = SIM_LISAR();
+    //rows are padded to whole 16-bit words
+    sim.Load_Row_Pixels = ((W * sim.Load_BPP + 15) / 16) * (16 / sim.Load_BPP);
+    sim.State = SIM_STATE_LOAD;
+
+    if(sim.Load_BPP == 3)
+        SIM_Error("3bpp load is not emulated");
+    if((uint32_t)X + W > sim.Panel_W || (uint32_t)Y + H > sim.Panel_H)
+        SIM_Error("load area out of range");
+}
+
+static void SIM_Load_Word(uint16_t Word)
+{
+    if(sim.Load_BPP == 3)
+        return;
+    if(sim.Load_Endian == SIM_LDIMG_B_ENDIAN)
+        Word = (Word >> 8) | (Word << 8);
+
+    uint32_t Pixels = 16 / sim.Load_BPP;
+    uint16_t Mask = (1 << sim.Load_BPP) - 1;
+    for(uint32_t k = 0; k < Pixels; k++) {
+        if(sim.Load_Row >= sim.Load_H) {
+            SIM_Error("more pixel data than the load area");
+            return;
+        }
+        if(sim.Load_Col < sim.Load_W) {
+            uint32_t Offset = sim.Load_Addr + (sim.Load_Y + sim.Load_Row) * sim.Panel_W + sim.Load_X + sim.Load_Col;
+            uint8_t Value = (Word >> (k * sim.Load_BPP)) & Mask;
+            if(Offset < SIM_IT8951_MEMORY_SIZE) {
+                //the controller keeps 8bpp internally, narrower formats fill the high bits
+                sim.Memory[Offset] = Value << (8 - sim.Load_BPP);
+                sim.Stats.Pixels_Loaded++;
+            } else {
+                SIM_Error("load writes outside image memory");
+            }
+        }
+        if(++sim.Load_Col == sim.Load_Row_Pixels) {
+            sim.Load_Col = 0;
+            sim.Load_Row++;
+        }
+    }
+}
+
+static void SIM_Load_End(void)
+{
+    if(sim.State != SIM_STATE_LOAD || sim.Load_Row != sim.Load_H || sim.Load_Col != 0)
+        SIM_Error("LD_IMG_END before the load area was complete");
+    sim.State = SIM_STATE_IDLE;
+}
+
+/******************************************************************************
+function:   I80 command decoding
+******************************************************************************/
+static void SIM_Execute(void)
+{
+    uint16_t *a = sim.Args;
+    uint16_t Info[20];
+
+    switch(sim.Command) {
+    case SIM_CMD_REG_RD:
+        Info[0] = SIM_Read_Reg(a[0]);
+        SIM_Queue_Read(Info, 1);
+        break;
+    case SIM_CMD_REG_WR:
+        SIM_Write_Reg(a[0], a[1]);
+        break;
+    case SIM_CMD_VCOM:
+        if(a[0] == 0) {
+            SIM_Queue_Read(&sim.VCOM, 1);
+        } else if(sim.Arg_Num == 1) {
+            //set VCOM needs one more argument
+            sim.Arg_Num = 2;
+            return;
+        } else {
+            sim.VCOM = a[1];
+        }
+        break;
+    case SIM_CMD_LD_IMG:
+        SIM_Load_Start(a[0], 0, 0, sim.Panel_W, sim.Panel_H);
+        return;
+    case SIM_CMD_LD_IMG_AREA:
+        SIM_Load_Start(a[0], a[1], a[2], a[3], a[4]);
+        return;
+    case SIM_CMD_DPY_AREA:
+        SIM_Display(a[0], a[1], a[2], a[3], a[4], SIM_IT8951_MEMORY_ADDR);
+        break;
+    case SIM_CMD_DPY_BUF_AREA:
+        SIM_Display(a[0], a[1], a[2], a[3], a[4], a[5] | ((uint32_t)a[6] << 16));
+        break;
+    case SIM_CMD_GET_DEV_INFO:
+        Info[0] = sim.Panel_W;
+        Info[1] = sim.Panel_H;
+        Info[2] = SIM_IT8951_MEMORY_ADDR & 0xFFFF;
+        Info[3] = SIM_IT8951_MEMORY_ADDR >> 16;
+        SIM_Queue_String(&Info[4], "SIM_IT8951");
+        SIM_Queue_String(&Info[12], sim.LUT_Version);
+        SIM_Queue_Read(Info, 20);
+        break;
+    default:
+        break;
+    }
+    sim.State = SIM_STATE_IDLE;
+}
+
+static void SIM_Command(uint16_t Command)
+{
+    sim.Stats.Commands++;
+    if(sim.State == SIM_STATE_LOAD && Command != SIM_CMD_LD_IMG_END)
+        SIM_Error("command during image load");
+
+    sim.Command = Command;
+    sim.Arg_Index = 0;
+    sim.Read_Len = 0;
+    SIM_Set_HRDY_Busy(SIM_CMD_READY_NS);
+
+    switch(Command) {
+    case SIM_CMD_REG_RD:      sim.Arg_Num = 1; break;
+    case SIM_CMD_REG_WR:      sim.Arg_Num = 2; break;
+    case SIM_CMD_VCOM:        sim.Arg_Num = 1; break;
+    case SIM_CMD_LD_IMG:      sim.Arg_Num = 1; break;
+    case SIM_CMD_LD_IMG_AREA: sim.Arg_Num = 5; break;
+    case SIM_CMD_DPY_AREA:    sim.Arg_Num = 5; break;
+    case SIM_CMD_DPY_BUF_AREA:sim.Arg_Num = 7; break;
+    case SIM_CMD_LD_IMG_END:
+        SIM_Load_End();
+        SIM_Set_HRDY_Busy(SIM_LD_END_READY_NS);
+        return;
+    case SIM_CMD_GET_DEV_INFO:
+    case SIM_CMD_SYS_RUN:
+    case SIM_CMD_STANDBY:
+    case SIM_CMD_SLEEP:
+    case SIM_CMD_MEM_BST_END:
+        sim.Arg_Num = 0;
+        SIM_Execute();
+        return;
+    default:
+        SIM_Error("unknown command");
+        sim.Arg_Num = 0;
+        sim.State = SIM_STATE_IDLE;
+        return;
+    }
+    sim.State = SIM_STATE_ARGS;
+}
+
+static void SIM_Data(uint16_t Word)
+{
+    switch(sim.State) {
+    case SIM_STATE_LOAD:
+        SIM_Load_Word(Word);
+        break;
+    case SIM_STATE_ARGS:
+        SIM_Set_HRDY_Busy(SIM_CMD_READY_NS);
+        sim.Args[sim.Arg_Index++] = Word;
+        if(sim.Arg_Index == sim.Arg_Num)
+            SIM_Execute();
+        break;
+    default:
+        SIM_Error("data without a command");
+        break;
+    }
+}
+
+/******************************************************************************
+function:   SPI byte stream
+Info:
+    Every CS low period starts with a 16-bit preamble (command, write data or
+    read data) followed by 16-bit words, most significant byte first.
+******************************************************************************/
+static uint8_t SIM_Byte(uint8_t Value)
+{
+    uint8_t Out = 0x00;
+    uint32_t Index = sim.Byte_Index++;
+
+    if(!sim.CS_Low) {
+        SIM_Error("SPI transfer with CS high");
+        return 0x00;
+    }
+
+    if(Index < 2) {
+        sim.Preamble = (sim.Preamble << 8) | Value;
+        sim.Stats.Bytes_Written++;
+        return 0x00;
+    }
+
+    if(sim.Preamble == SIM_PREAMBLE_READ) {
+        //first word is a dummy, the queued words follow
+        uint32_t Word_Index = (Index - 2) / 2;
+        uint16_t Word = 0;
+        if(Word_Index > 0 && Word_Index - 1 < sim.Read_Len)
+            Word = sim.Read_Queue[Word_Index - 1];
+        else if(Word_Index > 0)
+            SIM_Error("read past the available data");
+        Out = (Index % 2 == 0) ? (Word >> 8) : (Word & 0xFF);
+        sim.Stats.Bytes_Read++;
+        return Out;
+    }
+
+    sim.Stats.Bytes_Written++;
+    sim.Word = (sim.Word << 8) | Value;
+    if(Index % 2 == 0)
+        return 0x00;
+
+    if(sim.Preamble == SIM_PREAMBLE_CMD)
+        SIM_Command(sim.Word);
+    else if(sim.Preamble == SIM_PREAMBLE_WRITE)
+        SIM_Data(sim.Word);
+    else
+        SIM_Error("unknown preamble");
+    return 0x00;
+}
+
+/******************************************************************************
+function:   DEV_Config hooks
+******************************************************************************/
+void SIM_IT8951_Digital_Write(uint16_t Pin, uint8_t Value)
+{
+    SIM_Advance(sim.GPIO_ns);
+
+    if(Pin == EPD_CS_PIN) {
+        if(!Value && !sim.CS_Low) {
+            sim.Byte_Index = 0;
+            sim.Preamble = 0;
+            sim.Stats.CS_Transactions++;
+        } else if(Value && sim.CS_Low && sim.Byte_Index % 2 != 0) {
+            SIM_Error("CS released in the middle of a word");
+        }
+        sim.CS_Low = !Value;
+    } else if(Pin == EPD_RST_PIN) {
+        if(!Value && sim.RST) {
+            //reset: registers and decoder go back to power-on state
+            memset(sim.Reg, 0, sizeof(sim.Reg));
+            sim.State = SIM_STATE_IDLE;
+            sim.LUT_Until_ns = 0;
+        }
+        sim.RST = Value;
+    }
+}
+
+uint8_t SIM_IT8951_Digital_Read(uint16_t Pin)
+{
+    SIM_Advance(sim.GPIO_ns);
+
+    if(Pin != EPD_BUSY_PIN)
+        return 0;
+    if(sim.Now_ns >= sim.HRDY_Until_ns)
+        return 1;
+
+    //report busy once, then let the poll loop find the pin ready
+    sim.Stats.Busy_Polls++;
+    sim.Stats.Busy_Wait_ns += sim.HRDY_Until_ns - sim.Now_ns;
+    sim.Now_ns = sim.HRDY_Until_ns;
+    return 0;
+}
+
+uint8_t SIM_IT8951_TransferByte(uint8_t Value)
+{
+    sim.Stats.SPI_Calls++;
+    SIM_Advance(SIM_SPI_CALL_NS + SIM_Byte_ns());
+    uint8_t Read_Value = SIM_Byte(Value);
+    if(sim.SPI_Max_Hz != 0 && sim.SPI_Hz > sim.SPI_Max_Hz)
+        Read_Value ^= 0x01;
+    return Read_Value;
+}
+
+void SIM_IT8951_WriteBuffer(const uint8_t *Buf, uint32_t Len)
+{
+    sim.Stats.SPI_Calls++;
+    SIM_Advance(SIM_SPI_CALL_NS + SIM_Byte_ns() * Len);
+    for(uint32_t i = 0; i < Len; i++)
+        SIM_Byte(Buf[i]);
+}
+
+void SIM_IT8951_Delay_ns(uint64_t ns)
+{
+    SIM_Advance(ns);
+}
+
+/******************************************************************************
+function:   Configuration
+******************************************************************************/
+void SIM_IT8951_Set_Panel(uint16_t Width, uint16_t Height)
+{
+    if(Width == 0 || Height == 0)
+        return;
+    free(sim.Panel);
+    sim.Panel_W = Width;
+    sim.Panel_H = Height;
+    sim.Panel = malloc((size_t)Width * Height);
+    if(sim.Panel != NULL)
+        memset(sim.Panel, 0xF0, (size_t)Width * Height);
+
+    //LUT versions as reported by the Waveshare panels of that size
+    const char *LUT = "M841";
+    sim.A2_Mode = 6;
+    if(Width == 800 && Height == 600) {
+        LUT = "M641";
+        sim.A2_Mode = 4;
+    } else if(Width == 1448 && Height == 1072) {
+        LUT = "M841_TFAB512";
+    } else if(Width == 1872 && Height == 1404) {
+        LUT = "M841_TFA5210";
+    }
+    strncpy(sim.LUT_Version, LUT, sizeof(sim.LUT_Version) - 1);
+}
+
+void SIM_IT8951_Set_SPI_Clock(uint32_t Hz)
+{
+    if(Hz > 0)
+        sim.SPI_Hz = Hz;
+}
+
+uint32_t SIM_IT8951_Get_SPI_Clock(void)
+{
+    return sim.SPI_Hz;
+}
+
+void SIM_IT8951_Set_GPIO_Cost(uint32_t ns)
+{
+    sim.GPIO_ns = ns;
+}
+
+void SIM_IT8951_Set_Refresh_Time(uint8_t Mode, uint32_t Base_ms, uint32_t Area_ms)
+{
+    if(Mode < SIM_IT8951_MODE_NUM) {
+        sim.Refresh[Mode].Base_ms = Base_ms;
+        sim.Refresh[Mode].Area_ms = Area_ms;
+    }
+}
+
+static void SIM_Parse_Refresh(const char *Spec)
+{
+    //"mode=base_ms[+area_ms],..."
+    const char *p = Spec;
+    while(p != NULL && *p) {
+        unsigned Mode, Base, Area = 0;
+        int n = sscanf(p, "%u=%u+%u", &Mode, &Base, &Area);
+        if(n >= 2 && Mode < SIM_IT8951_MODE_NUM)
+            SIM_IT8951_Set_Refresh_Time(Mode, Base, n == 3 ? Area : 0);
+        p = strchr(p, ',');
+        if(p != NULL)
+            p++;
+    }
+}
+
+/******************************************************************************
+function:   Initialization
+******************************************************************************/
+void SIM_IT8951_Init(void)
+{
+    //Roughly the 10.3inch panel timings, INIT DU GC16 GL16 GLR16 GLD16 A2
+    static const SIM_Refresh_Time Default_Refresh[SIM_IT8951_MODE_NUM] = {
+        {1600, 400}, {180, 80}, {300, 150}, {300, 150},
+        {300, 150}, {300, 150}, {80, 40}, {300, 150},
+    };
+    const char *Env;
+    unsigned W = 1872, H = 1404;
+
+    free(sim.Memory);
+    free(sim.Panel);
+    memset(&sim, 0, sizeof(sim));
+
+    //pages are only touched when written, so a 64MB SDRAM costs what is used
+    sim.Memory = calloc(1, SIM_IT8951_MEMORY_SIZE);
+    if(sim.Memory == NULL) {
+        printf("SIM: failed to allocate image memory\r\n");
+        exit(1);
+    }
+    sim.RST = 1;
+    sim.VCOM = 1500;
+    sim.SPI_Hz = SIM_IT8951_SPI_HZ;
+    sim.GPIO_ns = SIM_GPIO_NS;
+    memcpy(sim.Refresh, Default_Refresh, sizeof(sim.Refresh));
+
+    if((Env = getenv("IT8951_SIM_PANEL")) != NULL)
+        sscanf(Env, "%ux%u", &W, &H);
+    SIM_IT8951_Set_Panel(W, H);
+    if((Env = getenv("IT8951_SIM_LUT")) != NULL)
+        strncpy(sim.LUT_Version, Env, sizeof(sim.LUT_Version) - 1);
+    if((Env = getenv("IT8951_SIM_SPI_HZ")) != NULL)
+        SIM_IT8951_Set_SPI_Clock(strtoul(Env, NULL, 10));
+    if((Env = getenv("IT8951_SIM_SPI_MAX_HZ")) != NULL)
+        sim.SPI_Max_Hz = strtoul(Env, NULL, 10);
+    if((Env = getenv("IT8951_SIM_GPIO_NS")) != NULL)
+        SIM_IT8951_Set_GPIO_Cost(strtoul(Env, NULL, 10));
+    if((Env = getenv("IT8951_SIM_REFRESH")) != NULL)
+        SIM_Parse_Refresh(Env);
+    sim.PGM_Path = getenv("IT8951_SIM_PGM");
+
+    printf("SIM: IT8951 %dx%d, LUT %s, SPI %u Hz\r\n",
+        sim.Panel_W, sim.Panel_H, sim.LUT_Version, sim.SPI_Hz);
+}
+
+void SIM_IT8951_Exit(void)
+{
+    printf("SIM: %llu refreshes, %llu bytes written, %.3f s simulated\r\n",
+        (unsigned long long)sim.Stats.Refreshes, (unsigned long long)sim.Stats.Bytes_Written,
+        sim.Now_ns / 1e9);
+    free(sim.Memory);
+    free(sim.Panel);
+    sim.Memory = NULL;
+    sim.Panel = NULL;
+}
+
+/******************************************************************************
+function:   Inspection
+******************************************************************************/
+uint64_t SIM_IT8951_Now_ns(void)
+{
+    return sim.Now_ns;
+}
+
+void SIM_IT8951_Get_Stats(SIM_IT8951_Stats *Stats)
+{
+    *Stats = sim.Stats;
+}
+
+void SIM_IT8951_Reset_Stats(void)
+{
+    memset(&sim.Stats, 0, sizeof(sim.Stats));
+}
+
+const uint8_t *SIM_IT8951_Memory(uint32_t Addr)
+{
+    if(sim.Memory == NULL || Addr >= SIM_IT8951_MEMORY_SIZE)
+        return NULL;
+    return sim.Memory + Addr;
+}
+
+const uint8_t *SIM_IT8951_Panel(void)
+{
+    return sim.Panel;
+}
+
+/******************************************************************************
+function:   Write the panel content as a binary PGM
+Info:       Return 0 success, -1 failed
+******************************************************************************/
+int SIM_IT8951_Dump_PGM(const char *Path)
+{
+    FILE *fp = fopen(Path, "wb");
+    if(fp == NULL)
+        return -1;
+
+    fprintf(fp, "P5\n%d %d\n255\n", sim.Panel_W, sim.Panel_H);
+    for(uint32_t i = 0; i < (uint32_t)sim.Panel_W * sim.Panel_H; i++)
+        fputc((sim.Panel[i] >> 4) * 17, fp);
+
+    int ret = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    return ret;
+}
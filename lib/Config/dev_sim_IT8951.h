@@ -0,0 +1,113 @@
+/*****************************************************************************
+* | File        :   dev_sim_IT8951.h
+* | Function    :   Simulated IT8951 controller (LIB=SIM)
+* | Info        :
+*   Emulates the IT8951 behind the DEV_Config interface so the driver can run
+*   without a Raspberry Pi or a panel:
+*     I80 command decoding over SPI, register file (LISAR, UP1SR, LUTAFSR,
+*     I80CPCR, BGVR), image SDRAM, the HRDY busy pin and LUT engine busy time.
+*   Time is virtual: SPI bytes, GPIO accesses, delays and refreshes advance a
+*   simulated clock, so transfers can be benchmarked on any Linux box.
+*
+*   Environment variables read by SIM_IT8951_Init():
+*     IT8951_SIM_PANEL      panel size, e.g. "1872x1404" (default)
+*     IT8951_SIM_LUT        LUT version string reported by GET_DEV_INFO
+*     IT8951_SIM_SPI_HZ     SPI clock in Hz (default 12500000)
+*     IT8951_SIM_SPI_MAX_HZ reads come back corrupted above this SPI clock
+*     IT8951_SIM_GPIO_NS    cost of one GPIO access in ns
+*     IT8951_SIM_REFRESH    refresh time model, "mode=base_ms[+area_ms],..."
+*     IT8951_SIM_PGM        dump the panel as PGM to this path after refreshes
+*----------------
+* |	This version:   V1.0
+* | Date        :   2026-10-17
+* | Info        :   Basic version
+*
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documnetation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to  whom the Software is
+# furished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS OR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+******************************************************************************/
+#ifndef __DEV_SIM_IT8951_
+#define __DEV_SIM_IT8951_
+
+#include <stdint.h>
+
+#define SIM_IT8951_DEBUG 0
+#if SIM_IT8951_DEBUG
+#define SIM_IT8951_Debug(__info,...) printf("Debug: " __info,##__VA_ARGS__)
+#else
+#define SIM_IT8951_Debug(__info,...)
+#endif
+
+#define SIM_IT8951_MEMORY_SIZE  0x04000000  //64MB of emulated image SDRAM
+#define SIM_IT8951_MEMORY_ADDR  0x001236E0  //Image buffer address reported by GET_DEV_INFO
+#define SIM_IT8951_SPI_HZ       12500000
+#define SIM_IT8951_MODE_NUM     8
+
+/**
+ * Refresh time of one display mode:
+ * Base_ms + Area_ms * (refreshed area / panel area)
+**/
+typedef struct {
+    uint32_t Base_ms;
+    uint32_t Area_ms;
+} SIM_Refresh_Time;
+
+/**
+ * Counters since the last SIM_IT8951_Reset_Stats()
+**/
+typedef struct {
+    uint64_t Bytes_Written;     //SPI bytes sent by the host, preambles included
+    uint64_t Bytes_Read;        //SPI bytes clocked back to the host
+    uint64_t SPI_Calls;         //Byte and buffer transfers issued by the host
+    uint64_t CS_Transactions;   //CS low periods
+    uint64_t Commands;          //I80 command words
+    uint64_t Busy_Polls;        //HRDY reads that returned busy
+    uint64_t Busy_Wait_ns;      //Simulated time spent waiting for HRDY
+    uint64_t Pixels_Loaded;     //Pixels written to image SDRAM
+    uint64_t Refreshes;         //DPY_AREA / DPY_BUF_AREA commands
+    uint64_t Refresh_ns;        //Sum of LUT engine busy time
+    uint64_t Errors;            //Protocol violations
+} SIM_IT8951_Stats;
+
+void SIM_IT8951_Init(void);
+void SIM_IT8951_Exit(void);
+
+//Hooks used by DEV_Config.c
+void SIM_IT8951_Digital_Write(uint16_t Pin, uint8_t Value);
+uint8_t SIM_IT8951_Digital_Read(uint16_t Pin);
+uint8_t SIM_IT8951_TransferByte(uint8_t Value);
+void SIM_IT8951_WriteBuffer(const uint8_t *Buf, uint32_t Len);
+void SIM_IT8951_Delay_ns(uint64_t ns);
+
+//Configuration, call after SIM_IT8951_Init()
+void SIM_IT8951_Set_Panel(uint16_t Width, uint16_t Height);
+void SIM_IT8951_Set_SPI_Clock(uint32_t Hz);
+uint32_t SIM_IT8951_Get_SPI_Clock(void);
+void SIM_IT8951_Set_GPIO_Cost(uint32_t ns);
+void SIM_IT8951_Set_Refresh_Time(uint8_t Mode, uint32_t Base_ms, uint32_t Area_ms);
+
+//Inspection
+uint64_t SIM_IT8951_Now_ns(void);
+void SIM_IT8951_Get_Stats(SIM_IT8951_Stats *Stats);
+void SIM_IT8951_Reset_Stats(void);
+const uint8_t *SIM_IT8951_Memory(uint32_t Addr);
+const uint8_t *SIM_IT8951_Panel(void);
+int SIM_IT8951_Dump_PGM(const char *Path);
+
+#endif
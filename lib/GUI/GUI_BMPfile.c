@@ -14,6 +14,14 @@
 *   Now Xstart and Xstart can control the position of the picture normally,
 *   and support the display of images of any size. If it is larger than
 *   the actual display range, it will not be displayed.
+* 3.GUI_ReadBmp() reads the pixel data in strips and converts it row by row,
+*   4bpp images are written without going through Paint_SetPixel().
+* 4.Palette images convert through a gray table, 16/24/32-bit rows through
+*   NEON or SSE2 kernels with the same results as the scalar formula.
+* 5.The decoding state lives in a BMP_Decoder, BMP_Decode_File() writes into
+*   an explicit 4bpp canvas and can run in several threads at once.
+* 6.BMP_Decoder_Draw_Rows() decodes a band of rows, so one picture can be
+*   split over several threads.
 #
 # Permission is hereby granted, free of charge, to any person obtaining a copy
 # of this software and associated documnetation files (the "Software"), to deal
@@ -47,379 +55,681 @@
 #include <math.h>//memset()
 #include <stdio.h>
 
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BMP_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BMP_SSE2 1
+#endif
 
-//global variables related to BMP picture display
-UBYTE *bmp_dst_buf = NULL;
-UBYTE *bmp_src_buf = NULL;
-UDOUBLE bmp_width, bmp_height;
-UBYTE  bmp_BitCount;
-UDOUBLE bytesPerLine;
-UDOUBLE imageSize;
-UDOUBLE skip;
-BMPRGBQUAD  palette[256];
 extern UBYTE isColor;
 
-static void Bitmap_format_Matrix(UBYTE *dst,UBYTE *src)
+/******************************************************************************
+function:	Gray value of one color, (R*299 + G*587 + B*114 + 500) / 1000
+parameter:
+******************************************************************************/
+static inline UBYTE BMP_Gray(UBYTE R, UBYTE G, UBYTE B)
 {
-	UDOUBLE i,j,k;
-    UBYTE *psrc = src;
-    UBYTE *pdst = dst;
-    UBYTE *p = psrc;
-	UBYTE temp;
-	UDOUBLE count;
-	
-	//Since the bmp storage is from the back to the front, it needs to be converted in reverse order.
-	switch(bmp_BitCount)
+	return (R*299 + G*587 + B*114 + 500) / 1000;
+}
+
+/*
+ * The vector kernels divide by 1000 as ((Sum >> 3) * 33555) >> 22, which equals
+ * Sum / 1000 for every Sum up to 255*1000+500 (checked exhaustively), so they
+ * give the same gray values as BMP_Gray() and fit in 16-bit lanes after the shift.
+ */
+#define BMP_DIV1000_MUL   33555
+#define BMP_DIV1000_SHIFT 22
+
+#if BMP_NEON
+static inline uint8x8_t BMP_Gray8_NEON(uint16x8_t R, uint16x8_t G, uint16x8_t B)
+{
+	uint32x4_t Round = vdupq_n_u32(500);
+	uint32x4_t Lo = vmull_n_u16(vget_low_u16(R), 299);
+	uint32x4_t Hi = vmull_n_u16(vget_high_u16(R), 299);
+	Lo = vmlal_n_u16(Lo, vget_low_u16(G), 587);
+	Hi = vmlal_n_u16(Hi, vget_high_u16(G), 587);
+	Lo = vmlal_n_u16(Lo, vget_low_u16(B), 114);
+	Hi = vmlal_n_u16(Hi, vget_high_u16(B), 114);
+	uint16x8_t Sum = vcombine_u16(vshrn_n_u32(vaddq_u32(Lo, Round), 3), vshrn_n_u32(vaddq_u32(Hi, Round), 3));
+	Lo = vmull_n_u16(vget_low_u16(Sum), BMP_DIV1000_MUL);
+	Hi = vmull_n_u16(vget_high_u16(Sum), BMP_DIV1000_MUL);
+	uint16x8_t Q = vcombine_u16(vshrn_n_u32(Lo, 16), vshrn_n_u32(Hi, 16));
+	return vmovn_u16(vshrq_n_u16(Q, BMP_DIV1000_SHIFT - 16));
+}
+
+//8 pixels per iteration, returns the pixels done
+static UDOUBLE BMP_Row_RGB_SIMD(const UBYTE *Src, UBYTE *Gray, UDOUBLE Width, UBYTE BitCount)
+{
+	UDOUBLE x = 0;
+	switch(BitCount)
 	{
-		case 1:
-			pdst += (bmp_width * bmp_height);
-			
-			for(i=0;i<bmp_height;i++)
+		case 16:
+			for(; x + 8 <= Width; x += 8)
 			{
-				pdst -= bmp_width;
-				count = 0;
-				for (j=0;j<(bmp_width+7)/8;j++)
-				{
-					temp = p[j];
-					
-					for (k=0;k<8;k++)
-					{
-						pdst[0]= ((temp & (0x80>>k)) >> (7-k));
-						count++;
-						pdst++;
-						if (count == bmp_width)
-						{
-							break;
-						}
-					}
-				}
-				pdst -= bmp_width;
-				p += bytesPerLine;
+				uint16x8_t V = vld1q_u16((const uint16_t *)(Src + x * 2));
+				uint16x8_t Mask = vdupq_n_u16(0xf8);
+				uint16x8_t R = vandq_u16(vshrq_n_u16(V, 7), Mask);
+				uint16x8_t G = vandq_u16(vshrq_n_u16(V, 2), Mask);
+				uint16x8_t B = vshlq_n_u16(vandq_u16(V, vdupq_n_u16(0x1f)), 3);
+				vst1_u8(Gray + x, BMP_Gray8_NEON(R, G, B));
 			}
 		break;
-		case 4:
-			pdst += (bmp_width * bmp_height);
-
-			for(i=0;i<bmp_height;i++)
+		case 24:
+			for(; x + 8 <= Width; x += 8)
 			{
-				pdst -= bmp_width;
-				count = 0;
-				for (j=0;j<(bmp_width+1)/2;j++)
-				{
-					temp = p[j];
-					pdst[0]= ((temp & 0xf0) >> 4);
-					count++;
-					pdst++;
-					if (count == bmp_width)
-					{
-						break;
-					}
-
-					pdst[0] = temp & 0x0f;
-					count++;
-					pdst++;
-					if (count == bmp_width)
-					{
-						break;
-					}
-				}
-				pdst -= bmp_width;
-				p += bytesPerLine;
+				uint8x8x3_t V = vld3_u8(Src + x * 3);
+				vst1_u8(Gray + x, BMP_Gray8_NEON(vmovl_u8(V.val[2]), vmovl_u8(V.val[1]), vmovl_u8(V.val[0])));
 			}
 		break;
-		case 8:
-			pdst += (bmp_width*bmp_height);
-			for(i=0;i<bmp_height;i++)
+		case 32:
+			for(; x + 8 <= Width; x += 8)
 			{
-				p = psrc+(i+1)*bytesPerLine;
-				p -= skip;
-				for(j=0;j<bmp_width;j++)
-				{
-					pdst -= 1;
-					p -= 1;
-					pdst[0] = p[0];
-				}
+				uint8x8x4_t V = vld4_u8(Src + x * 4);
+				vst1_u8(Gray + x, BMP_Gray8_NEON(vmovl_u8(V.val[2]), vmovl_u8(V.val[1]), vmovl_u8(V.val[0])));
 			}
 		break;
+		default:
+		break;
+	}
+	return x;
+}
+#elif BMP_SSE2
+static inline __m128i BMP_Gray8_SSE2(__m128i R, __m128i G, __m128i B)
+{
+	//(R,G) and (B,1) pairs through pmaddwd give the 32-bit sums
+	const __m128i RG_Weight = _mm_set1_epi32((587 << 16) | 299);
+	const __m128i B1_Weight = _mm_set1_epi32((500 << 16) | 114);
+	const __m128i One = _mm_set1_epi16(1);
+	__m128i Lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(R, G), RG_Weight),
+	                           _mm_madd_epi16(_mm_unpacklo_epi16(B, One), B1_Weight));
+	__m128i Hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(R, G), RG_Weight),
+	                           _mm_madd_epi16(_mm_unpackhi_epi16(B, One), B1_Weight));
+	__m128i Sum = _mm_packs_epi32(_mm_srli_epi32(Lo, 3), _mm_srli_epi32(Hi, 3));
+	__m128i Q = _mm_srli_epi16(_mm_mulhi_epu16(Sum, _mm_set1_epi16((short)BMP_DIV1000_MUL)), BMP_DIV1000_SHIFT - 16);
+	return _mm_packus_epi16(Q, Q);
+}
+
+//B, G and R of four little-endian BGRx pixels, as 32-bit lanes
+static inline void BMP_Split_BGRX(__m128i V, __m128i *R, __m128i *G, __m128i *B)
+{
+	const __m128i Mask = _mm_set1_epi32(0xff);
+	*B = _mm_and_si128(V, Mask);
+	*G = _mm_and_si128(_mm_srli_epi32(V, 8), Mask);
+	*R = _mm_and_si128(_mm_srli_epi32(V, 16), Mask);
+}
+
+static inline UDOUBLE BMP_Load24(const UBYTE *p)
+{
+	UDOUBLE v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+//8 pixels per iteration, returns the pixels done
+static UDOUBLE BMP_Row_RGB_SIMD(const UBYTE *Src, UBYTE *Gray, UDOUBLE Width, UBYTE BitCount)
+{
+	UDOUBLE x = 0;
+	__m128i R0, G0, B0, R1, G1, B1, V0, V1;
+	switch(BitCount)
+	{
 		case 16:
-			pdst += (bmp_width*bmp_height*2);
-			for(i=0;i<bmp_height;i++)
+			for(; x + 8 <= Width; x += 8)
 			{
-				p = psrc+(i+1)*bytesPerLine;
-				p -= skip;
-				for(j=0;j<bmp_width;j++)
-				{
-					pdst -= 2;
-					p -= 2;
-					pdst[0] = p[1];
-					pdst[1] = p[0];
-				}
+				__m128i V = _mm_loadu_si128((const __m128i *)(Src + x * 2));
+				__m128i Mask = _mm_set1_epi16(0xf8);
+				__m128i R = _mm_and_si128(_mm_srli_epi16(V, 7), Mask);
+				__m128i G = _mm_and_si128(_mm_srli_epi16(V, 2), Mask);
+				__m128i B = _mm_slli_epi16(_mm_and_si128(V, _mm_set1_epi16(0x1f)), 3);
+				_mm_storel_epi64((__m128i *)(Gray + x), BMP_Gray8_SSE2(R, G, B));
 			}
 		break;
 		case 24:
-			pdst += (bmp_width*bmp_height*3);
-			for(i=0;i<bmp_height;i++)
+			//4-byte loads, the strip has one spare byte after the last row
+			for(; x + 8 <= Width; x += 8)
 			{
-				p = psrc+(i+1)*bytesPerLine;
-				p -= skip;
-				for(j=0;j<bmp_width;j++)
-				{
-					pdst -= 3;
-					p -= 3;
-					pdst[0] = p[2];
-					pdst[1] = p[1];
-					pdst[2] = p[0];
-				}
+				const UBYTE *p = Src + x * 3;
+				V0 = _mm_set_epi32(BMP_Load24(p + 9), BMP_Load24(p + 6), BMP_Load24(p + 3), BMP_Load24(p));
+				V1 = _mm_set_epi32(BMP_Load24(p + 21), BMP_Load24(p + 18), BMP_Load24(p + 15), BMP_Load24(p + 12));
+				BMP_Split_BGRX(V0, &R0, &G0, &B0);
+				BMP_Split_BGRX(V1, &R1, &G1, &B1);
+				_mm_storel_epi64((__m128i *)(Gray + x), BMP_Gray8_SSE2(_mm_packs_epi32(R0, R1),
+					_mm_packs_epi32(G0, G1), _mm_packs_epi32(B0, B1)));
 			}
 		break;
 		case 32:
-			pdst += (bmp_width*bmp_height*4);
-			for(i=0;i<bmp_height;i++)
+			for(; x + 8 <= Width; x += 8)
 			{
-				p = psrc+(i+1)*bmp_width*4;
-				for(j=0;j<bmp_width;j++)
-				{
-					pdst -= 4;
-					p -= 4;
-					pdst[0] = p[2];
-					pdst[1] = p[1];
-					pdst[2] = p[0];
-					pdst[3] = p[3];
-				}
+				V0 = _mm_loadu_si128((const __m128i *)(Src + x * 4));
+				V1 = _mm_loadu_si128((const __m128i *)(Src + x * 4 + 16));
+				BMP_Split_BGRX(V0, &R0, &G0, &B0);
+				BMP_Split_BGRX(V1, &R1, &G1, &B1);
+				_mm_storel_epi64((__m128i *)(Gray + x), BMP_Gray8_SSE2(_mm_packs_epi32(R0, R1),
+					_mm_packs_epi32(G0, G1), _mm_packs_epi32(B0, B1)));
 			}
 		break;
-		
 		default:
 		break;
-	}	
+	}
+	return x;
 }
+#else
+static UDOUBLE BMP_Row_RGB_SIMD(const UBYTE *Src, UBYTE *Gray, UDOUBLE Width, UBYTE BitCount)
+{
+	return 0;
+}
+#endif
 
-static void DrawMatrix(UWORD Xpos, UWORD Ypos,UWORD Width, UWORD High,const UBYTE* Matrix)
+/******************************************************************************
+function:	Convert one row of the file to 8-bit gray values
+parameter:
+    Src      : the row as stored in the file
+    Gray     : Width gray values, left to right
+    Width    : pixels to convert, from the left
+    BitCount : 1, 4, 8 (through Palette_Gray), 16 (x1r5g5b5), 24 or 32
+******************************************************************************/
+static void BMP_Row_To_Gray(const UBYTE *Src, UBYTE *Gray, UDOUBLE Width, UBYTE BitCount,
+                            const UBYTE *Palette_Gray)
 {
-	UWORD i,j,x,y;
-	UBYTE R = 0, G = 0, B = 0;
-	UBYTE temp1,temp2;
-	double Gray;
-	
-	for (y=0,j=Ypos;y<High;y++,j++)
+	UDOUBLE x = 0;
+	UBYTE temp1, temp2;
+
+	switch(BitCount)
 	{
- 		for (x=0,i=Xpos;x<Width;x++,i++)
-		{
-			switch(bmp_BitCount)
+		case 1:
+			for(; x < Width; x++)
+				Gray[x] = Palette_Gray[(Src[x / 8] >> (7 - x % 8)) & 0x01];
+		break;
+
+		case 4:
+			for(; x + 2 <= Width; x += 2)
 			{
-				case 1:
-				case 4:
-				case 8:
-					R = palette[Matrix[(y*Width+x)]].rgbRed;
-					G = palette[Matrix[(y*Width+x)]].rgbGreen;
-					B = palette[Matrix[(y*Width+x)]].rgbBlue;
-				break;
-				
-				case 16:
-					temp1 = Matrix[(y*Width+x)*2];
-					temp2 = Matrix[(y*Width+x)*2+1];
-					R = (temp1 & 0x7c)<<1;
-					G = (((temp1 & 0x03) << 3 ) | ((temp2&0xe0) >> 5))<<3;
-					B = (temp2 & 0x1f)<<3;
-				break;
-				
-				case 24:
-					R = Matrix[(y*Width+x)*3];
-					G = Matrix[(y*Width+x)*3+1];
-					B = Matrix[(y*Width+x)*3+2];
-				break;
-				
-				case 32:
-					R = Matrix[(y*Width+x)*4];
-					G = Matrix[(y*Width+x)*4+1];
-					B = Matrix[(y*Width+x)*4+2];
-				break;
-				
-				default:
-				break;
+				Gray[x] = Palette_Gray[Src[x / 2] >> 4];
+				Gray[x + 1] = Palette_Gray[Src[x / 2] & 0x0f];
 			}
-		
-			Gray = (R*299 + G*587 + B*114 + 500) / 1000;
-            if(isColor && i%3==2)
-				Paint_SetPixel(i, j, Gray/2);
-			else
-				Paint_SetPixel(i, j, Gray);
-		}
+			if(x < Width)
+				Gray[x] = Palette_Gray[Src[x / 2] >> 4];
+		break;
+
+		case 8:
+			for(; x < Width; x++)
+				Gray[x] = Palette_Gray[Src[x]];
+		break;
+
+		case 16:
+			//little-endian word, the high byte holds red and the top of green
+			for(x = BMP_Row_RGB_SIMD(Src, Gray, Width, BitCount); x < Width; x++)
+			{
+				temp1 = Src[x * 2 + 1];
+				temp2 = Src[x * 2];
+				Gray[x] = BMP_Gray((temp1 & 0x7c)<<1, (((temp1 & 0x03) << 3 ) | ((temp2&0xe0) >> 5))<<3,
+				                   (temp2 & 0x1f)<<3);
+			}
+		break;
+
+		case 24:
+			for(x = BMP_Row_RGB_SIMD(Src, Gray, Width, BitCount); x < Width; x++)
+				Gray[x] = BMP_Gray(Src[x * 3 + 2], Src[x * 3 + 1], Src[x * 3]);
+		break;
+
+		case 32:
+			for(x = BMP_Row_RGB_SIMD(Src, Gray, Width, BitCount); x < Width; x++)
+				Gray[x] = BMP_Gray(Src[x * 4 + 2], Src[x * 4 + 1], Src[x * 4]);
+		break;
+
+		default:
+		break;
 	}
 }
 
-UBYTE GUI_ReadBmp(const char *path, UWORD x, UWORD y)
+const char *BMP_Result_String(BMP_Result Result)
 {
-	//bmp file pointer
-	FILE *fp;
-	BMPFILEHEADER FileHead;
-	BMPINFOHEADER InfoHead;
-	UDOUBLE total_length;
-	UBYTE *buf = NULL;
-	UDOUBLE ret = -1;
-	
-	fp = fopen(path,"rb");
-	if (fp == NULL)
+	switch(Result)
 	{
-		return(-1);
+		case BMP_OK:            return "ok";
+		case BMP_DONE:          return "no more rows";
+		case BMP_ERR_OPEN:      return "can not open file";
+		case BMP_ERR_HEADER:    return "can not read file header";
+		case BMP_ERR_NOT_BMP:   return "not a BMP file";
+		case BMP_ERR_INFO:      return "can not read info header";
+		case BMP_ERR_PALETTE:   return "can not read palette";
+		case BMP_ERR_FORMAT:    return "unsupported format";
+		case BMP_ERR_TRUNCATED: return "pixel data ends early";
+		case BMP_ERR_NOMEM:     return "out of memory";
+		default:                return "unknown error";
 	}
- 
-	ret = fread(&FileHead, sizeof(BMPFILEHEADER),1, fp);
+}
+
+/******************************************************************************
+function:	Read the headers and palette from Decoder->fp
+parameter:
+******************************************************************************/
+static BMP_Result BMP_Decoder_Read_Headers(BMP_Decoder *Decoder)
+{
+	BMPFILEHEADER *FileHead = &Decoder->FileHead;
+	BMPINFOHEADER *InfoHead = &Decoder->InfoHead;
+	UDOUBLE ret;
+
+	ret = fread(FileHead, sizeof(BMPFILEHEADER),1, Decoder->fp);
 	if (ret != 1)
 	{
 		Debug("Read header error!\n");
-		fclose(fp);
-		return(-2);
+		return BMP_ERR_HEADER;
 	}
 
 	//Detect if it is a bmp image, since BMP file type is "BM"(0x4D42)
-	if (FileHead.bType != 0x4D42)
+	if (FileHead->bType != 0x4D42)
 	{
 		Debug("It's not a BMP file\n");
-		fclose(fp);
-		return(-3);
+		return BMP_ERR_NOT_BMP;
 	}
 	
 	Debug("*****************************************\n");
-	Debug("BMP_bSize:%d \n", FileHead.bSize);
- 	Debug("BMP_bOffset:%d \n", FileHead.bOffset);
+	Debug("BMP_bSize:%d \n", FileHead->bSize);
+ 	Debug("BMP_bOffset:%d \n", FileHead->bOffset);
 	
-	ret = fread((char *)&InfoHead, sizeof(BMPINFOHEADER),1, fp);
+	ret = fread((char *)InfoHead, sizeof(BMPINFOHEADER),1, Decoder->fp);
 	if (ret != 1)
 	{
 		Debug("Read infoheader error!\n");
-		fclose(fp);
-		return(-4);
+		return BMP_ERR_INFO;
 	}
 	
-	Debug("BMP_biInfoSize:%d \n", InfoHead.biInfoSize);
- 	Debug("BMP_biWidth:%d \n", InfoHead.biWidth);
-	Debug("BMP_biHeight:%d \n", InfoHead.biHeight);
-	Debug("BMP_biPlanes:%d \n", InfoHead.biPlanes);
-	Debug("BMP_biBitCount:%d \n", InfoHead.biBitCount);
-	Debug("BMP_biCompression:%d \n", InfoHead.biCompression);
-	Debug("BMP_bimpImageSize:%d \n", InfoHead.bimpImageSize);
-	Debug("BMP_biXPelsPerMeter:%d \n", InfoHead.biXPelsPerMeter);
-	Debug("BMP_biYPelsPerMeter:%d \n", InfoHead.biYPelsPerMeter);
-	Debug("BMP_biClrUsed:%d \n", InfoHead.biClrUsed);
-	Debug("BMP_biClrImportant:%d \n", InfoHead.biClrImportant);
-	
-	total_length = FileHead.bSize-FileHead.bOffset;
-	bytesPerLine=((InfoHead.biWidth*InfoHead.biBitCount+31)>>5)<<2;
-	imageSize=bytesPerLine*InfoHead.biHeight;
-	skip=(4-((InfoHead.biWidth*InfoHead.biBitCount)>>3))&3;
+	Debug("BMP_biInfoSize:%d \n", InfoHead->biInfoSize);
+ 	Debug("BMP_biWidth:%d \n", InfoHead->biWidth);
+	Debug("BMP_biHeight:%d \n", InfoHead->biHeight);
+	Debug("BMP_biPlanes:%d \n", InfoHead->biPlanes);
+	Debug("BMP_biBitCount:%d \n", InfoHead->biBitCount);
+	Debug("BMP_biCompression:%d \n", InfoHead->biCompression);
+	Debug("BMP_bimpImageSize:%d \n", InfoHead->bimpImageSize);
+	Debug("BMP_biXPelsPerMeter:%d \n", InfoHead->biXPelsPerMeter);
+	Debug("BMP_biYPelsPerMeter:%d \n", InfoHead->biYPelsPerMeter);
+	Debug("BMP_biClrUsed:%d \n", InfoHead->biClrUsed);
+	Debug("BMP_biClrImportant:%d \n", InfoHead->biClrImportant);
+
+	//A negative height marks rows stored from the top down
+	Decoder->Width = InfoHead->biWidth;
+	Decoder->Top_Down = (int32_t)InfoHead->biHeight < 0;
+	Decoder->Height = Decoder->Top_Down ? (UDOUBLE)-(int32_t)InfoHead->biHeight : InfoHead->biHeight;
+	Decoder->Bit_Count = InfoHead->biBitCount;
+	Decoder->Bytes_Per_Line = ((Decoder->Width*InfoHead->biBitCount+31)>>5)<<2;
 	
-	Debug("bimpImageSize:%d\n", InfoHead.bimpImageSize);
-	Debug("total_length:%d\n", total_length);
-	Debug("bytesPerLine = %d\n", bytesPerLine);
-	Debug("imageSize = %d\n", imageSize);
-	Debug("skip = %d\n", skip);
+	Debug("bytesPerLine = %d\n", Decoder->Bytes_Per_Line);
 	Debug("*****************************************\n");
-	
-    bmp_width = InfoHead.biWidth;
-    bmp_height = InfoHead.biHeight;
-	bmp_BitCount = InfoHead.biBitCount;
-	
-	//This is old code, but allocate imageSize byte memory is more reasonable
-    bmp_src_buf = (UBYTE*)calloc(1,total_length);
-	//bmp_src_buf = (UBYTE*)calloc(1,imageSize);
-    if(bmp_src_buf == NULL){
-        Debug("Load > malloc bmp out of memory!\n");
-        return -1;
-    }
-	//This is old code, but allocate imageSize byte memory is more reasonable
-	bmp_dst_buf = (UBYTE*)calloc(1,total_length);
-	//bmp_dst_buf = (UBYTE*)calloc(1,imageSize);
-    if(bmp_dst_buf == NULL){
-        Debug("Load > malloc bmp out of memory!\n");
-        return -2;
-    }
 
-	 //Jump to data area
-    fseek(fp, FileHead.bOffset, SEEK_SET);
-	
-	//Bytes per line
-    buf = bmp_src_buf;
-    while ((ret = fread(buf,1,total_length,fp)) >= 0) 
+	switch(Decoder->Bit_Count)
 	{
-        if (ret == 0) 
-		{
-            DEV_Delay_us(100);
-            continue;
-        }
-		buf = ((UBYTE*)buf) + ret;
-        total_length = total_length - ret;
-        if(total_length == 0)
-            break;
-    }
-	
-	//Jump to color pattern board
-	switch(bmp_BitCount)
-	{	
 		case 1:
-			fseek(fp, 54, SEEK_SET);
-			ret = fread(palette,1,4*2,fp);
-			if (ret != 8) 
-			{
-				Debug("Error: fread != 8\n");
-				return -5;
-			}
-
-			//this is old code, will likely result in memory leak if use 1bp source bmp image
-			 
-			bmp_dst_buf = (UBYTE*)calloc(1,InfoHead.biWidth * InfoHead.biHeight);
-			if(bmp_dst_buf == NULL)
-			{
-				Debug("Load > malloc bmp out of memory!\n");
-				return -5;
-			}
-			
-		break;
-		
 		case 4:
-			fseek(fp, 54, SEEK_SET);
-			ret = fread(palette,1,4*16,fp);
-			if (ret != 64) 
-			{
-				Debug("Error: fread != 64\n");
-				return -5;
-			}
-			//this is old code, will likely result in memory leak if use 4bp source bmp image
-			
-			bmp_dst_buf = (UBYTE*)calloc(1,InfoHead.biWidth * InfoHead.biHeight);
-			if(bmp_dst_buf == NULL)
-			{
-				Debug("Load > malloc bmp out of memory!\n");
-				return -5;
-			}
-			
-		break;
-		
 		case 8:
-			fseek(fp, 54, SEEK_SET);
-
-			ret = fread(palette,1,4*256,fp);
-
-			if (ret != 1024) 
-			{
-				Debug("Error: fread != 1024\n");
-				return -5;
-			}
+		case 16:
+		case 24:
+		case 32:
 		break;
-		
 		default:
-		break;
+			Debug("Unsupported BitCount %d\n", InfoHead->biBitCount);
+			return BMP_ERR_FORMAT;
+	}
+	if(Decoder->Width == 0 || Decoder->Width > 0xFFFF || Decoder->Height > 0xFFFF)
+	{
+		Debug("Unsupported size %dx%d\n", Decoder->Width, Decoder->Height);
+		return BMP_ERR_FORMAT;
+	}
+
+	//Jump to color pattern board, it follows the info header
+	if(Decoder->Bit_Count <= 8)
+	{
+		UDOUBLE Colors = 1 << Decoder->Bit_Count;
+		fseek(Decoder->fp, sizeof(BMPFILEHEADER) + InfoHead->biInfoSize, SEEK_SET);
+		ret = fread(Decoder->Palette,1,4*Colors,Decoder->fp);
+		if (ret != 4*Colors) 
+		{
+			Debug("Error: fread != %d\n", 4*Colors);
+			return BMP_ERR_PALETTE;
+		}
+		//At most 256 distinct inputs, convert them once
+		for(UDOUBLE i = 0; i < Colors; i++)
+			Decoder->Palette_Gray[i] = BMP_Gray(Decoder->Palette[i].rgbRed, Decoder->Palette[i].rgbGreen,
+			                                    Decoder->Palette[i].rgbBlue);
+	}
+
+	//Bounded memory: one strip of file rows, one spare byte for the 4-byte
+	//loads of the 24-bit kernel
+	Decoder->Strip_Rows = BMP_STRIP_SIZE / Decoder->Bytes_Per_Line;
+	if(Decoder->Strip_Rows == 0)
+		Decoder->Strip_Rows = 1;
+	if(Decoder->Strip_Rows > Decoder->Height)
+		Decoder->Strip_Rows = Decoder->Height;
+	Decoder->Strip = (UBYTE*)malloc(Decoder->Strip_Rows * Decoder->Bytes_Per_Line + 1);
+	if(Decoder->Strip == NULL)
+	{
+		Debug("Load > malloc bmp out of memory!\n");
+		return BMP_ERR_NOMEM;
+	}
+
+	 //Jump to data area
+	fseek(Decoder->fp, FileHead->bOffset, SEEK_SET);
+	return BMP_OK;
+}
+
+/******************************************************************************
+function:	Open a BMP file and read its headers and palette
+parameter:
+    Decoder : context, BMP_Decoder_Close() it whatever the result
+    path    : file to decode
+******************************************************************************/
+BMP_Result BMP_Decoder_Open(BMP_Decoder *Decoder, const char *path)
+{
+	memset(Decoder, 0, sizeof(*Decoder));
+	Decoder->fp = fopen(path,"rb");
+	if (Decoder->fp == NULL)
+	{
+		return BMP_ERR_OPEN;
+	}
+	return BMP_Decoder_Read_Headers(Decoder);
+}
+
+/******************************************************************************
+function:	Open a BMP file held in memory, e.g. a received message
+parameter:
+    Decoder : context, BMP_Decoder_Close() it whatever the result
+    Data    : the whole file, it must stay valid until BMP_Decoder_Close()
+    Size    : its size in bytes
+******************************************************************************/
+BMP_Result BMP_Decoder_Open_Memory(BMP_Decoder *Decoder, const UBYTE *Data, UDOUBLE Size)
+{
+	memset(Decoder, 0, sizeof(*Decoder));
+	if (Data == NULL || Size == 0)
+	{
+		return BMP_ERR_OPEN;
+	}
+	//Only read through, fmemopen() does not write to a buffer opened "rb"
+	Decoder->fp = fmemopen((void *)Data, Size, "rb");
+	if (Decoder->fp == NULL)
+	{
+		return BMP_ERR_OPEN;
+	}
+	Decoder->Data = Data;
+	Decoder->Data_Size = Size;
+	return BMP_Decoder_Read_Headers(Decoder);
+}
+
+/******************************************************************************
+function:	Next row of the file, in file order
+parameter:
+    Src       : the row as stored in the file, valid until the next call
+    Image_Row : its row in the picture, 0 is the top
+******************************************************************************/
+BMP_Result BMP_Decoder_Next_Row(BMP_Decoder *Decoder, const UBYTE **Src, UDOUBLE *Image_Row)
+{
+	if(Decoder->Row == Decoder->Height)
+		return BMP_DONE;
+
+	if(Decoder->Strip_Pos == Decoder->Strip_Len)
+	{
+		UDOUBLE Rows = Decoder->Height - Decoder->Row;
+		if(Rows > Decoder->Strip_Rows)
+			Rows = Decoder->Strip_Rows;
+		Decoder->Strip_Len = fread(Decoder->Strip, Decoder->Bytes_Per_Line, Rows, Decoder->fp);
+		Decoder->Strip_Pos = 0;
+		if(Decoder->Strip_Len == 0)
+		{
+			Debug("BMP data ends after %d of %d rows\n", Decoder->Row, Decoder->Height);
+			return BMP_ERR_TRUNCATED;
+		}
+	}
+
+	*Src = Decoder->Strip + Decoder->Strip_Pos * Decoder->Bytes_Per_Line;
+	//Since the bmp storage is from the back to the front, the first row is the bottom one.
+	*Image_Row = Decoder->Top_Down ? Decoder->Row : Decoder->Height - 1 - Decoder->Row;
+	Decoder->Strip_Pos++;
+	Decoder->Row++;
+	return BMP_OK;
+}
+
+/******************************************************************************
+function:	Convert the first Width pixels of a row from BMP_Decoder_Next_Row()
+parameter:
+    Gray : Width 8-bit gray values
+******************************************************************************/
+void BMP_Decoder_Row_To_Gray(const BMP_Decoder *Decoder, const UBYTE *Src, UBYTE *Gray, UDOUBLE Width)
+{
+	if(Width > Decoder->Width)
+		Width = Decoder->Width;
+	BMP_Row_To_Gray(Src, Gray, Width, Decoder->Bit_Count, Decoder->Palette_Gray);
+}
+
+/******************************************************************************
+function:	Pack a row of gray values into a 4bpp row, even pixel in the low nibble
+parameter:
+******************************************************************************/
+static void BMP_Pack_4bp(UBYTE *Row, UDOUBLE Xpos, const UBYTE *Gray, UDOUBLE Width)
+{
+	UDOUBLE x = 0, i = Xpos;
+
+	if(Width > 0 && (i % 2))
+	{
+		Row[i / 2] = (Row[i / 2] & 0x0f) | (Gray[0] & 0xf0);
+		x = 1;
+		i++;
+	}
+	for(; x + 1 < Width; x += 2, i += 2)
+		Row[i / 2] = (Gray[x] >> 4) | (Gray[x + 1] & 0xf0);
+	if(x < Width)
+		Row[i / 2] = (Row[i / 2] & 0xf0) | (Gray[x] >> 4);
+}
+
+/******************************************************************************
+function:	Decode the rest of the picture into a 4bpp canvas
+parameter:
+    X, Y : canvas position of the top left pixel, the picture is clipped
+           to the canvas
+******************************************************************************/
+BMP_Result BMP_Decoder_Draw(BMP_Decoder *Decoder, const BMP_Canvas *Canvas, UWORD X, UWORD Y)
+{
+	const UBYTE *Src;
+	UDOUBLE Image_Row, Visible;
+	BMP_Result Result;
+
+	//Only the part inside the canvas is converted
+	Visible = (X >= Canvas->Width) ? 0 : (UDOUBLE)Canvas->Width - X;
+	if(Visible > Decoder->Width)
+		Visible = Decoder->Width;
+	UBYTE *Gray = (UBYTE*)malloc(Visible + 1);
+	if(Gray == NULL)
+		return BMP_ERR_NOMEM;
+
+	while((Result = BMP_Decoder_Next_Row(Decoder, &Src, &Image_Row)) == BMP_OK)
+	{
+		UDOUBLE Ypos = Y + Image_Row;
+		if(Ypos >= Canvas->Height || Visible == 0)
+			continue;
+		BMP_Decoder_Row_To_Gray(Decoder, Src, Gray, Visible);
+		BMP_Pack_4bp(Canvas->Image + Ypos * Canvas->Width_Byte, X, Gray, Visible);
+	}
+
+	free(Gray);
+	return (Result == BMP_DONE) ? BMP_OK : Result;
+}
+
+/******************************************************************************
+function:	Decode the picture rows First to First + Rows - 1 into a 4bpp canvas
+parameter:
+    X, Y  : canvas position of the top left pixel, as for BMP_Decoder_Draw()
+    First : first picture row, 0 is the top
+    Rows  : rows to decode
+    Reads with pread(), or copies from the memory of BMP_Decoder_Open_Memory(),
+    into its own buffers, so several threads can decode disjoint row ranges of
+    one opened decoder at the same time. The canvas
+    ends up as with BMP_Decoder_Draw().
+******************************************************************************/
+BMP_Result BMP_Decoder_Draw_Rows(const BMP_Decoder *Decoder, const BMP_Canvas *Canvas, UWORD X, UWORD Y,
+                                 UDOUBLE First, UDOUBLE Rows)
+{
+	UDOUBLE Visible, Begin, End, Strip_Rows;
+	BMP_Result Result = BMP_OK;
+	int fd = Decoder->Data ? -1 : fileno(Decoder->fp);
+
+	if(First >= Decoder->Height)
+		return BMP_OK;
+	if(Rows > Decoder->Height - First)
+		Rows = Decoder->Height - First;
+
+	//File rows of the range, bottom-up files store the last picture row first
+	Begin = Decoder->Top_Down ? First : Decoder->Height - First - Rows;
+	End = Begin + Rows;
+
+	Visible = (X >= Canvas->Width) ? 0 : (UDOUBLE)Canvas->Width - X;
+	if(Visible > Decoder->Width)
+		Visible = Decoder->Width;
+
+	Strip_Rows = BMP_STRIP_SIZE / Decoder->Bytes_Per_Line;
+	if(Strip_Rows == 0)
+		Strip_Rows = 1;
+	UBYTE *Strip = (UBYTE*)malloc(Strip_Rows * Decoder->Bytes_Per_Line + 1);
+	UBYTE *Gray = (UBYTE*)malloc(Visible + 1);
+	if(Strip == NULL || Gray == NULL)
+	{
+		free(Strip);
+		free(Gray);
+		return BMP_ERR_NOMEM;
 	}
 
-	Bitmap_format_Matrix(bmp_dst_buf,bmp_src_buf);
-	DrawMatrix(x, y,InfoHead.biWidth, InfoHead.biHeight, bmp_dst_buf);
+	for(UDOUBLE File_Row = Begin; File_Row < End; File_Row += Strip_Rows)
+	{
+		UDOUBLE n = End - File_Row;
+		if(n > Strip_Rows)
+			n = Strip_Rows;
+		off_t Offset = (off_t)Decoder->FileHead.bOffset + (off_t)File_Row * Decoder->Bytes_Per_Line;
+		size_t Want = (size_t)n * Decoder->Bytes_Per_Line, Got = 0;
+		if(Decoder->Data)
+		{
+			if(Offset < (off_t)Decoder->Data_Size)
+				Got = Decoder->Data_Size - Offset;
+			if(Got > Want)
+				Got = Want;
+			memcpy(Strip, Decoder->Data + Offset, Got);
+		}
+		while(Got < Want && fd >= 0)
+		{
+			ssize_t r = pread(fd, Strip + Got, Want - Got, Offset + Got);
+			if(r <= 0)
+				break;
+			Got += r;
+		}
 
-    free(bmp_src_buf);
-    free(bmp_dst_buf);
+		//Like fread() in BMP_Decoder_Next_Row(), only complete rows count
+		UDOUBLE Full = Got / Decoder->Bytes_Per_Line;
+		for(UDOUBLE i = 0; i < Full; i++)
+		{
+			UDOUBLE Image_Row = Decoder->Top_Down ? File_Row + i : Decoder->Height - 1 - (File_Row + i);
+			UDOUBLE Ypos = Y + Image_Row;
+			if(Ypos >= Canvas->Height || Visible == 0)
+				continue;
+			BMP_Row_To_Gray(Strip + i * Decoder->Bytes_Per_Line, Gray, Visible, Decoder->Bit_Count,
+			                Decoder->Palette_Gray);
+			BMP_Pack_4bp(Canvas->Image + Ypos * Canvas->Width_Byte, X, Gray, Visible);
+		}
+		if(Full < n)
+		{
+			Debug("BMP data ends in row %d of %d\n", File_Row + Full, Decoder->Height);
+			Result = BMP_ERR_TRUNCATED;
+			break;
+		}
+	}
 
-	bmp_src_buf = NULL;
-	bmp_dst_buf = NULL;
+	free(Strip);
+	free(Gray);
+	return Result;
+}
+
+void BMP_Decoder_Close(BMP_Decoder *Decoder)
+{
+	if(Decoder->fp)
+		fclose(Decoder->fp);
+	free(Decoder->Strip);
+	Decoder->fp = NULL;
+	Decoder->Strip = NULL;
+}
+
+/******************************************************************************
+function:	Decode a BMP file into a 4bpp canvas
+parameter:
+    path : file to decode
+    X, Y : canvas position of the top left pixel
+******************************************************************************/
+BMP_Result BMP_Decode_File(const char *path, const BMP_Canvas *Canvas, UWORD X, UWORD Y)
+{
+	BMP_Decoder Decoder;
+	BMP_Result Result = BMP_Decoder_Open(&Decoder, path);
+	if(Result == BMP_OK)
+		Result = BMP_Decoder_Draw(&Decoder, Canvas, X, Y);
+	BMP_Decoder_Close(&Decoder);
+	return Result;
+}
+
+/******************************************************************************
+function:	Decode a BMP file held in memory into a 4bpp canvas
+parameter:
+    Data, Size : the whole file
+    X, Y       : canvas position of the top left pixel
+******************************************************************************/
+BMP_Result BMP_Decode_Memory(const UBYTE *Data, UDOUBLE Size, const BMP_Canvas *Canvas, UWORD X, UWORD Y)
+{
+	BMP_Decoder Decoder;
+	BMP_Result Result = BMP_Decoder_Open_Memory(&Decoder, Data, Size);
+	if(Result == BMP_OK)
+		Result = BMP_Decoder_Draw(&Decoder, Canvas, X, Y);
+	BMP_Decoder_Close(&Decoder);
+	return Result;
+}
+
+/******************************************************************************
+function:	Decode a BMP file into the image selected with Paint_SelectImage()
+parameter:
+    path : file to decode
+    x, y : position of the top left pixel
+    Returns 0 or a BMP_Result error, as UBYTE. Uses the global Paint, so it is
+    not reentrant, decode with BMP_Decode_File() in threads.
+******************************************************************************/
+UBYTE GUI_ReadBmp(const char *path, UWORD x, UWORD y)
+{
+	BMP_Decoder Decoder;
+	BMP_Result Result;
+	const UBYTE *Src;
+	UDOUBLE Image_Row;
+
+	//The usual 4bpp frame is a plain canvas
+	if(Paint.Image != NULL && Paint.BitsPerPixel == 4 && Paint.Rotate == ROTATE_0 &&
+	   Paint.Mirror == MIRROR_NONE && !isColor)
+	{
+		BMP_Canvas Canvas = {Paint.Image, Paint.Width, Paint.Height, Paint.WidthByte};
+		return BMP_Decode_File(path, &Canvas, x, y);
+	}
+
+	Result = BMP_Decoder_Open(&Decoder, path);
+	UBYTE *Gray = (Result == BMP_OK) ? (UBYTE*)malloc(Decoder.Width) : NULL;
+	if(Result == BMP_OK && Gray == NULL)
+		Result = BMP_ERR_NOMEM;
+
+	while(Result == BMP_OK && (Result = BMP_Decoder_Next_Row(&Decoder, &Src, &Image_Row)) == BMP_OK)
+	{
+		UDOUBLE Ypos = y + Image_Row;
+		if(Ypos >= Paint.Height)
+			continue;
+		BMP_Decoder_Row_To_Gray(&Decoder, Src, Gray, Decoder.Width);
+		//Paint_SetPixel() lets X == Width through, into the next row
+		for(UDOUBLE j = 0, i = x; j < Decoder.Width && i < Paint.Width; j++, i++)
+		{
+			if(isColor && i%3==2)
+				Paint_SetPixel(i, Ypos, Gray[j]/2);
+			else
+				Paint_SetPixel(i, Ypos, Gray[j]);
+		}
+	}
 
-	fclose(fp);
-	return(0);
+	free(Gray);
+	BMP_Decoder_Close(&Decoder);
+	return (Result == BMP_DONE) ? BMP_OK : Result;
 }
\ No newline at end of file
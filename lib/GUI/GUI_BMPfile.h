@@ -44,9 +44,6 @@
 
 #include "../Config/DEV_Config.h"
 
-extern UBYTE *bmp_dst_buf;
-extern UBYTE *bmp_src_buf;
-
 /*Bitmap file header   14bit*/
 typedef struct
 {
@@ -82,6 +79,67 @@ typedef struct
 	UBYTE rgbReversed;              //rgbReversed value
 }__attribute__((packed)) BMPRGBQUAD;//Tell the compiler to cancel optimal alignment of the structure during compilation
 
+//Pixel data is read from the file this many bytes at a time (at least one row)
+#define BMP_STRIP_SIZE 65536
+
+typedef enum
+{
+	BMP_OK            = 0,
+	BMP_DONE          = 1,      //BMP_Decoder_Next_Row(): all rows read
+	BMP_ERR_OPEN      = -1,
+	BMP_ERR_HEADER    = -2,
+	BMP_ERR_NOT_BMP   = -3,
+	BMP_ERR_INFO      = -4,
+	BMP_ERR_PALETTE   = -5,
+	BMP_ERR_FORMAT    = -6,     //bit count or size not supported
+	BMP_ERR_TRUNCATED = -7,     //the rows decoded so far are kept
+	BMP_ERR_NOMEM     = -8,
+}BMP_Result;
+
+//4bpp output image, even pixel in the low nibble
+typedef struct
+{
+	UBYTE *Image;
+	UWORD Width;                    //pixels
+	UWORD Height;
+	UDOUBLE Width_Byte;             //bytes per row
+}BMP_Canvas;
+
+//Decoding state of one file, decoders do not share anything
+typedef struct
+{
+	FILE *fp;
+	const UBYTE *Data;              //BMP_Decoder_Open_Memory(): the whole file, else NULL
+	UDOUBLE Data_Size;
+	BMPFILEHEADER FileHead;
+	BMPINFOHEADER InfoHead;
+	BMPRGBQUAD Palette[256];
+	UBYTE Palette_Gray[256];        //gray value of each palette entry
+	UDOUBLE Width;                  //pixels per row
+	UDOUBLE Height;                 //rows
+	UDOUBLE Bytes_Per_Line;         //file row, padded to 4 bytes
+	UBYTE Bit_Count;
+	int Top_Down;                   //rows stored from the top
+	UBYTE *Strip;                   //file rows read ahead
+	UDOUBLE Strip_Rows;             //capacity of Strip
+	UDOUBLE Strip_Len;              //rows in Strip
+	UDOUBLE Strip_Pos;              //next row in Strip
+	UDOUBLE Row;                    //rows returned so far
+}BMP_Decoder;
+
+BMP_Result BMP_Decoder_Open(BMP_Decoder *Decoder, const char *path);
+BMP_Result BMP_Decoder_Open_Memory(BMP_Decoder *Decoder, const UBYTE *Data, UDOUBLE Size);
+BMP_Result BMP_Decoder_Next_Row(BMP_Decoder *Decoder, const UBYTE **Src, UDOUBLE *Image_Row);
+void BMP_Decoder_Row_To_Gray(const BMP_Decoder *Decoder, const UBYTE *Src, UBYTE *Gray, UDOUBLE Width);
+BMP_Result BMP_Decoder_Draw(BMP_Decoder *Decoder, const BMP_Canvas *Canvas, UWORD X, UWORD Y);
+BMP_Result BMP_Decoder_Draw_Rows(const BMP_Decoder *Decoder, const BMP_Canvas *Canvas, UWORD X, UWORD Y,
+                                 UDOUBLE First, UDOUBLE Rows);
+void BMP_Decoder_Close(BMP_Decoder *Decoder);
+
+BMP_Result BMP_Decode_File(const char *path, const BMP_Canvas *Canvas, UWORD X, UWORD Y);
+BMP_Result BMP_Decode_Memory(const UBYTE *Data, UDOUBLE Size, const BMP_Canvas *Canvas, UWORD X, UWORD Y);
+const char *BMP_Result_String(BMP_Result Result);
+
 UBYTE GUI_ReadBmp(const char *path, UWORD x, UWORD y);
 
 #endif
@@ -31,11 +31,13 @@
 #include "EPD_IT8951.h"
 #include <time.h>
 
-// Define telegram and burst sizes.
+// Default telegram and burst sizes, changed at runtime through Telegram_Rows and Burst_Size.
 #define TELEGRAM_ROWS 100    // Number of rows per telegram.
 #define BURST_SIZE    8190   // Maximum number of 16-bit words per burst.
 // Buffer size: 2 bytes for preamble + 2 bytes per word.
-#define SPI_BUFFER_SIZE (2 + (BURST_SIZE * 2))
+#define SPI_BUFFER_SIZE (2 + (IT8951_BURST_SIZE_MAX * 2))
+// Bytes per bulk SPI call in EPD_IT8951_WriteMuitiData.
+#define WRITE_CHUNK_SIZE 4096
 
 
 //basic mode definition
@@ -43,6 +45,43 @@ UBYTE INIT_Mode = 0;
 UBYTE GC16_Mode = 2;
 //A2_Mode's value is not fixed, is decide by firmware's LUT 
 UBYTE A2_Mode = 6;
+UBYTE DU_Mode = 1;
+UBYTE GL16_Mode = 3;
+
+IT8951_Write_Strategy Write_Strategy = IT8951_WRITE_TELEGRAM;
+UWORD Telegram_Rows = TELEGRAM_ROWS;
+UWORD Burst_Size = BURST_SIZE;
+IT8951_Abort_Check Upload_Abort_Check = NULL;
+
+/******************************************************************************
+function :	Words per SPI burst, Burst_Size limited to what the buffers hold
+parameter:
+******************************************************************************/
+static UDOUBLE EPD_IT8951_BurstWords(void)
+{
+    if(Burst_Size == 0)
+        return 1;
+    return (Burst_Size > IT8951_BURST_SIZE_MAX) ? IT8951_BURST_SIZE_MAX : Burst_Size;
+}
+
+/******************************************************************************
+function :	Whether the rest of the upload is no longer wanted, see Upload_Abort_Check
+parameter:
+******************************************************************************/
+static bool EPD_IT8951_UploadAborted(void)
+{
+    return Upload_Abort_Check != NULL && Upload_Abort_Check();
+}
+
+/******************************************************************************
+function :	16-bit words per row of a load image area
+parameter:  1bpp areas are loaded as 8bpp bytes, Area_X and Area_W already divided by 8
+******************************************************************************/
+static UWORD EPD_IT8951_RowWords(IT8951_Load_Img_Info* Load_Img_Info, IT8951_Area_Img_Info* Area_Img_Info)
+{
+    static const UBYTE Bits[4] = {2, 3, 4, 8};
+    return (UDOUBLE)Area_Img_Info->Area_W * Bits[Load_Img_Info->Pixel_Format & 0x3] / 16;
+}
 
 /******************************************************************************
 function :	Software reset
@@ -66,11 +105,8 @@ parameter:
 static void EPD_IT8951_ReadBusy(void)
 {
 	// Debug("Busy ------\r\n");
-    UBYTE Busy_State = DEV_Digital_Read(EPD_BUSY_PIN);
     //0: busy, 1: idle
-    while(Busy_State == 0) {
-        Busy_State = DEV_Digital_Read(EPD_BUSY_PIN);
-    }
+    DEV_Digital_Wait(EPD_BUSY_PIN, HIGH, 0);
 	// Debug("Busy Release ------\r\n");
 }
 
@@ -143,60 +179,24 @@ static void EPD_IT8951_WriteMuitiData(UWORD* Data_Buf, UDOUBLE Length)
 
     EPD_IT8951_ReadBusy();
 
-    for(UDOUBLE i = 0; i<Length; i++)
+    //big-endian words, handed to the SPI driver a chunk at a time
+    UBYTE Tx_Buf[WRITE_CHUNK_SIZE];
+    while(Length > 0)
     {
-	    DEV_SPI_WriteByte(Data_Buf[i]>>8);
-	    DEV_SPI_WriteByte(Data_Buf[i]);
-    }
-    DEV_Digital_Write(EPD_CS_PIN, HIGH);
-}
-
-/******************************************************************************
-function :	write multi data burst
-parameter:  data
-******************************************************************************/
-
-static void EPD_IT8951_WriteMuitiData_Burst(UWORD* Data_Buf, UDOUBLE TotalLength)
-{
-    UWORD Write_Preamble = 0x0000;
-    UDOUBLE remaining = TotalLength;
-    UDOUBLE offset = 0;
-
-    while (remaining > 0)
-    {
-        UDOUBLE burst = (remaining > BURST_SIZE) ? BURST_SIZE : remaining;
-        
-        // Wait for controller to be ready before starting a burst.
-        EPD_IT8951_ReadBusy();
-        
-        // Begin burst: assert CS and send the preamble.
-        DEV_Digital_Write(EPD_CS_PIN, LOW);
-        DEV_SPI_WriteByte(Write_Preamble >> 8);
-        DEV_SPI_WriteByte(Write_Preamble & 0xFF);
-        EPD_IT8951_ReadBusy();
-        
-        // Send a burst of words.
-        for (UDOUBLE i = 0; i < burst; i++)
+        UDOUBLE Words = (Length > WRITE_CHUNK_SIZE/2) ? WRITE_CHUNK_SIZE/2 : Length;
+        for(UDOUBLE i = 0; i<Words; i++)
         {
-            UWORD word = Data_Buf[offset + i];
-            DEV_SPI_WriteByte(word >> 8);
-            DEV_SPI_WriteByte(word & 0xFF);
+            Tx_Buf[2*i]   = Data_Buf[i]>>8;
+            Tx_Buf[2*i+1] = Data_Buf[i];
         }
-        
-        // End burst: deassert CS.
-        DEV_Digital_Write(EPD_CS_PIN, HIGH);
-        
-        // Update counters.
-        offset    += burst;
-        remaining -= burst;
-        
-        // Optional: short delay between bursts.
-         DEV_Delay_ms(1);
+        DEV_SPI_WriteBuffer(Tx_Buf, Words*2);
+        Data_Buf += Words;
+        Length -= Words;
     }
+    DEV_Digital_Write(EPD_CS_PIN, HIGH);
 }
 
 
-
 /******************************************************************************
 function :	read data
 parameter:  data
@@ -344,22 +344,6 @@ static void EPD_IT8951_SetVCOM(UWORD VCOM)
 
 
 
-/******************************************************************************
-function :	Cmd10 LD_IMG
-parameter:  
-******************************************************************************/
-static void EPD_IT8951_LoadImgStart( IT8951_Load_Img_Info* Load_Img_Info )
-{
-    UWORD Args;
-    Args = (\
-        Load_Img_Info->Endian_Type<<8 | \
-        Load_Img_Info->Pixel_Format<<4 | \
-        Load_Img_Info->Rotate\
-    );
-    EPD_IT8951_WriteCommand(IT8951_TCON_LD_IMG);
-    EPD_IT8951_WriteData(Args);
-}
-
 
 /******************************************************************************
 function :	Cmd11 LD_IMG_Area
@@ -428,12 +412,13 @@ static void EPD_IT8951_SetTargetMemoryAddr(UDOUBLE Target_Memory_Addr)
 function :	EPD_IT8951_WaitForDisplayReady
 parameter:  
 ******************************************************************************/
-static void EPD_IT8951_WaitForDisplayReady(void)
+void EPD_IT8951_WaitForDisplayReady(void)
 {
     //Check IT8951 Register LUTAFSR => NonZero Busy, Zero - Free
+    //A refresh takes hundreds of ms, poll the register instead of hammering SPI
     while( EPD_IT8951_ReadReg(LUTAFSR) )
     {
-        //wait in idle state
+        DEV_Delay_ms(1);
     }
 }
 
@@ -448,7 +433,7 @@ parameter:
 static void EPD_IT8951_HostAreaPackedPixelWrite_1bp(IT8951_Load_Img_Info*Load_Img_Info,IT8951_Area_Img_Info*Area_Img_Info, bool Packed_Write)
 {
     UWORD Source_Buffer_Width, Source_Buffer_Height;
-    UWORD Source_Buffer_Length;
+    UDOUBLE Source_Buffer_Length;
 
     UWORD* Source_Buffer = (UWORD*)Load_Img_Info->Source_Buffer_Addr;
     EPD_IT8951_SetTargetMemoryAddr(Load_Img_Info->Target_Memory_Addr);
@@ -490,7 +475,7 @@ parameter:
 static void EPD_IT8951_HostAreaPackedPixelWrite_2bp(IT8951_Load_Img_Info*Load_Img_Info, IT8951_Area_Img_Info*Area_Img_Info, bool Packed_Write)
 {
     UWORD Source_Buffer_Width, Source_Buffer_Height;
-    UWORD Source_Buffer_Length;
+    UDOUBLE Source_Buffer_Length;
 
     UWORD* Source_Buffer = (UWORD*)Load_Img_Info->Source_Buffer_Addr;
     EPD_IT8951_SetTargetMemoryAddr(Load_Img_Info->Target_Memory_Addr);
@@ -531,14 +516,14 @@ parameter:
 static void EPD_IT8951_HostAreaPackedPixelWrite_4bp(IT8951_Load_Img_Info*Load_Img_Info, IT8951_Area_Img_Info*Area_Img_Info, bool Packed_Write)
 {
     UWORD Source_Buffer_Width, Source_Buffer_Height;
-    UWORD Source_Buffer_Length;
+    UDOUBLE Source_Buffer_Length;
 	
     UWORD* Source_Buffer = (UWORD*)Load_Img_Info->Source_Buffer_Addr;
     EPD_IT8951_SetTargetMemoryAddr(Load_Img_Info->Target_Memory_Addr);
     EPD_IT8951_LoadImgAreaStart(Load_Img_Info,Area_Img_Info);
 
     //from byte to word
-    Source_Buffer_Width = (Area_Img_Info->Area_W*4/8)/2;    
+    Source_Buffer_Width = EPD_IT8951_RowWords(Load_Img_Info, Area_Img_Info);
     Source_Buffer_Height = Area_Img_Info->Area_H;
     Source_Buffer_Length = Source_Buffer_Width * Source_Buffer_Height;    
 
@@ -564,10 +549,9 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp(IT8951_Load_Img_Info*Load_Im
 static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_PerRow(IT8951_Load_Img_Info* Load_Img_Info,
                                                               IT8951_Area_Img_Info* Area_Img_Info)
 {
-    // Compute the number of words per row.
-    // Original code assumed: (Area_W * 4 / 8) / 2  which is Area_W/4 if no rounding issues.
+    // Compute the number of words per row, Area_W/4 for 4bpp.
     // It may be necessary to account for line padding if required by the controller.
-    UWORD words_per_row = (Area_Img_Info->Area_W * 4 / 8) / 2;  
+    UWORD words_per_row = EPD_IT8951_RowWords(Load_Img_Info, Area_Img_Info);
     UWORD num_rows = Area_Img_Info->Area_H;
     
     // Pointer to the start of the image data.
@@ -576,6 +560,13 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_PerRow(IT8951_Load_Img_Info*
     // Loop through each row.
     for (UWORD row = 0; row < num_rows; row++)
     {
+        // Every row is a load image command of its own, so the upload can stop between them.
+        if (EPD_IT8951_UploadAborted())
+        {
+            Debug("Upload aborted after %d of %d rows\r\n", row, num_rows);
+            break;
+        }
+
         // Prepare a row-specific area info.
         IT8951_Area_Img_Info row_area = *Area_Img_Info;
         row_area.Area_Y = Area_Img_Info->Area_Y + row;
@@ -605,7 +596,8 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_Telegram(IT8951_Load_Img_Inf
     // For 4 bits per pixel, each pixel is 0.5 byte.
     // Therefore, for Area_W pixels: (Area_W / 2) bytes total.
     // Each 16-bit word holds 2 bytes: words_per_row = (Area_W / 2) / 2 = Area_W / 4.
-    UWORD words_per_row = (Area_Img_Info->Area_W * 4 / 8) / 2;
+    // The same writer serves the 1bpp and 2bpp uploads, see EPD_IT8951_RowWords().
+    UWORD words_per_row = EPD_IT8951_RowWords(Load_Img_Info, Area_Img_Info);
     UWORD total_rows = Area_Img_Info->Area_H;
     UWORD* Source_Buffer = (UWORD*)Load_Img_Info->Source_Buffer_Addr;
     UWORD current_row = 0;
@@ -615,8 +607,15 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_Telegram(IT8951_Load_Img_Inf
     
     while (current_row < total_rows)
     {
+        // The previous telegram was closed with LoadImgEnd, so the upload can stop here.
+        if (EPD_IT8951_UploadAborted())
+        {
+            Debug("Upload aborted after %d of %d rows\r\n", current_row, total_rows);
+            break;
+        }
+
         // Determine the number of rows to send in this telegram.
-        UWORD telegram_rows = TELEGRAM_ROWS;
+        UWORD telegram_rows = (Telegram_Rows == 0) ? 1 : Telegram_Rows;
         if ((total_rows - current_row) < telegram_rows)
         {
             telegram_rows = total_rows - current_row;
@@ -640,7 +639,7 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_Telegram(IT8951_Load_Img_Inf
         while (remaining > 0)
         {
             // Determine the burst size.
-            UDOUBLE burst = (remaining > BURST_SIZE) ? BURST_SIZE : remaining;
+            UDOUBLE burst = (remaining > EPD_IT8951_BurstWords()) ? EPD_IT8951_BurstWords() : remaining;
             
             // Wait until the controller is ready.
             EPD_IT8951_ReadBusy();
@@ -686,7 +685,7 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_WholeImage(IT8951_Load_Img_I
     // Thus, for Area_W pixels: (Area_W / 2) bytes.
     // Each 16-bit word holds 2 bytes, so:
     //    words_per_row = (Area_W / 2) / 2 = Area_W / 4.
-    UWORD words_per_row = (Area_Img_Info->Area_W * 4 / 8) / 2;
+    UWORD words_per_row = EPD_IT8951_RowWords(Load_Img_Info, Area_Img_Info);
     UWORD total_rows = Area_Img_Info->Area_H;
     UWORD* Source_Buffer = (UWORD*)Load_Img_Info->Source_Buffer_Addr;
 
@@ -711,7 +710,7 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_WholeImage(IT8951_Load_Img_I
     while (remaining > 0)
     {
         // Determine how many words to send in this burst.
-        UDOUBLE burst = (remaining > BURST_SIZE) ? BURST_SIZE : remaining;
+        UDOUBLE burst = (remaining > EPD_IT8951_BurstWords()) ? EPD_IT8951_BurstWords() : remaining;
 
         // Wait until the controller is ready.
         EPD_IT8951_ReadBusy();
@@ -756,7 +755,7 @@ static void EPD_IT8951_HostAreaPackedPixelWrite_4bp_OneChunk(IT8951_Load_Img_Inf
     // Thus, for Area_W pixels: (Area_W / 2) bytes.
     // Each 16-bit word holds 2 bytes, so:
     //   words_per_row = (Area_W / 2) / 2 = Area_W / 4.
-    UWORD words_per_row = (Area_Img_Info->Area_W * 4 / 8) / 2;
+    UWORD words_per_row = EPD_IT8951_RowWords(Load_Img_Info, Area_Img_Info);
     UWORD total_rows = Area_Img_Info->Area_H;
     UWORD* Source_Buffer = (UWORD*)Load_Img_Info->Source_Buffer_Addr;
     
@@ -968,6 +967,17 @@ IT8951_Dev_Info EPD_IT8951_Init(UWORD VCOM)
     EPD_IT8951_SystemRun();
 
     EPD_IT8951_GetSystemInfo(&Dev_Info);
+
+    //The 6inch LUT (M641) has no GLR16/GLD16, so A2 moves up to 4
+    if( strncmp((char*)Dev_Info.LUT_Version, "M641", 4) == 0 )
+    {
+        A2_Mode = 4;
+    }
+    else
+    {
+        A2_Mode = 6;
+    }
+    Debug("A2 Mode = %d\r\n", A2_Mode);
     
     //Enable Pack write
     EPD_IT8951_WriteReg(I80CPCR,0x0001);
@@ -982,6 +992,33 @@ IT8951_Dev_Info EPD_IT8951_Init(UWORD VCOM)
 }
 
 
+/******************************************************************************
+function :	EPD_IT8951_Check_Link
+parameter:  Dev_Info : what EPD_IT8951_Init() read at a safe SPI clock
+Info     :  Reads the device info and a register pattern back, false on any
+            difference, e.g. when the SPI clock is too high for the wiring
+******************************************************************************/
+bool EPD_IT8951_Check_Link(IT8951_Dev_Info Dev_Info)
+{
+    static const UWORD Pattern[] = {0x0000, 0xFFFF, 0xA5A5, 0x5A5A, 0x0F0F};
+    IT8951_Dev_Info Read_Info;
+
+    EPD_IT8951_WriteCommand(USDEF_I80_CMD_GET_DEV_INFO);
+    EPD_IT8951_ReadMultiData((UWORD*)&Read_Info, sizeof(IT8951_Dev_Info)/2);
+    if(memcmp(&Read_Info, &Dev_Info, sizeof(IT8951_Dev_Info)) != 0)
+        return false;
+
+    //LISAR is written again before every image load
+    for(UWORD i = 0; i < sizeof(Pattern)/sizeof(Pattern[0]); i++)
+    {
+        EPD_IT8951_WriteReg(LISAR, Pattern[i]);
+        if(EPD_IT8951_ReadReg(LISAR) != Pattern[i])
+            return false;
+    }
+    return true;
+}
+
+
 /******************************************************************************
 function :	EPD_IT8951_Clear_Refresh
 parameter:  
@@ -1146,10 +1183,12 @@ void EPD_IT8951_2bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H
 
 
 /******************************************************************************
-function :	EPD_IT8951_4bp_Refresh
-parameter:  
+function :	Upload an area with the selected Write_Strategy, no refresh
+parameter:  Pixel_Format : IT8951_2BPP, IT8951_4BPP, or IT8951_8BPP for 1bpp
+            areas whose X and W are given in bytes
 ******************************************************************************/
-void EPD_IT8951_4bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, bool Hold, UDOUBLE Target_Memory_Addr, bool Packed_Write)
+static void EPD_IT8951_Strategy_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UWORD Pixel_Format,
+                                      UDOUBLE Target_Memory_Addr, bool Packed_Write)
 {
     IT8951_Load_Img_Info Load_Img_Info;
     IT8951_Area_Img_Info Area_Img_Info;
@@ -1158,7 +1197,7 @@ void EPD_IT8951_4bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H
 
     Load_Img_Info.Source_Buffer_Addr = Frame_Buf;
     Load_Img_Info.Endian_Type = IT8951_LDIMG_L_ENDIAN;
-    Load_Img_Info.Pixel_Format = IT8951_4BPP;
+    Load_Img_Info.Pixel_Format = Pixel_Format;
     Load_Img_Info.Rotate =  IT8951_ROTATE_0;
     Load_Img_Info.Target_Memory_Addr = Target_Memory_Addr;
 
@@ -1167,16 +1206,139 @@ void EPD_IT8951_4bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H
     Area_Img_Info.Area_W = W;
     Area_Img_Info.Area_H = H;
 
+    switch(Write_Strategy)
+    {
+    case IT8951_WRITE_PACKED:
+        EPD_IT8951_HostAreaPackedPixelWrite_4bp(&Load_Img_Info, &Area_Img_Info, Packed_Write);
+        break;
+    case IT8951_WRITE_PER_ROW:
+        EPD_IT8951_HostAreaPackedPixelWrite_4bp_PerRow(&Load_Img_Info, &Area_Img_Info);
+        break;
+    case IT8951_WRITE_WHOLE_IMAGE:
+        EPD_IT8951_HostAreaPackedPixelWrite_4bp_WholeImage(&Load_Img_Info, &Area_Img_Info);
+        break;
+    case IT8951_WRITE_ONE_CHUNK:
+        EPD_IT8951_HostAreaPackedPixelWrite_4bp_OneChunk(&Load_Img_Info, &Area_Img_Info);
+        break;
+    case IT8951_WRITE_TELEGRAM:
+    default:
+        EPD_IT8951_HostAreaPackedPixelWrite_4bp_Telegram(&Load_Img_Info, &Area_Img_Info);
+        break;
+    }
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_4bp_Write
+parameter:  Upload a 4bpp area with the selected Write_Strategy, no refresh
+******************************************************************************/
+void EPD_IT8951_4bp_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UDOUBLE Target_Memory_Addr, bool Packed_Write)
+{
+    EPD_IT8951_Strategy_Write(Frame_Buf, X, Y, W, H, IT8951_4BPP, Target_Memory_Addr, Packed_Write);
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_2bp_Write
+parameter:  Upload a 2bpp area (pixel X%4 in bits 2*(X%4)) like EPD_IT8951_4bp_Write,
+            the controller keeps each pixel as v<<6, so only the gray levels
+            0x00, 0x40, 0x80 and 0xC0 can be loaded this way. W a multiple of 8
+******************************************************************************/
+void EPD_IT8951_2bp_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UDOUBLE Target_Memory_Addr, bool Packed_Write)
+{
+    EPD_IT8951_Strategy_Write(Frame_Buf, X, Y, W, H, IT8951_2BPP, Target_Memory_Addr, Packed_Write);
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_1bp_Write
+parameter:  Upload a 1bpp area (pixel X%8 in bit X%8) like EPD_IT8951_4bp_Write,
+            show it with EPD_IT8951_1bp_Area_Refresh(). X and W multiples of 16
+******************************************************************************/
+void EPD_IT8951_1bp_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UDOUBLE Target_Memory_Addr, bool Packed_Write)
+{
+    //Use 8bpp to set 1bpp
+    EPD_IT8951_Strategy_Write(Frame_Buf, X/8, Y, W/8, H, IT8951_8BPP, Target_Memory_Addr, Packed_Write);
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_1bp_Area_Refresh
+parameter:  Refresh an area uploaded before with EPD_IT8951_1bp_Write
+            Back_Gray_Val : shown for the 0 bits, Front_Gray_Val : for the 1 bits
+            The controller is in 1bpp mode during the refresh, so it waits for
+            the LUT engines before and after it. For several areas with the
+            same gray values use EPD_IT8951_1bp_Mode_Begin() instead
+******************************************************************************/
+void EPD_IT8951_1bp_Area_Refresh(UWORD X, UWORD Y, UWORD W, UWORD H, UBYTE Mode, UDOUBLE Target_Memory_Addr,
+                                 UBYTE Back_Gray_Val, UBYTE Front_Gray_Val)
+{
+    EPD_IT8951_1bp_Mode_Begin(Back_Gray_Val, Front_Gray_Val);
+    EPD_IT8951_1bp_Area_Display(X, Y, W, H, Mode, Target_Memory_Addr);
+    EPD_IT8951_1bp_Mode_End();
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_1bp_Mode_Begin
+parameter:  Switch the controller to 1bpp display mode once the LUT engines are
+            idle, then refresh any number of areas uploaded with EPD_IT8951_1bp_Write
+            with EPD_IT8951_1bp_Area_Display; they run in parallel like 4bpp areas.
+            Back_Gray_Val : shown for the 0 bits, Front_Gray_Val : for the 1 bits
+******************************************************************************/
+void EPD_IT8951_1bp_Mode_Begin(UBYTE Back_Gray_Val, UBYTE Front_Gray_Val)
+{
+    EPD_IT8951_WaitForDisplayReady();
+
+    //Set Display mode to 1 bpp mode - Set 0x18001138 Bit[18](0x1800113A Bit[2])to 1
+    EPD_IT8951_WriteReg(UP1SR+2, EPD_IT8951_ReadReg(UP1SR+2) | (1<<2) );
+    EPD_IT8951_WriteReg(BGVR, (Front_Gray_Val<<8) | Back_Gray_Val);
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_1bp_Area_Display
+parameter:  Refresh one area between EPD_IT8951_1bp_Mode_Begin and
+            EPD_IT8951_1bp_Mode_End, without waiting for it
+******************************************************************************/
+void EPD_IT8951_1bp_Area_Display(UWORD X, UWORD Y, UWORD W, UWORD H, UBYTE Mode, UDOUBLE Target_Memory_Addr)
+{
+    if(Target_Memory_Addr == 0)
+    {
+        EPD_IT8951_Display_Area(X,Y,W,H,Mode);
+    }
+    else
+    {
+        EPD_IT8951_Display_AreaBuf(X,Y,W,H,Mode,Target_Memory_Addr);
+    }
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_1bp_Mode_End
+parameter:  Wait for the 1bpp refreshes to finish and switch back to the
+            normal display mode
+******************************************************************************/
+void EPD_IT8951_1bp_Mode_End(void)
+{
+    EPD_IT8951_WaitForDisplayReady();
+
+    EPD_IT8951_WriteReg(UP1SR+2, EPD_IT8951_ReadReg(UP1SR+2) & ~(1<<2) );
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_4bp_Refresh
+parameter:  
+******************************************************************************/
+void EPD_IT8951_4bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, bool Hold, UDOUBLE Target_Memory_Addr, bool Packed_Write)
+{
     /*struct timespec start, end;
     double elapsed_ms;
 
     // Record start time
     clock_gettime(CLOCK_MONOTONIC, &start);*/
-    //EPD_IT8951_HostAreaPackedPixelWrite_4bp(&Load_Img_Info, &Area_Img_Info, Packed_Write);
-    //EPD_IT8951_HostAreaPackedPixelWrite_4bp_PerRow(&Load_Img_Info, &Area_Img_Info); 
-    EPD_IT8951_HostAreaPackedPixelWrite_4bp_Telegram(&Load_Img_Info, &Area_Img_Info);       
-    //EPD_IT8951_HostAreaPackedPixelWrite_4bp_WholeImage(&Load_Img_Info, &Area_Img_Info);
-    //EPD_IT8951_HostAreaPackedPixelWrite_4bp_OneChunk(&Load_Img_Info, &Area_Img_Info);
+    EPD_IT8951_4bp_Write(Frame_Buf, X, Y, W, H, Target_Memory_Addr, Packed_Write);
 
     /*// Record end time
     clock_gettime(CLOCK_MONOTONIC, &end);
@@ -1187,13 +1349,26 @@ void EPD_IT8951_4bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H
 
     printf("Elapsed time HostAreaPackedPixelWrite: %f ms\n", elapsed_ms);*/
 
+    EPD_IT8951_4bp_Area_Refresh(X, Y, W, H, GC16_Mode, Hold, Target_Memory_Addr);
+}
+
+
+/******************************************************************************
+function :	EPD_IT8951_4bp_Area_Refresh
+parameter:  Refresh an area uploaded before with EPD_IT8951_4bp_Write
+            Mode : GC16_Mode, GL16_Mode, DU_Mode or A2_Mode
+            Areas that do not overlap are driven in parallel by the LUT engines,
+            so upload all of them first and refresh them one after the other
+******************************************************************************/
+void EPD_IT8951_4bp_Area_Refresh(UWORD X, UWORD Y, UWORD W, UWORD H, UBYTE Mode, bool Hold, UDOUBLE Target_Memory_Addr)
+{
     if(Hold == true)
     {
-        EPD_IT8951_Display_Area(X,Y,W,H, GC16_Mode);
+        EPD_IT8951_Display_Area(X,Y,W,H, Mode);
     }
     else
     {
-        EPD_IT8951_Display_AreaBuf(X,Y,W,H, GC16_Mode,Target_Memory_Addr);
+        EPD_IT8951_Display_AreaBuf(X,Y,W,H, Mode,Target_Memory_Addr);
     }
 }
 
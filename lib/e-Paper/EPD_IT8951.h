@@ -42,6 +42,35 @@ extern UBYTE INIT_Mode;
 extern UBYTE GC16_Mode;
 // A2 mode, for fast refresh without flash
 extern UBYTE A2_Mode;
+// DU mode, any gray level to black or white, no flash
+extern UBYTE DU_Mode;
+// GL16 mode, 16 grayscale without flash, for text on a white background
+extern UBYTE GL16_Mode;
+
+//How EPD_IT8951_4bp_Refresh() moves the frame buffer over SPI
+typedef enum {
+    IT8951_WRITE_PACKED = 0,    //one CS period for the whole area (word by word if !Packed_Write)
+    IT8951_WRITE_PER_ROW,       //one load image command per row
+    IT8951_WRITE_TELEGRAM,      //load image command per block of rows, bulk SPI bursts
+    IT8951_WRITE_WHOLE_IMAGE,   //one load image command, bulk SPI bursts
+    IT8951_WRITE_ONE_CHUNK,     //one load image command, one SPI transfer of the whole area
+    IT8951_WRITE_STRATEGY_NUM
+} IT8951_Write_Strategy;
+
+// Strategy used for 4bpp uploads, default IT8951_WRITE_TELEGRAM
+extern IT8951_Write_Strategy Write_Strategy;
+// Rows per load image command for IT8951_WRITE_TELEGRAM, default 100
+extern UWORD Telegram_Rows;
+// 16-bit words per CS period for the burst strategies, default 8190
+extern UWORD Burst_Size;
+// Largest Burst_Size, the burst buffer lives on the stack
+#define IT8951_BURST_SIZE_MAX 16382
+
+// Asked before each load image command of IT8951_WRITE_TELEGRAM and IT8951_WRITE_PER_ROW
+// uploads; returning true drops the rest of the upload, e.g. when a newer frame is waiting.
+// The rows already sent stay in the image buffer. NULL, the default, never aborts
+typedef bool (*IT8951_Abort_Check)(void);
+extern IT8951_Abort_Check Upload_Abort_Check;
 
 
 typedef struct IT8951_Load_Img_Info
@@ -190,17 +219,30 @@ void EPD_IT8951_Standby(void);
 
 void EPD_IT8951_Sleep(void);
 
+void EPD_IT8951_WaitForDisplayReady(void);
+
 IT8951_Dev_Info EPD_IT8951_Init(UWORD VCOM);
 
+bool EPD_IT8951_Check_Link(IT8951_Dev_Info Dev_Info);
+
 void EPD_IT8951_Clear_Refresh(IT8951_Dev_Info Dev_Info,UDOUBLE Target_Memory_Addr, UWORD Mode);
 
 void EPD_IT8951_1bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UBYTE Mode, UDOUBLE Target_Memory_Addr, bool Packed_Write);
 void EPD_IT8951_1bp_Multi_Frame_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H,UDOUBLE Target_Memory_Addr, bool Packed_Write);
 void EPD_IT8951_1bp_Multi_Frame_Refresh(UWORD X, UWORD Y, UWORD W, UWORD H,UDOUBLE Target_Memory_Addr);
+void EPD_IT8951_1bp_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UDOUBLE Target_Memory_Addr, bool Packed_Write);
+void EPD_IT8951_1bp_Area_Refresh(UWORD X, UWORD Y, UWORD W, UWORD H, UBYTE Mode, UDOUBLE Target_Memory_Addr,
+                                 UBYTE Back_Gray_Val, UBYTE Front_Gray_Val);
+void EPD_IT8951_1bp_Mode_Begin(UBYTE Back_Gray_Val, UBYTE Front_Gray_Val);
+void EPD_IT8951_1bp_Area_Display(UWORD X, UWORD Y, UWORD W, UWORD H, UBYTE Mode, UDOUBLE Target_Memory_Addr);
+void EPD_IT8951_1bp_Mode_End(void);
 
 void EPD_IT8951_2bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, bool Hold, UDOUBLE Target_Memory_Addr, bool Packed_Write);
+void EPD_IT8951_2bp_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UDOUBLE Target_Memory_Addr, bool Packed_Write);
 
+void EPD_IT8951_4bp_Write(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, UDOUBLE Target_Memory_Addr, bool Packed_Write);
 void EPD_IT8951_4bp_Refresh(UBYTE* Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, bool Hold, UDOUBLE Target_Memory_Addr, bool Packed_Write);
+void EPD_IT8951_4bp_Area_Refresh(UWORD X, UWORD Y, UWORD W, UWORD H, UBYTE Mode, bool Hold, UDOUBLE Target_Memory_Addr);
 
 void EPD_IT8951_8bp_Refresh(UBYTE *Frame_Buf, UWORD X, UWORD Y, UWORD W, UWORD H, bool Hold, UDOUBLE Target_Memory_Addr);
 
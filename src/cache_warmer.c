@@ -0,0 +1,188 @@
+//cache_warmer.c
+#include "cache_warmer.h"
+#include "image_cache.h"
+#include "../lib/GUI/GUI_BMPfile.h"
+#include "../lib/GUI/GUI_Paint.h"
+#include "../lib/Config/Debug.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// ioprio_set() has no glibc wrapper.
+#define WARMER_IOPRIO_CLASS_IDLE  3
+#define WARMER_IOPRIO_CLASS_SHIFT 13
+#define WARMER_IOPRIO_WHO_PROCESS 1
+
+static pthread_t warmerThread;
+static int warmerRunning = 0;
+static int stopPipe[2] = { -1, -1 };
+static int stopRequested = 0;
+static UWORD frameWidth;
+static UWORD frameHeight;
+
+static int stopping(void) {
+    return __atomic_load_n(&stopRequested, __ATOMIC_RELAXED);
+}
+
+static int isBmpName(const char *name) {
+    const char *dot = strrchr(name, '.');
+    return name[0] != '.' && dot && strcasecmp(dot, ".bmp") == 0;
+}
+
+// Lowest CPU and I/O priority for the calling thread only.
+static void lowerPriority(void) {
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, 19) != 0)
+        Debug("CacheWarmer: Failed to lower the CPU priority.\n");
+#ifdef SYS_ioprio_set
+    if (syscall(SYS_ioprio_set, WARMER_IOPRIO_WHO_PROCESS, tid,
+                WARMER_IOPRIO_CLASS_IDLE << WARMER_IOPRIO_CLASS_SHIFT) != 0)
+        Debug("CacheWarmer: Failed to lower the I/O priority.\n");
+#endif
+}
+
+// Decodes one BMP into its cache file, unless the file is already valid.
+static void warmImage(const char *name) {
+    char bmpPath[512];
+    char cachePath[256];
+    ImageCacheKey key;
+
+    snprintf(bmpPath, sizeof(bmpPath), CACHE_WARMER_BMP_DIR "/%s", name);
+    makeImageCachePath(name, cachePath, sizeof(cachePath));
+    if (makeImageCacheKey(bmpPath, frameWidth, frameHeight, 4, ROTATE_0, MIRROR_NONE, &key) != 0)
+        return;
+    if (checkPreDecodedImage(cachePath, &key) == 0)
+        return;
+
+    UDOUBLE size = (UDOUBLE)frameWidth / 2 * frameHeight;
+    UBYTE *buffer = (UBYTE *)malloc(size);
+    if (!buffer) {
+        Debug("CacheWarmer: Memory allocation failed for %s.\n", name);
+        return;
+    }
+    memset(buffer, 0xFF, size);
+    BMP_Canvas canvas = { buffer, frameWidth, frameHeight, frameWidth / 2 };
+    BMP_Result ret = BMP_Decode_File(bmpPath, &canvas, 0, 0);
+    if (ret != BMP_OK) {
+        // A file still being copied fails here and comes back with its close event.
+        Debug("CacheWarmer: Failed to decode %s: %s.\n", bmpPath, BMP_Result_String(ret));
+    } else if (cachePreDecodedImage(cachePath, &key, buffer, size) != 0) {
+        Debug("CacheWarmer: Failed to write %s.\n", cachePath);
+    } else {
+        Debug("CacheWarmer: Decoded %s into %s.\n", bmpPath, cachePath);
+    }
+    free(buffer);
+}
+
+static void warmDirectory(void) {
+    DIR *dir = opendir(CACHE_WARMER_BMP_DIR);
+    if (!dir) {
+        Debug("CacheWarmer: Cannot open " CACHE_WARMER_BMP_DIR ".\n");
+        return;
+    }
+    struct dirent *entry;
+    while (!stopping() && (entry = readdir(dir)) != NULL) {
+        if (isBmpName(entry->d_name))
+            warmImage(entry->d_name);
+    }
+    closedir(dir);
+}
+
+static void *warmerMain(void *arg) {
+    (void)arg;
+    lowerPriority();
+
+    // Watch first, so nothing that arrives during the scan is missed.
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, CACHE_WARMER_BMP_DIR,
+                                     IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+        Debug("CacheWarmer: Cannot watch " CACHE_WARMER_BMP_DIR ", only scanning it once.\n");
+
+    warmDirectory();
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (fd >= 0 && !stopping()) {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { stopPipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        ssize_t len = read(fd, events, sizeof(events));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        for (char *p = events; p < events + len && !stopping(); ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost, look at everything again.
+                warmDirectory();
+            } else if (event->mask & IN_IGNORED) {
+                Debug("CacheWarmer: " CACHE_WARMER_BMP_DIR " is gone, no longer watching it.\n");
+                close(fd);
+                fd = -1;
+                break;
+            } else if (event->len > 0 && !(event->mask & IN_ISDIR) && isBmpName(event->name)) {
+                warmImage(event->name);
+            }
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+int CacheWarmer_Start(UWORD width, UWORD height) {
+    if (warmerRunning)
+        return 0;
+    frameWidth = width;
+    frameHeight = height;
+    mkdir(IMAGE_CACHE_DIR, 0777);
+
+    if (pipe(stopPipe) != 0) {
+        Debug("CacheWarmer_Start: pipe() failed.\n");
+        return -1;
+    }
+    __atomic_store_n(&stopRequested, 0, __ATOMIC_RELAXED);
+    if (pthread_create(&warmerThread, NULL, warmerMain, NULL) != 0) {
+        Debug("CacheWarmer_Start: Failed to start the thread.\n");
+        close(stopPipe[0]);
+        close(stopPipe[1]);
+        return -1;
+    }
+    warmerRunning = 1;
+    return 0;
+}
+
+void CacheWarmer_Stop(void) {
+    if (!warmerRunning)
+        return;
+    __atomic_store_n(&stopRequested, 1, __ATOMIC_RELAXED);
+    if (write(stopPipe[1], "", 1) != 1)
+        Debug("CacheWarmer_Stop: Failed to wake the thread.\n");
+    pthread_join(warmerThread, NULL);
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    warmerRunning = 0;
+}
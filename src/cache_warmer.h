@@ -0,0 +1,28 @@
+//cache_warmer.h
+#ifndef CACHE_WARMER_H
+#define CACHE_WARMER_H
+
+#include "../lib/Config/DEV_Config.h"
+
+#define CACHE_WARMER_BMP_DIR  "./pic/bmp"
+
+/**
+ * @brief Starts the background thread that keeps ./pic/raw in step with ./pic/bmp.
+ *
+ * It first decodes every BMP without a valid cache file, then watches the directory
+ * with inotify and decodes new, replaced and touched BMPs as they arrive. It runs at
+ * the lowest CPU and I/O priority and decodes on its own thread only, so the display
+ * path is not slowed down.
+ *
+ * @param width  Frame width, the aligned panel width loadImageBuffer() decodes for.
+ * @param height Frame height.
+ * @return 0 on success, -1 if the thread could not be started.
+ */
+int CacheWarmer_Start(UWORD width, UWORD height);
+
+/**
+ * @brief Stops the thread after the image it is decoding, if any.
+ */
+void CacheWarmer_Stop(void);
+
+#endif // CACHE_WARMER_H
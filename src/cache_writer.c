@@ -0,0 +1,158 @@
+//cache_writer.c
+#include "cache_writer.h"
+#include "frame_cache.h"
+#include "../lib/Config/Debug.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    char cachePath[256];
+    ImageCacheKey key;
+    UBYTE *frame;           // Reference held in the frame cache until written.
+    UDOUBLE size;
+    uint64_t hash;
+} CacheWriteJob;
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueWake = PTHREAD_COND_INITIALIZER;
+static CacheWriteJob queue[CACHE_WRITER_QUEUE_LEN];
+static int queued = 0;
+static int stopRequested = 0;
+static int writerRunning = 0;
+static pthread_t writerThread;
+
+static int sameKey(const ImageCacheKey *a, const ImageCacheKey *b) {
+    return a->width == b->width && a->height == b->height && a->bpp == b->bpp &&
+           a->rotate == b->rotate && a->mirror == b->mirror &&
+           a->sourceSize == b->sourceSize && a->sourceMtimeNs == b->sourceMtimeNs;
+}
+
+// Writes a batch of frames: all temporary files first, then one flush each,
+// then the renames and a single flush of the directory for all of them.
+static void writeBatch(CacheWriteJob *jobs, int count) {
+    char tmpPaths[CACHE_WRITER_QUEUE_LEN][300];
+    int fds[CACHE_WRITER_QUEUE_LEN];
+    int renamed = 0;
+
+    for (int i = 0; i < count; i++) {
+        fds[i] = writePreDecodedImage(jobs[i].cachePath, &jobs[i].key, jobs[i].frame, jobs[i].size,
+                                      jobs[i].hash, tmpPaths[i], sizeof(tmpPaths[i]));
+        if (fds[i] < 0)
+            Debug("CacheWriter: Failed to write %s.\n", jobs[i].cachePath);
+        FrameCache_Release(jobs[i].frame);
+    }
+    for (int i = 0; i < count; i++) {
+        if (fds[i] < 0)
+            continue;
+        int ok = fdatasync(fds[i]) == 0;
+        if (close(fds[i]) != 0)
+            ok = 0;
+        if (!ok || rename(tmpPaths[i], jobs[i].cachePath) != 0) {
+            Debug("CacheWriter: Failed to replace %s.\n", jobs[i].cachePath);
+            remove(tmpPaths[i]);
+            continue;
+        }
+        renamed++;
+    }
+    if (renamed > 0) {
+        // Makes the renames themselves survive a crash.
+        int dirFd = open(IMAGE_CACHE_DIR, O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+        Debug("CacheWriter: Wrote %d cache file(s).\n", renamed);
+    }
+}
+
+static void *writerMain(void *arg) {
+    (void)arg;
+    CacheWriteJob jobs[CACHE_WRITER_QUEUE_LEN];
+    for (;;) {
+        pthread_mutex_lock(&queueLock);
+        while (queued == 0 && !stopRequested)
+            pthread_cond_wait(&queueWake, &queueLock);
+        if (queued == 0) {
+            pthread_mutex_unlock(&queueLock);
+            break;
+        }
+        // Take everything queued so far, it is flushed as one batch.
+        int count = queued;
+        memcpy(jobs, queue, count * sizeof(CacheWriteJob));
+        queued = 0;
+        pthread_mutex_unlock(&queueLock);
+
+        writeBatch(jobs, count);
+    }
+    return NULL;
+}
+
+int CacheWriter_Start(void) {
+    if (writerRunning)
+        return 0;
+    stopRequested = 0;
+    if (pthread_create(&writerThread, NULL, writerMain, NULL) != 0) {
+        Debug("CacheWriter_Start: Failed to start the thread.\n");
+        return -1;
+    }
+    writerRunning = 1;
+    return 0;
+}
+
+int CacheWriter_Queue(const char *cachePath, const ImageCacheKey *key, UBYTE *frame, UDOUBLE size,
+                      uint64_t hash) {
+    if (!writerRunning)
+        return cachePreDecodedImage(cachePath, key, frame, size);
+    if (!FrameCache_Retain(frame))
+        return -1;
+
+    UBYTE *dropped = NULL;
+    int ret = 0;
+    pthread_mutex_lock(&queueLock);
+    int i = 0;
+    while (i < queued && strcmp(queue[i].cachePath, cachePath) != 0)
+        i++;
+    if (i < queued && sameKey(&queue[i].key, key)) {
+        // Already on its way to the same file.
+        dropped = frame;
+    } else if (i < queued) {
+        // Decoded from a newer version of the BMP, write that one instead.
+        dropped = queue[i].frame;
+        queue[i].key = *key;
+        queue[i].frame = frame;
+        queue[i].size = size;
+        queue[i].hash = hash;
+    } else if (queued == CACHE_WRITER_QUEUE_LEN) {
+        Debug("CacheWriter_Queue: Queue full, not caching %s.\n", cachePath);
+        dropped = frame;
+        ret = -1;
+    } else {
+        CacheWriteJob *job = &queue[queued++];
+        strncpy(job->cachePath, cachePath, sizeof(job->cachePath) - 1);
+        job->cachePath[sizeof(job->cachePath) - 1] = '\0';
+        job->key = *key;
+        job->frame = frame;
+        job->size = size;
+        job->hash = hash;
+        pthread_cond_signal(&queueWake);
+    }
+    pthread_mutex_unlock(&queueLock);
+
+    FrameCache_Release(dropped);
+    return ret;
+}
+
+void CacheWriter_Stop(void) {
+    if (!writerRunning)
+        return;
+    pthread_mutex_lock(&queueLock);
+    stopRequested = 1;
+    pthread_cond_signal(&queueWake);
+    pthread_mutex_unlock(&queueLock);
+    pthread_join(writerThread, NULL);
+    writerRunning = 0;
+}
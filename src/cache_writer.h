@@ -0,0 +1,38 @@
+//cache_writer.h
+#ifndef CACHE_WRITER_H
+#define CACHE_WRITER_H
+
+#include "../lib/Config/DEV_Config.h"
+#include "image_cache.h"
+#include <stdint.h>
+
+#define CACHE_WRITER_QUEUE_LEN  8
+
+/**
+ * @brief Starts the thread that writes cache files behind the display path.
+ *
+ * Without it, CacheWriter_Queue() writes synchronously.
+ *
+ * @return 0 on success, -1 if the thread could not be started.
+ */
+int CacheWriter_Start(void);
+
+/**
+ * @brief Queues a decoded frame to be written to its cache file.
+ *
+ * The frame must be held in the frame cache; the writer takes its own reference
+ * until the file is written. A frame queued for a cachePath that is already
+ * pending replaces it, or is dropped if it has the same key.
+ *
+ * @param hash ImageSlots_Hash() of the frame.
+ * @return 0 if the frame was queued or written, -1 if the queue is full or the write failed.
+ */
+int CacheWriter_Queue(const char *cachePath, const ImageCacheKey *key, UBYTE *frame, UDOUBLE size,
+                      uint64_t hash);
+
+/**
+ * @brief Writes everything still queued and stops the thread.
+ */
+void CacheWriter_Stop(void);
+
+#endif // CACHE_WRITER_H
@@ -35,6 +35,21 @@ int loadConfig(const char *filename, Config *config) {
         Debug("loadConfig: Error parsing JSON.\n");
         return -1;
     }
+
+    // Defaults for the optional settings.
+    strncpy(config->transferProfilePath, "./config/transfer_profile.json", MAX_STR_LEN - 1);
+    config->calibrateTransfer = 1;
+    config->calibrationMaxSpiHz = 0;
+    config->diffRefresh = 1;
+    config->fullRefreshInterval = 0;
+    config->autoRefreshMode = 1;
+    config->reducedDepthUpload = 1;
+    config->imageSlots = 12;
+    config->preloadImageCount = 0;
+    config->decodeThreads = 0;
+    config->frameCacheMB = 16;
+    config->cacheWarmer = 1;
+    config->cacheCompression = 0;
     
     // Extract values from the JSON.
     cJSON *item = cJSON_GetObjectItemCaseSensitive(json, "DEFAULT_IMAGE_PATH");
@@ -86,6 +101,91 @@ int loadConfig(const char *filename, Config *config) {
     if (cJSON_IsNumber(item)) {
         config->maxReconnectTimeout = item->valueint;
     }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "TRANSFER_PROFILE_PATH");
+    if (cJSON_IsString(item) && (item->valuestring != NULL)) {
+        strncpy(config->transferProfilePath, item->valuestring, MAX_STR_LEN - 1);
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "CALIBRATE_TRANSFER");
+    if (cJSON_IsBool(item)) {
+        config->calibrateTransfer = cJSON_IsTrue(item);
+    } else if (cJSON_IsNumber(item)) {
+        config->calibrateTransfer = item->valueint != 0;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "CALIBRATION_MAX_SPI_HZ");
+    if (cJSON_IsNumber(item)) {
+        config->calibrationMaxSpiHz = item->valueint;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "DIFF_REFRESH");
+    if (cJSON_IsBool(item)) {
+        config->diffRefresh = cJSON_IsTrue(item);
+    } else if (cJSON_IsNumber(item)) {
+        config->diffRefresh = item->valueint != 0;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "FULL_REFRESH_INTERVAL");
+    if (cJSON_IsNumber(item)) {
+        config->fullRefreshInterval = item->valueint;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "AUTO_REFRESH_MODE");
+    if (cJSON_IsBool(item)) {
+        config->autoRefreshMode = cJSON_IsTrue(item);
+    } else if (cJSON_IsNumber(item)) {
+        config->autoRefreshMode = item->valueint != 0;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "REDUCED_DEPTH_UPLOAD");
+    if (cJSON_IsBool(item)) {
+        config->reducedDepthUpload = cJSON_IsTrue(item);
+    } else if (cJSON_IsNumber(item)) {
+        config->reducedDepthUpload = item->valueint != 0;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "IMAGE_SLOTS");
+    if (cJSON_IsNumber(item)) {
+        config->imageSlots = item->valueint;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "PRELOAD_IMAGES");
+    if (cJSON_IsArray(item)) {
+        cJSON *image = NULL;
+        cJSON_ArrayForEach(image, item) {
+            if (config->preloadImageCount >= MAX_PRELOAD_IMAGES)
+                break;
+            if (cJSON_IsString(image) && (image->valuestring != NULL)) {
+                strncpy(config->preloadImages[config->preloadImageCount], image->valuestring, MAX_STR_LEN - 1);
+                config->preloadImageCount++;
+            }
+        }
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "DECODE_THREADS");
+    if (cJSON_IsNumber(item)) {
+        config->decodeThreads = item->valueint;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "FRAME_CACHE_MB");
+    if (cJSON_IsNumber(item)) {
+        config->frameCacheMB = item->valueint;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "CACHE_WARMER");
+    if (cJSON_IsBool(item)) {
+        config->cacheWarmer = cJSON_IsTrue(item);
+    } else if (cJSON_IsNumber(item)) {
+        config->cacheWarmer = item->valueint != 0;
+    }
+
+    item = cJSON_GetObjectItemCaseSensitive(json, "CACHE_COMPRESSION");
+    if (cJSON_IsBool(item)) {
+        config->cacheCompression = cJSON_IsTrue(item);
+    } else if (cJSON_IsNumber(item)) {
+        config->cacheCompression = item->valueint != 0;
+    }
     
     cJSON_Delete(json);
     return 0;
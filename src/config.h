@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #define MAX_STR_LEN 256
+#define MAX_PRELOAD_IMAGES 16
 
 typedef struct {
     char defaultImagePath[MAX_STR_LEN];
@@ -14,6 +15,21 @@ typedef struct {
     int  defaultImageTimeout;
     int  initialReconnectTimeout;
     int  maxReconnectTimeout;
+    char transferProfilePath[MAX_STR_LEN];  // SPI transfer profiles per board and panel.
+    int  calibrateTransfer;                 // Calibrate when there is no profile yet.
+    int  calibrationMaxSpiHz;               // Highest SPI clock calibration may try, 0 keeps the default.
+    int  diffRefresh;                       // Upload and refresh only what changed since the last image.
+    int  fullRefreshInterval;               // Full refresh after this many partial ones, 0 never forces one.
+    int  autoRefreshMode;                   // Pick A2/DU/GL16 for partial refreshes instead of always GC16.
+    int  reducedDepthUpload;                // Upload areas with few gray levels at 1bpp or 2bpp.
+    int  imageSlots;                        // Frames kept in controller memory, the working buffer included.
+    char preloadImages[MAX_PRELOAD_IMAGES][MAX_STR_LEN];  // Uploaded into image slots at startup.
+    int  preloadImageCount;
+    int  decodeThreads;                     // Threads decoding one picture, 0 uses one per core.
+    int  frameCacheMB;                      // Memory for decoded frames kept for reuse, in MB.
+    int  cacheWarmer;                       // Decode new BMPs into the cache in the background.
+    int  cacheCompression;                  // Write pic/raw files run-length encoded: smaller files, but every
+                                            // cache hit is expanded into a copy instead of uploaded from the mapping.
     // Add other settings as needed.
 } Config;
 
@@ -10,6 +10,13 @@
 #include <time.h>
 #include "config.h"
 #include "image_cache.h"
+#include "image_decode.h"
+#include "frame_cache.h"
+#include "cache_warmer.h"
+#include "cache_writer.h"
+#include "frame_diff.h"
+#include "frame_pack.h"
+#include "image_slots.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -22,6 +29,12 @@ volatile int loading_image = 0;  // Flag indicating an image load is in progress
 extern IT8951_Dev_Info global_dev_info;
 extern UDOUBLE Init_Target_Memory_Addr;
 
+// Last frame uploaded to the controller's image buffer, the base for partial refreshes.
+static UBYTE *shadow_frame = NULL;
+static UDOUBLE shadow_size = 0;
+static uint64_t shadow_hash = 0;
+static int partial_refreshes = 0;
+
 /* Helper to calculate aligned width and image buffer size */
 static void computeAlignedWidthAndBufferSize(IT8951_Dev_Info dev_info, UWORD *aligned_width, UDOUBLE *buffer_size) {
     UWORD width = dev_info.Panel_W;
@@ -35,23 +48,331 @@ static inline const char* getDefaultImageFilename() {
     return slash ? slash + 1 : globalConfig.defaultImagePath;
 }
 
-// Generic function to load and display an image with caching.
-// If imagePath is non-empty, it attempts to load a pre-decoded image
-// from the cache. If not present (or size mismatch), it decodes the BMP
-// and then caches the result. Finally, the display is refreshed.
-static void loadAndDisplayImage(const char *imagePath, IT8951_Dev_Info dev_info, UDOUBLE mem_addr) {
-    struct timespec start, mid, end;
-    double elapsed_load_ms, elapsed_refresh_ms;
+// Waveform modes picked for partial refreshes, from fastest to best quality.
+typedef enum {
+    REFRESH_A2,
+    REFRESH_DU,
+    REFRESH_GL16,
+    REFRESH_GC16,
+    REFRESH_MODE_NUM
+} RefreshMode;
 
-    // Record start time (for image loading)
-    clock_gettime(CLOCK_MONOTONIC, &start);
+static const char *refreshModeNames[REFRESH_MODE_NUM] = { "A2", "DU", "GL16", "GC16" };
+static unsigned long refreshModeCounts[REFRESH_MODE_NUM];
 
-    if (loading_image) {
-        Debug("loadAndDisplayImage: Another image load is in progress. Skipping this request.\n");
+// Gray changes up to this share of the panel (1/n) are refreshed with GL16.
+#define GL16_MAX_AREA_DIVISOR 8
+
+/* Picks the fastest waveform that can show the change in rect without artifacts:
+   A2 when it stays black and white, DU when it ends black and white,
+   GL16 for a small gray area such as a label, GC16 otherwise. */
+static RefreshMode selectRefreshMode(const UBYTE *prev, const UBYTE *next, UWORD width, UWORD height,
+                                     const FrameRect *rect) {
+    if (!globalConfig.autoRefreshMode)
+        return REFRESH_GC16;
+
+    int levels = FrameDiff_Levels(prev, next, width, rect);
+    if ((levels & FRAME_LEVELS_BW_NEW) && (levels & FRAME_LEVELS_BW_OLD))
+        return REFRESH_A2;
+    if (levels & FRAME_LEVELS_BW_NEW)
+        return REFRESH_DU;
+    if ((UDOUBLE)rect->w * rect->h * GL16_MAX_AREA_DIVISOR <= (UDOUBLE)width * height)
+        return REFRESH_GL16;
+    return REFRESH_GC16;
+}
+
+/* Mode number of the panel's LUT, see EPD_IT8951_Init() */
+static UBYTE refreshModeNumber(RefreshMode mode) {
+    switch (mode) {
+    case REFRESH_A2:   return A2_Mode;
+    case REFRESH_DU:   return DU_Mode;
+    case REFRESH_GL16: return GL16_Mode;
+    default:           return GC16_Mode;
+    }
+}
+
+static void logRefreshModes(const RefreshMode *modes, int count) {
+    char picked[128] = {0};
+    size_t len = 0;
+
+    for (int i = 0; i < count; i++) {
+        refreshModeCounts[modes[i]]++;
+        if (len < sizeof(picked))
+            len += snprintf(picked + len, sizeof(picked) - len, "%s%s", i ? " " : "", refreshModeNames[modes[i]]);
+    }
+    printf("Refresh mode: %s (total A2 %lu, DU %lu, GL16 %lu, GC16 %lu)\n", picked,
+           refreshModeCounts[REFRESH_A2], refreshModeCounts[REFRESH_DU],
+           refreshModeCounts[REFRESH_GL16], refreshModeCounts[REFRESH_GC16]);
+}
+
+/* Picks the narrowest depth that keeps the gray levels of one area, see FramePack_Choose(). */
+static void chooseFormat(const UBYTE *buffer, UWORD width, const FrameRect *rect, FramePackFormat *format) {
+    format->bpp = 4;
+    if (globalConfig.reducedDepthUpload) {
+        UDOUBLE hist[16];
+        FramePack_Histogram(buffer, width, rect, hist);
+        FramePack_Choose(hist, rect, format);
+    }
+}
+
+/* A 1bpp refresh switches the display mode of the whole controller, so the LUT
+   engines have to be idle before the switch and after the refresh. All 1bpp areas
+   of a frame therefore share one switch and refresh in parallel under it, which
+   needs a single pair of gray levels for all of them. A frame with 1bpp areas of
+   different levels, or with areas at other depths as well, would wait for one
+   waveform per switch, far longer than the SPI time saved; its 1bpp areas go at
+   2bpp or 4bpp instead. Returns 1 when every area is refreshed at 1bpp. */
+static int shareOneBitFormat(const FrameRect *rects, FramePackFormat *formats, int count) {
+    UDOUBLE hist[16] = { 0 };
+    int levels = 0, others = 0;
+    for (int i = 0; i < count; i++) {
+        if (formats[i].bpp != 1) {
+            others = 1;
+            continue;
+        }
+        levels += !hist[formats[i].back] + (formats[i].back != formats[i].front && !hist[formats[i].front]);
+        hist[formats[i].back] = hist[formats[i].front] = 1;
+    }
+    if (levels == 0)
+        return 0;
+
+    if (!others && levels <= 2) {
+        // 1bpp areas are aligned, so this picks 1bpp and the bit order of the pair.
+        FramePackFormat common;
+        FramePack_Choose(hist, &rects[0], &common);
+        for (int i = 0; i < count; i++)
+            formats[i] = common;
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (formats[i].bpp == 1)
+            formats[i].bpp = ((formats[i].back | formats[i].front) & 0x3) ? 4 : 2;
+    }
+    return 0;
+}
+
+/* Uploads one area of the frame in the format picked for it. Whole rows at 4bpp
+   go straight from the frame, anything else is packed into scratch first, which
+   holds the area at 4bpp. */
+static void uploadArea(UBYTE *buffer, UWORD width, const FrameRect *rect, UDOUBLE mem_addr,
+                       UBYTE *scratch, const FramePackFormat *format) {
+    if (format->bpp == 4 && rect->x == 0 && rect->w == width) {
+        EPD_IT8951_4bp_Write(buffer + (UDOUBLE)rect->y * (width / 2), rect->x, rect->y, rect->w, rect->h,
+                             mem_addr, true);
         return;
     }
-    loading_image = 1;
 
+    FramePack_Pack(buffer, width, rect, format, scratch);
+    if (format->bpp == 1)
+        EPD_IT8951_1bp_Write(scratch, rect->x, rect->y, rect->w, rect->h, mem_addr, true);
+    else if (format->bpp == 2)
+        EPD_IT8951_2bp_Write(scratch, rect->x, rect->y, rect->w, rect->h, mem_addr, true);
+    else
+        EPD_IT8951_4bp_Write(scratch, rect->x, rect->y, rect->w, rect->h, mem_addr, true);
+    Debug("uploadArea: %ux%u at %u,%u as %ubpp, %u bytes instead of %u.\n", rect->w, rect->h, rect->x, rect->y,
+          format->bpp, FramePack_Size(rect, format->bpp), FramePack_Size(rect, 4));
+}
+
+/* Refreshes an area uploaded by uploadArea(), 1bpp ones through the BGVR color table. */
+static void refreshArea(const FrameRect *rect, UBYTE mode, UDOUBLE mem_addr, const FramePackFormat *format) {
+    if (format->bpp == 1)
+        EPD_IT8951_1bp_Area_Refresh(rect->x, rect->y, rect->w, rect->h, mode, mem_addr,
+                                    format->back << 4, format->front << 4);
+    else
+        EPD_IT8951_4bp_Area_Refresh(rect->x, rect->y, rect->w, rect->h, mode, false, mem_addr);
+}
+
+/* Whether a newer frame is waiting, see Upload_Abort_Check. Uploads stop at the
+   next telegram, and an area uploaded for an obsolete frame is not refreshed. */
+static int frameSuperseded(void) {
+    return Upload_Abort_Check && Upload_Abort_Check();
+}
+
+/* Uploads and refreshes the areas that differ from the shadow frame, or the whole
+   panel when there is no shadow yet or most of the frame changed.
+   With a slot_addr the frame is already in the controller and nothing is uploaded.
+   The shadow follows what the panel shows, not the image buffer at mem_addr: every
+   refreshed area is uploaded whole, so stale pixels around it never reach the panel.
+   Partial refreshes get their own waveform each; full ones always use GC16.
+   Areas with few gray levels go over the wire at 1bpp or 2bpp, see uploadArea().
+   Returns -1, with nothing refreshed, when a newer frame arrived before the refresh;
+   the image buffer may then hold part of this frame, but only areas uploaded whole
+   are ever refreshed, so the shadow stays right. */
+static int refreshChangedAreas(UBYTE *buffer, UWORD width, UWORD height, UDOUBLE buffer_size, UDOUBLE mem_addr,
+                                UDOUBLE slot_addr) {
+    FrameRect rects[FRAME_DIFF_MAX_RECTS];
+    RefreshMode modes[FRAME_DIFF_MAX_RECTS];
+    FramePackFormat formats[FRAME_DIFF_MAX_RECTS];
+    RefreshMode fullMode = REFRESH_GC16;
+    int count = -1;
+
+    if (globalConfig.diffRefresh && shadow_frame && shadow_size == buffer_size &&
+        (globalConfig.fullRefreshInterval <= 0 || partial_refreshes < globalConfig.fullRefreshInterval)) {
+        count = FrameDiff_Find(shadow_frame, buffer, width, height, rects, FRAME_DIFF_MAX_RECTS);
+        // A 1bpp upload needs 16-pixel columns; the bands never share rows, so widening is safe.
+        for (int i = 0; globalConfig.reducedDepthUpload && i < count; i++) {
+            UWORD x1 = rects[i].x + rects[i].w;
+            rects[i].x -= rects[i].x % FRAME_PACK_ALIGN_1BPP;
+            x1 += (FRAME_PACK_ALIGN_1BPP - x1 % FRAME_PACK_ALIGN_1BPP) % FRAME_PACK_ALIGN_1BPP;
+            rects[i].w = (x1 > width ? width : x1) - rects[i].x;
+        }
+        // Past half of the panel, one full area is as fast as several partial ones.
+        if (FrameDiff_Area(rects, count) * 2 > (UDOUBLE)width * height)
+            count = -1;
+    }
+
+    if (count == 0) {
+        Debug("refreshChangedAreas: Frame unchanged, no refresh.\n");
+        return 0;
+    }
+    for (int i = 0; i < count; i++)
+        modes[i] = selectRefreshMode(shadow_frame, buffer, width, height, &rects[i]);
+
+    if (slot_addr) {
+        if (frameSuperseded())
+            return -1;
+        if (count > 0) {
+            for (int i = 0; i < count; i++) {
+                EPD_IT8951_4bp_Area_Refresh(rects[i].x, rects[i].y, rects[i].w, rects[i].h,
+                                            refreshModeNumber(modes[i]), false, slot_addr);
+            }
+            logRefreshModes(modes, count);
+            partial_refreshes++;
+        } else {
+            EPD_IT8951_4bp_Area_Refresh(0, 0, width, height, GC16_Mode, false, slot_addr);
+            logRefreshModes(&fullMode, 1);
+            partial_refreshes = 0;
+        }
+        Debug("refreshChangedAreas: Refreshed from image slot at 0x%X.\n", slot_addr);
+        return 0;
+    }
+
+    if (count > 0) {
+        UDOUBLE largest = 0;
+        for (int i = 0; i < count; i++) {
+            UDOUBLE size = (UDOUBLE)rects[i].w / 2 * rects[i].h;
+            if (size > largest)
+                largest = size;
+            chooseFormat(buffer, width, &rects[i], &formats[i]);
+        }
+        UBYTE *area = (UBYTE *)malloc(largest);
+        if (area) {
+            int oneBit = shareOneBitFormat(rects, formats, count);
+            for (int i = 0; i < count && !frameSuperseded(); i++)
+                uploadArea(buffer, width, &rects[i], mem_addr, area, &formats[i]);
+            free(area);
+            if (frameSuperseded())
+                return -1;
+            if (oneBit) {
+                EPD_IT8951_1bp_Mode_Begin(formats[0].back << 4, formats[0].front << 4);
+                for (int i = 0; i < count; i++)
+                    EPD_IT8951_1bp_Area_Display(rects[i].x, rects[i].y, rects[i].w, rects[i].h,
+                                                refreshModeNumber(modes[i]), mem_addr);
+                EPD_IT8951_1bp_Mode_End();
+            } else {
+                for (int i = 0; i < count; i++)
+                    refreshArea(&rects[i], refreshModeNumber(modes[i]), mem_addr, &formats[i]);
+            }
+            Debug("refreshChangedAreas: %d area(s), %u of %u pixels.\n",
+                  count, FrameDiff_Area(rects, count), (UDOUBLE)width * height);
+            logRefreshModes(modes, count);
+            partial_refreshes++;
+            return 0;
+        }
+        Debug("refreshChangedAreas: Memory allocation failed, refreshing the whole panel.\n");
+    }
+
+    FrameRect full = { 0, 0, width, height };
+    UBYTE *packed = globalConfig.reducedDepthUpload ? (UBYTE *)malloc(FramePack_Size(&full, 2)) : NULL;
+    if (!packed) {
+        formats[0].bpp = 4;
+        EPD_IT8951_4bp_Write(buffer, 0, 0, width, height, mem_addr, true);
+    } else {
+        // Only ever packed narrower than 4bpp, so half the 4bpp size is enough.
+        chooseFormat(buffer, width, &full, &formats[0]);
+        uploadArea(buffer, width, &full, mem_addr, packed, &formats[0]);
+        free(packed);
+    }
+    if (frameSuperseded())
+        return -1;
+    refreshArea(&full, GC16_Mode, mem_addr, &formats[0]);
+    logRefreshModes(&fullMode, 1);
+    partial_refreshes = 0;
+    return 0;
+}
+
+// Frames of the default and disconnected pictures stay in the frame cache.
+static int isPinnedImage(const char *bmpPath) {
+    const char *pinned[2] = { globalConfig.defaultImagePath, globalConfig.disconnectedImagePath };
+    const char *base = strrchr(bmpPath, '/');
+    base = base ? base + 1 : bmpPath;
+    for (int i = 0; i < 2; i++) {
+        const char *pinnedBase = strrchr(pinned[i], '/');
+        pinnedBase = pinnedBase ? pinnedBase + 1 : pinned[i];
+        if (strlen(pinnedBase) > 0 && strcmp(base, pinnedBase) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Looks for the frame of bmpPath in the frame cache, then in its cache file.
+// A raw cache file is mapped and uploaded from directly, without a copy; the
+// frame cache keeps the mapping until the frame is evicted. A compressed one
+// is expanded from the mapping into a frame of its own.
+static UBYTE *loadCachedFrame(const char *bmpPath, const char *cachePath, const ImageCacheKey *key,
+                              UDOUBLE expected_buffer_size, uint64_t *hash) {
+    UBYTE *buffer = FrameCache_Get(bmpPath, key, hash);
+    if (buffer)
+        return buffer;
+
+    UDOUBLE cached_size = 0;
+    int mapped = 0;
+    buffer = mapPreDecodedImage(cachePath, key, &cached_size, hash, &mapped);
+    if (buffer && (cached_size != expected_buffer_size)) {
+        Debug("loadImageBuffer: Cached image size (%u) does not match expected (%u). Re-decoding image.\n",
+              cached_size, expected_buffer_size);
+        if (mapped)
+            unmapPreDecodedImage(buffer, cached_size);
+        else
+            free(buffer);
+        buffer = NULL;
+    }
+    if (!buffer)
+        return NULL;
+    if (!mapped)
+        return FrameCache_Put(bmpPath, key, buffer, expected_buffer_size, *hash, isPinnedImage(bmpPath));
+    return FrameCache_PutMapped(bmpPath, key, buffer, expected_buffer_size, *hash, isPinnedImage(bmpPath));
+}
+
+// Before cache files had a header, pic/raw held bare frames, and some pictures
+// are shipped that way only, without their BMP (default.raw). While the BMP is
+// absent, such a file of exactly one frame is the picture; its key is made from
+// the cache file itself, so replacing the file is noticed.
+static UBYTE *loadLegacyFrame(const char *bmpPath, const char *cachePath, const ImageCacheKey *key,
+                              UDOUBLE expected_buffer_size, uint64_t *hash) {
+    UBYTE *buffer = FrameCache_Get(bmpPath, key, hash);
+    if (buffer)
+        return buffer;
+
+    buffer = loadLegacyImage(cachePath, expected_buffer_size);
+    if (!buffer)
+        return NULL;
+    Debug("loadImageBuffer: %s is absent, showing the frame in %s.\n", bmpPath, cachePath);
+    *hash = ImageSlots_Hash(buffer, expected_buffer_size);
+    return FrameCache_Put(bmpPath, key, buffer, expected_buffer_size, *hash, isPinnedImage(bmpPath));
+}
+
+// Loads an image as a 4bpp frame of the aligned panel width.
+// If imagePath is non-empty, it looks for the frame in the frame cache, then
+// for a pre-decoded image in the cache directory. If not present, or decoded
+// from another version of the BMP or for another panel, it decodes the BMP
+// and then caches the result. Without a BMP, a headerless frame in the cache
+// directory is used, see loadLegacyFrame(). An empty imagePath gives a white frame.
+// With allowFallback, a BMP that fails to decode is replaced by the
+// "no image available" picture, otherwise NULL is returned.
+// The frame is shared through the frame cache: it must not be modified and
+// goes back with FrameCache_Release(). hash receives its ImageSlots_Hash().
+static UBYTE *loadImageBuffer(const char *imagePath, IT8951_Dev_Info dev_info, int allowFallback, uint64_t *hash) {
     UWORD aligned_width;
     UDOUBLE expected_buffer_size;
     computeAlignedWidthAndBufferSize(dev_info, &aligned_width, &expected_buffer_size);
@@ -70,118 +391,282 @@ static void loadAndDisplayImage(const char *imagePath, IT8951_Dev_Info dev_info,
         // Construct the BMP file path in the new location (./pic/bmp/).
         snprintf(bmpPath, sizeof(bmpPath), "./pic/bmp/%s", base);
 
-        // Find the dot in the base filename to remove the extension.
-        const char *dot = strrchr(base, '.');
-        int nameLen = dot ? (dot - base) : strlen(base);
-
         // Ensure the cache directory exists.
         struct stat st = {0};
-        if (stat("./pic/raw", &st) == -1) {
-            if (mkdir("./pic/raw", 0777) != 0) {
-                Debug("loadAndDisplayImage: Failed to create directory ./pic/raw/.\n");
+        if (stat(IMAGE_CACHE_DIR, &st) == -1) {
+            if (mkdir(IMAGE_CACHE_DIR, 0777) != 0) {
+                Debug("loadImageBuffer: Failed to create directory " IMAGE_CACHE_DIR "/.\n");
             }
         }
         // Construct the cache file path based on the requested image.
-        snprintf(cachePath, sizeof(cachePath), "./pic/raw/%.*s.raw", nameLen, base);
+        makeImageCachePath(base, cachePath, sizeof(cachePath));
     }
 
+    // Frames are decoded unrotated at 4bpp; the key ties a cached frame to the
+    // BMP it came from, so a changed BMP is decoded again. The white frame
+    // has no BMP and is only kept in the frame cache, under an empty name.
     UBYTE *buffer = NULL;
-    if (imagePath && strlen(imagePath) > 0) {
-        UDOUBLE cached_size = 0;
-        buffer = loadPreDecodedImage(cachePath, &cached_size);
-        if (buffer && (cached_size != expected_buffer_size)) {
-            Debug("loadAndDisplayImage: Cached image size (%u) does not match expected (%u). Re-decoding image.\n",
-                  cached_size, expected_buffer_size);
-            free(buffer);
-            buffer = NULL;
-        }
+    ImageCacheKey cacheKey;
+    int cacheable = makeImageCacheKey(bmpPath, aligned_width, dev_info.Panel_H, 4,
+                                      ROTATE_0, MIRROR_NONE, &cacheKey) == 0;
+    if (cacheable) {
+        buffer = loadCachedFrame(bmpPath, cachePath, &cacheKey, expected_buffer_size, hash);
+    } else if (strlen(bmpPath) == 0) {
+        buffer = FrameCache_Get("", &cacheKey, hash);
+    } else if (makeImageCacheKey(cachePath, aligned_width, dev_info.Panel_H, 4,
+                                 ROTATE_0, MIRROR_NONE, &cacheKey) == 0) {
+        buffer = loadLegacyFrame(bmpPath, cachePath, &cacheKey, expected_buffer_size, hash);
     }
+    if (buffer)
+        return buffer;
+
+    const char *frameName = cacheable ? bmpPath : NULL;
+    if (strlen(bmpPath) == 0)
+        frameName = "";
 
+    // Allocate buffer for decoding.
+    buffer = (UBYTE *)malloc(expected_buffer_size);
     if (!buffer) {
-        // Allocate buffer for decoding.
-        buffer = (UBYTE *)malloc(expected_buffer_size);
-        if (!buffer) {
-            Debug("loadAndDisplayImage: Memory allocation failed.\n");
-            loading_image = 0;
-            return;
+        Debug("loadImageBuffer: Memory allocation failed.\n");
+        return NULL;
+    }
+
+    // The decoder writes straight into the 4bpp frame; whatever the image
+    // does not cover stays white.
+    BMP_Canvas canvas = { buffer, aligned_width, dev_info.Panel_H, aligned_width / 2 };
+    memset(buffer, 0xFF, expected_buffer_size);
+
+    if (imagePath && strlen(imagePath) > 0) {
+        BMP_Result ret = ImageDecode_File(bmpPath, &canvas, 0, 0);
+        if (ret != BMP_OK && !allowFallback) {
+            Debug("loadImageBuffer: Failed to load image %s: %s.\n", bmpPath, BMP_Result_String(ret));
+            free(buffer);
+            return NULL;
         }
-        
-        Paint_NewImage(buffer, aligned_width, dev_info.Panel_H, 0, BLACK);
-        Paint_SelectImage(buffer);
-        Paint_SetRotate(ROTATE_0);
-        Paint_SetMirroring(MIRROR_NONE);
-        Paint_SetBitsPerPixel(4);
-        Paint_Clear(WHITE);
-
-        if (imagePath && strlen(imagePath) > 0) {
-            int ret = GUI_ReadBmp(bmpPath, 0, 0);
-            if (ret != 0) {
-                Debug("loadAndDisplayImage: Failed to load image %s, error code %d. Attempting fallback.\n", bmpPath, ret);
-                // Only attempt fallback if we're not already trying to load the fallback image.
-                if (strcmp(bmpPath, globalConfig.noImageAvailablePath) != 0) {
-                    // Build fallback paths.
-                    char fallbackBmpPath[256] = {0};
-                    char fallbackCachePath[256] = {0};
-                    int maxFilenameLen = sizeof(fallbackBmpPath) - strlen("./pic/bmp/") - 1;
-                    
-                    // Build fallback BMP path.
-                    if (strchr(globalConfig.noImageAvailablePath, '/') == NULL) {
-                        snprintf(fallbackBmpPath, sizeof(fallbackBmpPath), "./pic/bmp/%.*s", maxFilenameLen, globalConfig.noImageAvailablePath);
+        if (ret != BMP_OK) {
+            Debug("loadImageBuffer: Failed to load image %s: %s. Attempting fallback.\n", bmpPath, BMP_Result_String(ret));
+            // Only attempt fallback if we're not already trying to load the fallback image.
+            if (strcmp(bmpPath, globalConfig.noImageAvailablePath) != 0) {
+                // Build fallback paths.
+                char fallbackBmpPath[256] = {0};
+                char fallbackCachePath[256] = {0};
+                int maxFilenameLen = sizeof(fallbackBmpPath) - strlen("./pic/bmp/") - 1;
+                
+                // Build fallback BMP path.
+                if (strchr(globalConfig.noImageAvailablePath, '/') == NULL) {
+                    snprintf(fallbackBmpPath, sizeof(fallbackBmpPath), "./pic/bmp/%.*s", maxFilenameLen, globalConfig.noImageAvailablePath);
+                } else {
+                    const char *fallbackBase = strrchr(globalConfig.noImageAvailablePath, '/');
+                    fallbackBase = fallbackBase ? fallbackBase + 1 : globalConfig.noImageAvailablePath;
+                    snprintf(fallbackBmpPath, sizeof(fallbackBmpPath), "./pic/bmp/%.*s", maxFilenameLen, fallbackBase);
+                }
+                // Build fallback cache path based on the fallback image's base name.
+                makeImageCachePath(fallbackBmpPath, fallbackCachePath, sizeof(fallbackCachePath));
+                
+                // First, try to load the fallback image from its cache.
+                UBYTE *fallbackBuffer = NULL;
+                ImageCacheKey fallbackKey;
+                int fallbackCacheable = makeImageCacheKey(fallbackBmpPath, aligned_width, dev_info.Panel_H, 4,
+                                                          ROTATE_0, MIRROR_NONE, &fallbackKey) == 0;
+                if (fallbackCacheable) {
+                    fallbackBuffer = loadCachedFrame(fallbackBmpPath, fallbackCachePath, &fallbackKey,
+                                                     expected_buffer_size, hash);
+                }
+                // A failed decode is neither written back nor found again.
+                cacheable = 0;
+                frameName = NULL;
+                if (fallbackBuffer) {
+                    Debug("loadImageBuffer: Loaded fallback image from cache: %s\n", fallbackCachePath);
+                    free(buffer);
+                    return fallbackBuffer;
+                } else {
+                    // Cache not available; decode the fallback image.
+                    // A failed decode may have left part of the image behind.
+                    memset(buffer, 0xFF, expected_buffer_size);
+                    ret = ImageDecode_File(fallbackBmpPath, &canvas, 0, 0);
+                    if (ret != BMP_OK) {
+                        Debug("loadImageBuffer: Fallback image %s also failed: %s.\n", fallbackBmpPath, BMP_Result_String(ret));
                     } else {
-                        const char *fallbackBase = strrchr(globalConfig.noImageAvailablePath, '/');
-                        fallbackBase = fallbackBase ? fallbackBase + 1 : globalConfig.noImageAvailablePath;
-                        snprintf(fallbackBmpPath, sizeof(fallbackBmpPath), "./pic/bmp/%.*s", maxFilenameLen, fallbackBase);
-                    }
-                    // Build fallback cache path based on the fallback image's base name.
-                    const char *fallbackBase = strrchr(fallbackBmpPath, '/');
-                    fallbackBase = fallbackBase ? fallbackBase + 1 : fallbackBmpPath;
-                    const char *dot = strrchr(fallbackBase, '.');
-                    int fbNameLen = dot ? (dot - fallbackBase) : strlen(fallbackBase);
-                    snprintf(fallbackCachePath, sizeof(fallbackCachePath), "./pic/raw/%.*s.raw", fbNameLen, fallbackBase);
-                    
-                    // First, try to load the fallback image from its cache.
-                    UDOUBLE fallbackCachedSize = 0;
-                    UBYTE *fallbackBuffer = loadPreDecodedImage(fallbackCachePath, &fallbackCachedSize);
-                    if (fallbackBuffer && (fallbackCachedSize == expected_buffer_size)) {
-                        Debug("loadAndDisplayImage: Loaded fallback image from cache: %s\n", fallbackCachePath);
-                        free(buffer);
-                        buffer = fallbackBuffer;
-                        // Update cachePath to fallbackCachePath for consistency.
+                        Debug("loadImageBuffer: Successfully loaded fallback image %s from file.\n", fallbackBmpPath);
+                        // Cache it under the fallback's own name and key.
                         strncpy(cachePath, fallbackCachePath, sizeof(cachePath));
-                    } else {
-                        // Either cache not available or size mismatch; decode the fallback image.
-                        ret = GUI_ReadBmp(fallbackBmpPath, 0, 0);
-                        if (ret != 0) {
-                            Debug("loadAndDisplayImage: Fallback image %s also failed, error code %d.\n", fallbackBmpPath, ret);
-                        } else {
-                            Debug("loadAndDisplayImage: Successfully loaded fallback image %s from file.\n", fallbackBmpPath);
-                            // Cache the fallback image.
-                            if (cachePreDecodedImage(fallbackCachePath, buffer, expected_buffer_size) != 0) {
-                                Debug("loadAndDisplayImage: Failed to cache fallback pre-decoded image to %s.\n", fallbackCachePath);
-                            }
-                            // Update cachePath for consistency.
-                            strncpy(cachePath, fallbackCachePath, sizeof(cachePath));
-                        }
+                        cacheKey = fallbackKey;
+                        cacheable = fallbackCacheable;
+                        strncpy(bmpPath, fallbackBmpPath, sizeof(bmpPath));
+                        frameName = fallbackCacheable ? bmpPath : NULL;
                     }
                 }
+            } else {
+                cacheable = 0;
+                frameName = NULL;
             }
         }
-        // Cache the decoded image (whether primary or fallback).
-        if (imagePath && strlen(imagePath) > 0) {
-            if (cachePreDecodedImage(cachePath, buffer, expected_buffer_size) != 0) {
-                Debug("loadAndDisplayImage: Failed to cache pre-decoded image to %s.\n", cachePath);
-            }
+    }
+    *hash = ImageSlots_Hash(buffer, expected_buffer_size);
+    buffer = FrameCache_Put(frameName, &cacheKey, buffer, expected_buffer_size, *hash,
+                            frameName ? isPinnedImage(frameName) : 0);
+
+    // Cache the decoded image (whether primary or fallback). The file is written
+    // behind the refresh, the frame cache holds the frame until then.
+    if (buffer && cacheable) {
+        if (CacheWriter_Queue(cachePath, &cacheKey, buffer, expected_buffer_size, *hash) != 0) {
+            Debug("loadImageBuffer: Failed to cache pre-decoded image to %s.\n", cachePath);
+        }
+    }
+    return buffer;
+}
+
+/* Checks that an "EPD4" packed frame fits a width x height canvas and holds all its pixels */
+static int checkFramePayload(const UBYTE *payload, UDOUBLE len, UWORD width, UWORD height) {
+    FramePayloadHeader header;
+    if (len < sizeof(header)) {
+        return -1;
+    }
+    memcpy(&header, payload, sizeof(header));
+    UDOUBLE rowBytes = ((UDOUBLE)header.width + 1) / 2;
+    if (header.width == 0 || header.height == 0 || header.width > width || header.height > height) {
+        Debug("checkFramePayload: A %ux%u frame does not fit the %ux%u panel.\n",
+              header.width, header.height, width, height);
+        return -1;
+    }
+    if (len - sizeof(header) < rowBytes * header.height) {
+        Debug("checkFramePayload: %u bytes of pixel data, %u expected.\n",
+              len - (UDOUBLE)sizeof(header), rowBytes * header.height);
+        return -1;
+    }
+    return 0;
+}
+
+/* Copies an "EPD4" packed frame into the top left corner of the canvas */
+static int unpackFramePayload(const UBYTE *payload, UDOUBLE len, const BMP_Canvas *canvas) {
+    if (checkFramePayload(payload, len, canvas->Width, canvas->Height) != 0) {
+        return -1;
+    }
+    FramePayloadHeader header;
+    memcpy(&header, payload, sizeof(header));
+    UDOUBLE rowBytes = ((UDOUBLE)header.width + 1) / 2;
+
+    const UBYTE *src = payload + sizeof(header);
+    for (UWORD y = 0; y < header.height; y++, src += rowBytes) {
+        UBYTE *dst = canvas->Image + (UDOUBLE)y * canvas->Width_Byte;
+        memcpy(dst, src, header.width / 2);
+        if (header.width % 2) {
+            // The last pixel is even, the odd one after it stays white.
+            dst[header.width / 2] = (dst[header.width / 2] & 0xF0) | (src[header.width / 2] & 0x0F);
         }
     }
+    return 0;
+}
+
+/* Decodes an image carried in a message straight from the payload, without a file.
+   The frame is kept in the frame cache under a hash of the payload, so the same
+   payload sent again is not decoded again. */
+static UBYTE* loadPayloadBuffer(const UBYTE *payload, UDOUBLE len, IT8951_Dev_Info dev_info, uint64_t *hash) {
+    UWORD aligned_width;
+    UDOUBLE expected_buffer_size;
+    computeAlignedWidthAndBufferSize(dev_info, &aligned_width, &expected_buffer_size);
+
+    // Not a path, so it never matches a frame loaded from a file.
+    char frameName[32];
+    snprintf(frameName, sizeof(frameName), "mqtt:%016llx", (unsigned long long)ImageSlots_Hash(payload, len));
+    ImageCacheKey key;
+    memset(&key, 0, sizeof(key));
+    key.width = aligned_width;
+    key.height = dev_info.Panel_H;
+    key.bpp = 4;
+    key.sourceSize = len;
+
+    UBYTE *buffer = FrameCache_Get(frameName, &key, hash);
+    if (buffer)
+        return buffer;
+
+    buffer = (UBYTE *)malloc(expected_buffer_size);
+    if (!buffer) {
+        Debug("loadPayloadBuffer: Memory allocation failed.\n");
+        return NULL;
+    }
+    BMP_Canvas canvas = { buffer, aligned_width, dev_info.Panel_H, aligned_width / 2 };
+    memset(buffer, 0xFF, expected_buffer_size);
+
+    if (payload[0] == 'B') {
+        BMP_Result ret = ImageDecode_Memory(payload, len, &canvas, 0, 0);
+        if (ret != BMP_OK) {
+            Debug("loadPayloadBuffer: Failed to decode the BMP payload: %s.\n", BMP_Result_String(ret));
+            free(buffer);
+            return NULL;
+        }
+    } else if (unpackFramePayload(payload, len, &canvas) != 0) {
+        free(buffer);
+        return NULL;
+    }
+    *hash = ImageSlots_Hash(buffer, expected_buffer_size);
+    return FrameCache_Put(frameName, &key, buffer, expected_buffer_size, *hash, 0);
+}
+
+// Generic function to load and display an image with caching.
+// The frame comes from loadImageBuffer(), or from loadPayloadBuffer() when a
+// payload is given; frames preloaded into an image slot are refreshed from the
+// controller memory without an upload.
+// With skipIfShown, a frame the panel already shows is not refreshed again.
+// Returns 0 once the image is shown, -1 if it could not be loaded or a
+// newer frame arrived before the refresh.
+static int loadAndDisplayImage(const char *imagePath, const UBYTE *payload, UDOUBLE payloadLen,
+                               IT8951_Dev_Info dev_info, UDOUBLE mem_addr, int skipIfShown) {
+    struct timespec start, mid, end;
+    double elapsed_load_ms, elapsed_refresh_ms;
+
+    // Record start time (for image loading)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (loading_image) {
+        Debug("loadAndDisplayImage: Another image load is in progress. Skipping this request.\n");
+        return -1;
+    }
+    loading_image = 1;
+
+    UWORD aligned_width;
+    UDOUBLE expected_buffer_size;
+    computeAlignedWidthAndBufferSize(dev_info, &aligned_width, &expected_buffer_size);
+
+    uint64_t hash = 0;
+    UBYTE *buffer = payload ? loadPayloadBuffer(payload, payloadLen, dev_info, &hash)
+                            : loadImageBuffer(imagePath, dev_info, 1, &hash);
+    if (!buffer) {
+        loading_image = 0;
+        return -1;
+    }
+    if (skipIfShown && shadow_frame && shadow_size == expected_buffer_size && shadow_hash == hash) {
+        Debug("loadAndDisplayImage: %s is already shown, no refresh.\n", imagePath);
+        FrameCache_Release(buffer);
+        last_image_display_time = time(NULL);
+        loading_image = 0;
+        return 0;
+    }
+    int slot = ImageSlots_Find(hash);
 
     // Record mid time after image loading/decoding.
     clock_gettime(CLOCK_MONOTONIC, &mid);
     elapsed_load_ms = (mid.tv_sec - start.tv_sec) * 1000.0 +
                       (mid.tv_nsec - start.tv_nsec) / 1000000.0;
     printf("Elapsed time Image Loading: %f ms\n", elapsed_load_ms);
+    FrameCacheStats cache_stats;
+    FrameCache_GetStats(&cache_stats);
+    Debug("Frame cache: %lu hits, %lu misses, %lu evictions, %u frames, %llu of %llu bytes.\n",
+          cache_stats.hits, cache_stats.misses, cache_stats.evictions, cache_stats.frames,
+          (unsigned long long)cache_stats.bytes, (unsigned long long)cache_stats.budget);
 
     // Perform the display refresh.
-    EPD_IT8951_4bp_Refresh(buffer, 0, 0, aligned_width, dev_info.Panel_H, false, mem_addr, true);
+    DEV_Reset_Wait_Stats();
+    if (refreshChangedAreas(buffer, aligned_width, dev_info.Panel_H, expected_buffer_size, mem_addr,
+                            slot >= 0 ? ImageSlots_Addr(slot) : 0) != 0) {
+        // The panel still shows the shadow frame, the newer one is shown next.
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("Display refresh abandoned for a newer image after %f ms\n",
+               (end.tv_sec - mid.tv_sec) * 1000.0 + (end.tv_nsec - mid.tv_nsec) / 1000000.0);
+        FrameCache_Release(buffer);
+        loading_image = 0;
+        return -1;
+    }
 
     // Record end time after refresh.
     clock_gettime(CLOCK_MONOTONIC, &end);
@@ -189,43 +674,101 @@ static void loadAndDisplayImage(const char *imagePath, IT8951_Dev_Info dev_info,
                          (end.tv_nsec - mid.tv_nsec) / 1000000.0;
     printf("Elapsed time Display Refresh: %f ms\n", elapsed_refresh_ms);
 
-    free(buffer);
+    DEV_Wait_Stats wait_stats;
+    DEV_Get_Wait_Stats(&wait_stats);
+    printf("Busy pin wait: %f ms in %llu waits (%llu slept, longest %f ms)\n",
+           wait_stats.Wait_ns / 1000000.0, (unsigned long long)wait_stats.Waits,
+           (unsigned long long)wait_stats.Blocks, wait_stats.Max_Wait_ns / 1000000.0);
+
+    // The frame now in the controller becomes the base for the next diff.
+    FrameCache_Release(shadow_frame);
+    shadow_frame = buffer;
+    shadow_size = expected_buffer_size;
+    shadow_hash = hash;
     last_image_display_time = time(NULL);
     loading_image = 0;
+    return 0;
+}
+
+/* Uploads the frames that are shown most often into image slots */
+void Display_PreloadImages(IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_addr) {
+    UWORD aligned_width;
+    UDOUBLE expected_buffer_size;
+    computeAlignedWidthAndBufferSize(dev_info, &aligned_width, &expected_buffer_size);
+
+    if (ImageSlots_Init(dev_info, init_target_memory_addr, globalConfig.imageSlots) <= 1)
+        return;
+
+    const char *paths[3 + MAX_PRELOAD_IMAGES];
+    int count = 0;
+    paths[count++] = globalConfig.defaultImagePath;
+    paths[count++] = globalConfig.disconnectedImagePath;
+    paths[count++] = globalConfig.noImageAvailablePath;
+    for (int i = 0; i < globalConfig.preloadImageCount; i++)
+        paths[count++] = globalConfig.preloadImages[i];
+
+    for (int i = 0; i < count; i++) {
+        if (strlen(paths[i]) == 0)
+            continue;
+        uint64_t hash = 0;
+        UBYTE *buffer = loadImageBuffer(paths[i], dev_info, 0, &hash);
+        if (!buffer)
+            continue;
+        if (ImageSlots_Find(hash) < 0 &&
+            ImageSlots_Store(paths[i], buffer, aligned_width, dev_info.Panel_H, hash) < 0) {
+            Debug("Display_PreloadImages: No free image slot for %s.\n", paths[i]);
+        }
+        FrameCache_Release(buffer);
+    }
+}
+
+/* Starts decoding ./pic/bmp into ./pic/raw in the background, for frames of this panel */
+void Display_StartCacheWarmer(IT8951_Dev_Info dev_info) {
+    UWORD aligned_width;
+    UDOUBLE expected_buffer_size;
+    computeAlignedWidthAndBufferSize(dev_info, &aligned_width, &expected_buffer_size);
+    CacheWarmer_Start(aligned_width, dev_info.Panel_H);
 }
 
 /* Clears the display by loading a blank image */
 void Display_Clear(IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_addr) {
-    loadAndDisplayImage("", dev_info, init_target_memory_addr);
+    loadAndDisplayImage("", NULL, 0, dev_info, init_target_memory_addr, 0);
 }
 
-/* Displays a special image (such as default or disconnected) */
+/* Displays a special image (such as default or disconnected), unless the panel already shows it */
 void Display_ShowSpecialImage(const char *imagePath, IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_addr) {
-    loadAndDisplayImage(imagePath, dev_info, init_target_memory_addr);
-    current_image_type = IMAGE_DEFAULT;
+    if (loadAndDisplayImage(imagePath, NULL, 0, dev_info, init_target_memory_addr, 1) == 0)
+        current_image_type = IMAGE_DEFAULT;
 }
 
-/* Process an incoming MQTT message */
-void Process_MQTT_Message(const char *message) {
+/* Reads the "Filename" of a JSON message, 0 on success */
+static int messageFilename(const char *message, char *filename, size_t size) {
     if (!message || strlen(message) == 0) {
-        Debug("Process_MQTT_Message: Received empty message.\n");
-        return;
+        Debug("messageFilename: Received empty message.\n");
+        return -1;
     }
     cJSON *json = cJSON_Parse(message);
     if (!json) {
-        Debug("Process_MQTT_Message: Error parsing JSON.\n");
-        return;
+        Debug("messageFilename: Error parsing JSON.\n");
+        return -1;
     }
     cJSON *filename_item = cJSON_GetObjectItemCaseSensitive(json, "Filename");
     if (!cJSON_IsString(filename_item) || !filename_item->valuestring) {
-        Debug("Process_MQTT_Message: Invalid or missing 'Filename' in JSON.\n");
+        Debug("messageFilename: Invalid or missing 'Filename' in JSON.\n");
         cJSON_Delete(json);
-        return;
+        return -1;
     }
-    char filename[128];
-    strncpy(filename, filename_item->valuestring, sizeof(filename));
-    filename[sizeof(filename)-1] = '\0';
+    strncpy(filename, filename_item->valuestring, size);
+    filename[size-1] = '\0';
     cJSON_Delete(json);
+    return 0;
+}
+
+/* Process an incoming MQTT message */
+void Process_MQTT_Message(const char *message) {
+    char filename[128];
+    if (messageFilename(message, filename, sizeof(filename)) != 0)
+        return;
     
     // If the requested file is the default image and it's already loaded, do nothing.
     // (Use strcasecmp for case-insensitive comparison if needed)
@@ -238,7 +781,8 @@ void Process_MQTT_Message(const char *message) {
     snprintf(filepath, sizeof(filepath), "./pic/%s", filename);
     Debug("Process_MQTT_Message: Displaying BMP file: %s\n", filepath);
 
-    loadAndDisplayImage(filepath, global_dev_info, Init_Target_Memory_Addr);
+    if (loadAndDisplayImage(filepath, NULL, 0, global_dev_info, Init_Target_Memory_Addr, 0) != 0)
+        return;
     
     // Update the image type flag based on the filename.
     if (strcmp(filename, getDefaultImageFilename()) == 0) {
@@ -248,6 +792,62 @@ void Process_MQTT_Message(const char *message) {
     }
 }
 
+/* Tells an image payload apart from a JSON message */
+int Display_IsImagePayload(const UBYTE *payload, UDOUBLE len) {
+    if (len >= 2 && payload[0] == 'B' && payload[1] == 'M')
+        return 1;
+    return len >= sizeof(FramePayloadHeader) && memcmp(payload, FRAME_PAYLOAD_MAGIC, 4) == 0;
+}
+
+/* Checks a payload on the MQTT client's thread, before it replaces the frame being shown.
+   A BMP payload is only decoded when shown, so only its signature is checked here, and
+   a frame in the cache directory only by its size, as loadLegacyFrame() does. */
+int Display_CheckPayload(const UBYTE *payload, UDOUBLE len) {
+    if (Display_IsImagePayload(payload, len)) {
+        if (payload[0] == 'B')
+            return 0;
+        UWORD aligned_width;
+        UDOUBLE expected_buffer_size;
+        computeAlignedWidthAndBufferSize(global_dev_info, &aligned_width, &expected_buffer_size);
+        return checkFramePayload(payload, len, aligned_width, global_dev_info.Panel_H);
+    }
+
+    char filename[128];
+    if (messageFilename((const char *)payload, filename, sizeof(filename)) != 0)
+        return -1;
+    // loadImageBuffer() reads the file from ./pic/bmp/ under its base name, or
+    // without it a headerless frame from the cache directory.
+    const char *base = strrchr(filename, '/');
+    char bmpPath[256];
+    snprintf(bmpPath, sizeof(bmpPath), "./pic/bmp/%s", base ? base + 1 : filename);
+    if (access(bmpPath, R_OK) == 0)
+        return 0;
+
+    UWORD aligned_width;
+    UDOUBLE expected_buffer_size;
+    computeAlignedWidthAndBufferSize(global_dev_info, &aligned_width, &expected_buffer_size);
+    char cachePath[256];
+    makeImageCachePath(bmpPath, cachePath, sizeof(cachePath));
+    struct stat st;
+    if (stat(cachePath, &st) == 0 && st.st_size == (off_t)expected_buffer_size)
+        return 0;
+    Debug("Display_CheckPayload: Neither %s nor a frame in %s exists.\n", bmpPath, cachePath);
+    return -1;
+}
+
+/* Process an incoming MQTT payload: an image, or a JSON message naming one */
+void Process_MQTT_Payload(const UBYTE *payload, UDOUBLE len) {
+    if (!Display_IsImagePayload(payload, len)) {
+        Process_MQTT_Message((const char *)payload);
+        return;
+    }
+    Debug("Process_MQTT_Payload: Displaying a %u byte %s payload.\n", len,
+          payload[0] == 'B' ? "BMP" : FRAME_PAYLOAD_MAGIC);
+    if (loadAndDisplayImage("MQTT payload", payload, len, global_dev_info, Init_Target_Memory_Addr, 0) != 0)
+        return;
+    current_image_type = IMAGE_CUSTOM;
+}
+
 /* Factory test routine (unchanged for now) */
 void Display_FactoryTest(IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_addr) {
     Debug("Display_FactoryTest: Starting factory test...\n");
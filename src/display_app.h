@@ -9,6 +9,22 @@ extern "C" {
 #include "../lib/e-Paper/EPD_IT8951.h"  // Contains IT8951_Dev_Info and UDOUBLE.
 #include "../lib/Config/DEV_Config.h"   // Hardware initialization routines.
 #include <time.h>                       // For time_t
+#include <stdint.h>
+
+/**
+ * @brief Header of a packed frame sent as an MQTT payload.
+ *
+ * It is followed by height rows of (width + 1) / 2 bytes at 4bpp, the even
+ * pixel in the low nibble as in the controller's image buffer. The frame is
+ * placed in the top left corner, the rest of the panel is white.
+ */
+#define FRAME_PAYLOAD_MAGIC "EPD4"
+
+typedef struct {
+    char magic[4];      /**< FRAME_PAYLOAD_MAGIC, not null-terminated. */
+    uint16_t width;     /**< Pixels per row, at most the aligned panel width. Little-endian. */
+    uint16_t height;    /**< Rows, at most the panel height. Little-endian. */
+} __attribute__((packed)) FramePayloadHeader;
 
 /**
  * @brief Enumerates the type of image currently displayed.
@@ -32,6 +48,27 @@ extern time_t last_image_display_time;
  */
 void Display_Clear(IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_addr);
 
+/**
+ * @brief Uploads the default, disconnected and "no image" pictures and the
+ *        PRELOAD_IMAGES list into image slots of the controller memory.
+ *
+ * Showing one of them later only needs a refresh from its slot, no upload.
+ *
+ * @param dev_info The device information containing panel dimensions.
+ * @param init_target_memory_addr The image buffer address reported by the controller.
+ */
+void Display_PreloadImages(IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_addr);
+
+/**
+ * @brief Starts the cache warmer for frames of this panel, see CacheWarmer_Start().
+ *
+ * BMPs copied into ./pic/bmp are decoded into ./pic/raw in the background, so
+ * they are not decoded when they are first shown.
+ *
+ * @param dev_info The device information containing panel dimensions.
+ */
+void Display_StartCacheWarmer(IT8951_Dev_Info dev_info);
+
 /**
  * @brief Processes an incoming MQTT message to display an image.
  *
@@ -42,6 +79,40 @@ void Display_Clear(IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_addr);
  */
 void Process_MQTT_Message(const char *message);
 
+/**
+ * @brief Checks whether an MQTT payload carries an image rather than a JSON message.
+ *
+ * @param payload The payload.
+ * @param len Its size in bytes.
+ * @return 1 for a BMP file ("BM") or a packed frame (FRAME_PAYLOAD_MAGIC), else 0.
+ */
+int Display_IsImagePayload(const UBYTE *payload, UDOUBLE len);
+
+/**
+ * @brief Checks whether an MQTT payload names or carries an image that can be shown.
+ *
+ * Catches malformed JSON, a message without "Filename", a picture with neither
+ * a BMP in ./pic/bmp/ nor a headerless frame in ./pic/raw/, and a packed frame
+ * that does not fit the panel. Cheap enough for
+ * the MQTT client's thread: nothing is decoded and the display is not touched.
+ *
+ * @param payload The payload, followed by a null terminator.
+ * @param len Its size in bytes, without the terminator.
+ * @return 0 if the payload may be shown, -1 if not.
+ */
+int Display_CheckPayload(const UBYTE *payload, UDOUBLE len);
+
+/**
+ * @brief Processes an incoming MQTT payload.
+ *
+ * An image payload is decoded straight from the message and shown as a custom
+ * image, nothing is written to disk. Anything else goes to Process_MQTT_Message().
+ *
+ * @param payload The payload, followed by a null terminator.
+ * @param len Its size in bytes, without the terminator.
+ */
+void Process_MQTT_Payload(const UBYTE *payload, UDOUBLE len);
+
 /**
  * @brief Runs a factory test routine for the display.
  *
@@ -56,6 +127,7 @@ void Display_FactoryTest(IT8951_Dev_Info dev_info, UDOUBLE init_target_memory_ad
  * @brief Displays a special image (e.g., default or disconnected).
  *
  * This function loads an image from the specified path and updates the display.
+ * If the panel already shows that frame, nothing is refreshed.
  * It also resets the current image type to IMAGE_DEFAULT.
  *
  * @param imagePath The file path of the image.
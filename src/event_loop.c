@@ -0,0 +1,68 @@
+//event_loop.c
+#include "event_loop.h"
+#include "../lib/Config/Debug.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static int wakeFd = -1;
+static int timerFd = -1;
+
+int EventLoop_Init(void) {
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    // The timer follows the wall clock, like the time(NULL) stamps it is set from.
+    timerFd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (wakeFd < 0 || timerFd < 0) {
+        Debug("EventLoop_Init: Failed to create the event descriptors.\n");
+        EventLoop_Exit();
+        return -1;
+    }
+    return 0;
+}
+
+void EventLoop_Wake(void) {
+    uint64_t one = 1;
+    if (wakeFd >= 0) {
+        // Only fails when the counter is full, and then the loop wakes anyway.
+        ssize_t ret = write(wakeFd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+void EventLoop_SetTimer(time_t when) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = when;
+    if (timerFd >= 0 && timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+        Debug("EventLoop_SetTimer: timerfd_settime() failed.\n");
+}
+
+int EventLoop_Wait(void) {
+    struct pollfd fds[2] = { { wakeFd, POLLIN, 0 }, { timerFd, POLLIN, 0 } };
+    if (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR)
+            Debug("EventLoop_Wait: poll() failed.\n");
+        return 0;
+    }
+
+    int events = 0;
+    uint64_t count;
+    if ((fds[0].revents & POLLIN) && read(wakeFd, &count, sizeof(count)) == sizeof(count))
+        events |= EVENT_LOOP_WAKE;
+    if ((fds[1].revents & POLLIN) && read(timerFd, &count, sizeof(count)) == sizeof(count))
+        events |= EVENT_LOOP_TIMER;
+    return events;
+}
+
+void EventLoop_Exit(void) {
+    if (wakeFd >= 0)
+        close(wakeFd);
+    if (timerFd >= 0)
+        close(timerFd);
+    wakeFd = timerFd = -1;
+}
@@ -0,0 +1,41 @@
+//event_loop.h
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <time.h>
+
+#define EVENT_LOOP_WAKE   0x1   // EventLoop_Wake() was called.
+#define EVENT_LOOP_TIMER  0x2   // The time set with EventLoop_SetTimer() has come.
+
+/**
+ * @brief Creates the eventfd and timerfd the main loop sleeps on.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int EventLoop_Init(void);
+
+/**
+ * @brief Wakes EventLoop_Wait(). Safe to call from any thread and from signal handlers.
+ */
+void EventLoop_Wake(void);
+
+/**
+ * @brief Sets the wall clock time the next EventLoop_Wait() returns at, at the latest.
+ *
+ * @param when Absolute time as from time(NULL); 0 clears the timer.
+ */
+void EventLoop_SetTimer(time_t when);
+
+/**
+ * @brief Sleeps until EventLoop_Wake() is called or the timer expires.
+ *
+ * @return EVENT_LOOP_WAKE and/or EVENT_LOOP_TIMER, 0 if interrupted by a signal.
+ */
+int EventLoop_Wait(void);
+
+/**
+ * @brief Closes the descriptors.
+ */
+void EventLoop_Exit(void);
+
+#endif // EVENT_LOOP_H
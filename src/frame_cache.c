@@ -0,0 +1,212 @@
+//frame_cache.c
+#include "frame_cache.h"
+#include "../lib/Config/Debug.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct FrameCacheEntry {
+    struct FrameCacheEntry *prev;   // Toward the most recently used.
+    struct FrameCacheEntry *next;
+    char name[256];
+    ImageCacheKey key;
+    UBYTE *frame;
+    UDOUBLE size;
+    uint64_t hash;
+    int refs;
+    int pinned;
+    int mapped;                     // From mapPreDecodedImage(), unmapped instead of freed.
+    int stale;                      // Replaced or unnamed, freed with its last reference.
+} FrameCacheEntry;
+
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static FrameCacheEntry *head = NULL;    // Most recently used.
+static FrameCacheEntry *tail = NULL;
+static FrameCacheStats stats;
+
+static void unlinkEntry(FrameCacheEntry *entry) {
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void pushFront(FrameCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = head;
+    if (head)
+        head->prev = entry;
+    head = entry;
+    if (!tail)
+        tail = entry;
+}
+
+static void freeEntry(FrameCacheEntry *entry) {
+    unlinkEntry(entry);
+    stats.frames--;
+    stats.bytes -= entry->size;
+    if (entry->mapped)
+        unmapPreDecodedImage(entry->frame, entry->size);
+    else
+        free(entry->frame);
+    free(entry);
+}
+
+static int sameKey(const ImageCacheKey *a, const ImageCacheKey *b) {
+    return a->width == b->width && a->height == b->height && a->bpp == b->bpp &&
+           a->rotate == b->rotate && a->mirror == b->mirror &&
+           a->sourceSize == b->sourceSize && a->sourceMtimeNs == b->sourceMtimeNs;
+}
+
+// Drops unused frames from the least recently used end until the budget is met.
+static void trim(void) {
+    FrameCacheEntry *entry = tail;
+    while (entry && stats.bytes > stats.budget) {
+        FrameCacheEntry *prev = entry->prev;
+        if (entry->refs == 0 && !entry->pinned) {
+            Debug("FrameCache: Evicting %s.\n", entry->name);
+            freeEntry(entry);
+            stats.evictions++;
+        }
+        entry = prev;
+    }
+}
+
+void FrameCache_Init(uint64_t budget) {
+    pthread_mutex_lock(&cacheLock);
+    stats.hits = stats.misses = stats.evictions = 0;
+    stats.budget = budget;
+    trim();
+    pthread_mutex_unlock(&cacheLock);
+    Debug("FrameCache_Init: Budget of %llu bytes.\n", (unsigned long long)budget);
+}
+
+UBYTE *FrameCache_Get(const char *name, const ImageCacheKey *key, uint64_t *hash) {
+    UBYTE *frame = NULL;
+    pthread_mutex_lock(&cacheLock);
+    for (FrameCacheEntry *entry = head; entry; entry = entry->next) {
+        if (!entry->stale && strcmp(entry->name, name) == 0) {
+            if (sameKey(&entry->key, key)) {
+                entry->refs++;
+                unlinkEntry(entry);
+                pushFront(entry);
+                *hash = entry->hash;
+                frame = entry->frame;
+            } else {
+                // Decoded from an older version of the file.
+                entry->stale = 1;
+                if (entry->refs == 0)
+                    freeEntry(entry);
+            }
+            break;
+        }
+    }
+    if (frame)
+        stats.hits++;
+    else
+        stats.misses++;
+    pthread_mutex_unlock(&cacheLock);
+    return frame;
+}
+
+static UBYTE *putFrame(const char *name, const ImageCacheKey *key, UBYTE *frame, UDOUBLE size,
+                       uint64_t hash, int pinned, int mapped) {
+    FrameCacheEntry *entry = calloc(1, sizeof(FrameCacheEntry));
+    if (!entry) {
+        // Not tracked: the frame would leak, so keep it out of the display path.
+        if (mapped)
+            unmapPreDecodedImage(frame, size);
+        else
+            free(frame);
+        return NULL;
+    }
+    if (name)
+        strncpy(entry->name, name, sizeof(entry->name) - 1);
+    entry->key = *key;
+    entry->frame = frame;
+    entry->size = size;
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->pinned = pinned;
+    entry->mapped = mapped;
+    entry->stale = (name == NULL);
+
+    pthread_mutex_lock(&cacheLock);
+    for (FrameCacheEntry *old = head; name && old; old = old->next) {
+        if (!old->stale && strcmp(old->name, name) == 0) {
+            old->stale = 1;
+            if (old->refs == 0)
+                freeEntry(old);
+            break;
+        }
+    }
+    pushFront(entry);
+    stats.frames++;
+    stats.bytes += size;
+    trim();
+    pthread_mutex_unlock(&cacheLock);
+    return frame;
+}
+
+UBYTE *FrameCache_Put(const char *name, const ImageCacheKey *key, UBYTE *frame, UDOUBLE size,
+                      uint64_t hash, int pinned) {
+    return putFrame(name, key, frame, size, hash, pinned, 0);
+}
+
+UBYTE *FrameCache_PutMapped(const char *name, const ImageCacheKey *key, UBYTE *frame, UDOUBLE size,
+                            uint64_t hash, int pinned) {
+    return putFrame(name, key, frame, size, hash, pinned, 1);
+}
+
+UBYTE *FrameCache_Retain(UBYTE *frame) {
+    pthread_mutex_lock(&cacheLock);
+    FrameCacheEntry *entry = head;
+    while (entry && entry->frame != frame)
+        entry = entry->next;
+    if (entry)
+        entry->refs++;
+    pthread_mutex_unlock(&cacheLock);
+    return entry ? frame : NULL;
+}
+
+void FrameCache_Release(UBYTE *frame) {
+    if (!frame)
+        return;
+    pthread_mutex_lock(&cacheLock);
+    FrameCacheEntry *entry = head;
+    while (entry && entry->frame != frame)
+        entry = entry->next;
+    if (!entry) {
+        Debug("FrameCache_Release: Unknown frame %p.\n", (void *)frame);
+    } else if (--entry->refs == 0) {
+        if (entry->stale)
+            freeEntry(entry);
+        else
+            trim();
+    }
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void FrameCache_GetStats(FrameCacheStats *out) {
+    pthread_mutex_lock(&cacheLock);
+    *out = stats;
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void FrameCache_Exit(void) {
+    pthread_mutex_lock(&cacheLock);
+    FrameCacheEntry *entry = head;
+    while (entry) {
+        FrameCacheEntry *next = entry->next;
+        if (entry->refs == 0)
+            freeEntry(entry);
+        entry = next;
+    }
+    pthread_mutex_unlock(&cacheLock);
+}
@@ -0,0 +1,79 @@
+//frame_cache.h
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include "../lib/Config/DEV_Config.h"
+#include "image_cache.h"
+#include <stdint.h>
+
+/**
+ * @brief Counters since FrameCache_Init().
+ */
+typedef struct {
+    unsigned long hits;         /**< FrameCache_Get() calls that found the frame. */
+    unsigned long misses;       /**< FrameCache_Get() calls that did not. */
+    unsigned long evictions;    /**< Frames dropped to stay within the budget. */
+    unsigned int frames;        /**< Frames held, in use or not. */
+    uint64_t bytes;             /**< Their size. */
+    uint64_t budget;            /**< Size the unused, unpinned frames are trimmed to. */
+} FrameCacheStats;
+
+/**
+ * @brief Sets the memory budget of decoded frames kept for reuse, in bytes.
+ *
+ * Pinned frames and frames in use count against the budget but are never evicted.
+ * A budget of 0 keeps only those.
+ */
+void FrameCache_Init(uint64_t budget);
+
+/**
+ * @brief Looks up the frame decoded from name with this key and takes a reference.
+ *
+ * The frame is shared, it must not be written to. Give it back with FrameCache_Release().
+ *
+ * @param hash Receives ImageSlots_Hash() of the frame.
+ * @return The frame, or NULL if it is not cached.
+ */
+UBYTE *FrameCache_Get(const char *name, const ImageCacheKey *key, uint64_t *hash);
+
+/**
+ * @brief Hands a malloc()ed frame over to the cache and takes a reference to it.
+ *
+ * A frame put under the name of an older one replaces it. With a NULL name the
+ * frame is only tracked until its last FrameCache_Release().
+ *
+ * @param pinned Never evict the frame, e.g. for the default and disconnected images.
+ * @return frame.
+ */
+UBYTE *FrameCache_Put(const char *name, const ImageCacheKey *key, UBYTE *frame, UDOUBLE size,
+                      uint64_t hash, int pinned);
+
+/**
+ * @brief Like FrameCache_Put(), for a frame from mapPreDecodedImage().
+ *
+ * The mapping stays valid while any reference is held, e.g. during an upload
+ * straight from it, and is unmapped when the frame is evicted.
+ */
+UBYTE *FrameCache_PutMapped(const char *name, const ImageCacheKey *key, UBYTE *frame, UDOUBLE size,
+                            uint64_t hash, int pinned);
+
+/**
+ * @brief Takes another reference to a frame the caller holds one to.
+ *
+ * @return frame, or NULL if it is not in the cache.
+ */
+UBYTE *FrameCache_Retain(UBYTE *frame);
+
+/**
+ * @brief Drops a reference taken by FrameCache_Get(), FrameCache_Put() or FrameCache_Retain(). NULL is ignored.
+ */
+void FrameCache_Release(UBYTE *frame);
+
+void FrameCache_GetStats(FrameCacheStats *stats);
+
+/**
+ * @brief Frees every frame that is not in use.
+ */
+void FrameCache_Exit(void);
+
+#endif // FRAME_CACHE_H
@@ -0,0 +1,96 @@
+//frame_diff.c
+#include "frame_diff.h"
+#include <string.h>
+
+int FrameDiff_Find(const UBYTE *prev, const UBYTE *next, UWORD width, UWORD height,
+                   FrameRect *rects, int maxRects) {
+    UDOUBLE stride = width / 2;
+    int count = 0;
+    // Changed columns of the current band, in bytes, and its last changed row.
+    UDOUBLE first = 0, last = 0;
+    UWORD bandEnd = 0;
+
+    if (maxRects < 1)
+        return 0;
+
+    for (UWORD y = 0; y < height; y++) {
+        const UBYTE *a = prev + (UDOUBLE)y * stride;
+        const UBYTE *b = next + (UDOUBLE)y * stride;
+        if (memcmp(a, b, stride) == 0)
+            continue;
+
+        UDOUBLE lo = 0, hi = stride - 1;
+        while (a[lo] == b[lo])
+            lo++;
+        while (a[hi] == b[hi])
+            hi--;
+
+        if (count > 0 && (y - bandEnd <= FRAME_DIFF_ROW_GAP || count == maxRects)) {
+            if (lo < first)
+                first = lo;
+            if (hi > last)
+                last = hi;
+        } else {
+            rects[count].y = y;
+            first = lo;
+            last = hi;
+            count++;
+        }
+        bandEnd = y;
+
+        // One byte holds two pixels, widen to whole words.
+        FrameRect *r = &rects[count - 1];
+        UDOUBLE x0 = first * 2;
+        UDOUBLE x1 = last * 2 + 2;
+        x0 -= x0 % FRAME_DIFF_ALIGN;
+        x1 += (FRAME_DIFF_ALIGN - x1 % FRAME_DIFF_ALIGN) % FRAME_DIFF_ALIGN;
+        if (x1 > width)
+            x1 = width;
+        r->x = x0;
+        r->w = x1 - x0;
+        r->h = y - r->y + 1;
+    }
+    return count;
+}
+
+// Both nibbles are 0x0 (black) or 0xF (white).
+static inline int isBlackWhite(UBYTE b) {
+    UBYTE lo = b & 0x0F, hi = b & 0xF0;
+    return (lo == 0 || lo == 0x0F) && (hi == 0 || hi == 0xF0);
+}
+
+int FrameDiff_Levels(const UBYTE *prev, const UBYTE *next, UWORD width, const FrameRect *rect) {
+    UDOUBLE stride = width / 2;
+    UDOUBLE rowBytes = rect->w / 2;
+    int levels = FRAME_LEVELS_BW_NEW | FRAME_LEVELS_BW_OLD;
+
+    for (UWORD y = 0; y < rect->h && levels; y++) {
+        UDOUBLE offset = (UDOUBLE)(rect->y + y) * stride + rect->x / 2;
+        for (UDOUBLE i = 0; i < rowBytes; i++) {
+            if (!isBlackWhite(next[offset + i]))
+                levels &= ~FRAME_LEVELS_BW_NEW;
+            if (!isBlackWhite(prev[offset + i]))
+                levels &= ~FRAME_LEVELS_BW_OLD;
+        }
+    }
+    return levels;
+}
+
+UDOUBLE FrameDiff_Area(const FrameRect *rects, int count) {
+    UDOUBLE area = 0;
+    for (int i = 0; i < count; i++)
+        area += (UDOUBLE)rects[i].w * rects[i].h;
+    return area;
+}
+
+void FrameDiff_Extract(const UBYTE *frame, UWORD width, const FrameRect *rect, UBYTE *out) {
+    UDOUBLE stride = width / 2;
+    UDOUBLE rowBytes = rect->w / 2;
+    const UBYTE *src = frame + (UDOUBLE)rect->y * stride + rect->x / 2;
+
+    for (UWORD y = 0; y < rect->h; y++) {
+        memcpy(out, src, rowBytes);
+        out += rowBytes;
+        src += stride;
+    }
+}
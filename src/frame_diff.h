@@ -0,0 +1,53 @@
+//frame_diff.h
+#ifndef FRAME_DIFF_H
+#define FRAME_DIFF_H
+
+#include "../lib/Config/DEV_Config.h"
+
+#define FRAME_DIFF_MAX_RECTS 16  // Areas refreshed at once; more changes are merged.
+#define FRAME_DIFF_ALIGN     4   // LD_IMG_AREA takes whole 16-bit words, four 4bpp pixels.
+#define FRAME_DIFF_ROW_GAP   16  // Unchanged rows that still join two changed bands.
+
+/**
+ * @brief A changed area of the panel, in pixels.
+ */
+typedef struct {
+    UWORD x;
+    UWORD y;
+    UWORD w;
+    UWORD h;
+} FrameRect;
+
+/**
+ * @brief Finds the areas in which two 4bpp frames of width x height differ.
+ *
+ * Changed rows are grouped into bands, each band gives one rectangle spanning the
+ * changed columns of its rows. X and W are aligned to FRAME_DIFF_ALIGN pixels.
+ * If there are more bands than maxRects, the last rectangle takes in the rest.
+ *
+ * @return Number of rectangles, 0 if the frames are equal.
+ */
+int FrameDiff_Find(const UBYTE *prev, const UBYTE *next, UWORD width, UWORD height,
+                   FrameRect *rects, int maxRects);
+
+#define FRAME_LEVELS_BW_NEW 0x01  // Every pixel of the new frame in the area is black or white.
+#define FRAME_LEVELS_BW_OLD 0x02  // The same for the frame it replaces.
+
+/**
+ * @brief Tells which gray levels occur in one rectangle of both frames.
+ *
+ * @return FRAME_LEVELS_* flags.
+ */
+int FrameDiff_Levels(const UBYTE *prev, const UBYTE *next, UWORD width, const FrameRect *rect);
+
+/**
+ * @brief Sum of the rectangle areas in pixels.
+ */
+UDOUBLE FrameDiff_Area(const FrameRect *rects, int count);
+
+/**
+ * @brief Copies one rectangle of a 4bpp frame into a packed buffer of rect->w / 2 * rect->h bytes.
+ */
+void FrameDiff_Extract(const UBYTE *frame, UWORD width, const FrameRect *rect, UBYTE *out);
+
+#endif // FRAME_DIFF_H
@@ -0,0 +1,124 @@
+//frame_pack.c
+#include "frame_pack.h"
+#include <stdint.h>
+#include <string.h>
+
+void FramePack_Histogram(const UBYTE *frame, UWORD width, const FrameRect *rect, UDOUBLE hist[16]) {
+    UDOUBLE stride = width / 2;
+    UDOUBLE rowBytes = rect->w / 2;
+    UDOUBLE bytes[256] = {0};
+
+    // Count whole bytes, two pixels each, and split them afterwards.
+    for (UWORD y = 0; y < rect->h; y++) {
+        const UBYTE *row = frame + (UDOUBLE)(rect->y + y) * stride + rect->x / 2;
+        for (UDOUBLE i = 0; i < rowBytes; i++)
+            bytes[row[i]]++;
+    }
+
+    memset(hist, 0, 16 * sizeof(hist[0]));
+    for (int b = 0; b < 256; b++) {
+        hist[b & 0x0F] += bytes[b];
+        hist[b >> 4] += bytes[b];
+    }
+}
+
+void FramePack_Choose(const UDOUBLE hist[16], const FrameRect *rect, FramePackFormat *format) {
+    int levels = 0, quarterLevels = 1;
+    UBYTE first = 0x0F, second = 0x0F;
+
+    for (int level = 0; level < 16; level++) {
+        if (!hist[level])
+            continue;
+        if (levels == 0)
+            first = level;
+        else if (levels == 1)
+            second = level;
+        levels++;
+        if (level & 0x3)
+            quarterLevels = 0;
+    }
+
+    if (levels < 2)
+        second = first;
+    format->bpp = 4;
+    format->back = first;
+    format->front = second;
+
+    if (levels <= 2 && rect->x % FRAME_PACK_ALIGN_1BPP == 0 && rect->w % FRAME_PACK_ALIGN_1BPP == 0) {
+        // The bit that tells the two levels apart becomes the pixel bit.
+        UBYTE bit = (UBYTE)((first ^ second) & -(first ^ second));
+        if (bit && (first & bit)) {
+            format->back = second;
+            format->front = first;
+        }
+        format->bpp = 1;
+    } else if (quarterLevels && rect->x % FRAME_PACK_ALIGN_2BPP == 0 && rect->w % FRAME_PACK_ALIGN_2BPP == 0) {
+        format->bpp = 2;
+    }
+}
+
+UDOUBLE FramePack_Size(const FrameRect *rect, UBYTE bpp) {
+    return (UDOUBLE)rect->w * bpp / 8 * rect->h;
+}
+
+// Bit `shift` of the 16 nibbles in w, pixel i in bit i.
+static inline uint16_t packBits(uint64_t w, int shift) {
+    w = (w >> shift) & 0x1111111111111111ULL;
+    w = (w | w >> 3) & 0x0303030303030303ULL;
+    w = (w | w >> 6) & 0x000F000F000F000FULL;
+    w = (w | w >> 12) & 0x000000FF000000FFULL;
+    return (uint16_t)(w | w >> 24);
+}
+
+// Top two bits of the 16 nibbles in w, pixel i in bits 2i and 2i+1.
+static inline uint32_t packPairs(uint64_t w) {
+    w = (w >> 2) & 0x3333333333333333ULL;
+    w = (w | w >> 2) & 0x0F0F0F0F0F0F0F0FULL;
+    w = (w | w >> 4) & 0x00FF00FF00FF00FFULL;
+    w = (w | w >> 8) & 0x0000FFFF0000FFFFULL;
+    return (uint32_t)(w | w >> 16);
+}
+
+void FramePack_Pack(const UBYTE *frame, UWORD width, const FrameRect *rect,
+                    const FramePackFormat *format, UBYTE *out) {
+    UDOUBLE stride = width / 2;
+    UDOUBLE rowBytes = rect->w / 2;
+    const UBYTE *src = frame + (UDOUBLE)rect->y * stride + rect->x / 2;
+
+    if (format->bpp == 4) {
+        FrameDiff_Extract(frame, width, rect, out);
+        return;
+    }
+
+    // With a single level every bit is 0 and shows the back level.
+    UBYTE diff = format->back ^ format->front;
+    int shift = 0;
+    while (diff && !(diff & (1 << shift)))
+        shift++;
+
+    for (UWORD y = 0; y < rect->h; y++, src += stride) {
+        UDOUBLE i = 0;
+        uint64_t w;
+        if (format->bpp == 1) {
+            for (; i < rowBytes; i += 8, out += 2) {
+                memcpy(&w, src + i, 8);
+                uint16_t bits = diff ? packBits(w, shift) : 0;
+                memcpy(out, &bits, 2);
+            }
+        } else {
+            for (; i + 8 <= rowBytes; i += 8, out += 4) {
+                memcpy(&w, src + i, 8);
+                uint32_t pairs = packPairs(w);
+                memcpy(out, &pairs, 4);
+            }
+            if (i < rowBytes) {
+                // 8 pixels left, the alignment guarantees no less.
+                uint32_t half;
+                memcpy(&half, src + i, 4);
+                uint16_t pairs = (uint16_t)packPairs(half);
+                memcpy(out, &pairs, 2);
+                out += 2;
+            }
+        }
+    }
+}
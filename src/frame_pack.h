@@ -0,0 +1,52 @@
+//frame_pack.h
+#ifndef FRAME_PACK_H
+#define FRAME_PACK_H
+
+#include "../lib/Config/DEV_Config.h"
+#include "frame_diff.h"
+
+#define FRAME_PACK_ALIGN_1BPP 16  // 1bpp goes as 8bpp bytes, whole words are 16 pixels.
+#define FRAME_PACK_ALIGN_2BPP 8   // A 2bpp word holds 8 pixels.
+
+/**
+ * @brief Pixel format an area of a 4bpp frame is uploaded in.
+ *
+ * The controller expands 2bpp and 4bpp pixels into its 8-bit image memory, so
+ * those areas refresh like any other. 1bpp bits are stored packed, eight pixels
+ * to the byte at X/8, and only read back correctly in the 1bpp display mode with
+ * back and front loaded into BGVR: such areas must be refreshed through the
+ * EPD_IT8951_1bp_* functions.
+ */
+typedef struct {
+    UBYTE bpp;    /**< 1, 2 or 4. */
+    UBYTE back;   /**< 1bpp: gray level (0x0-0xF) of the 0 bits. */
+    UBYTE front;  /**< 1bpp: gray level of the 1 bits. */
+} FramePackFormat;
+
+/**
+ * @brief Counts the pixels of each gray level (0x0-0xF) in one rectangle of a 4bpp frame.
+ */
+void FramePack_Histogram(const UBYTE *frame, UWORD width, const FrameRect *rect, UDOUBLE hist[16]);
+
+/**
+ * @brief Picks the narrowest format that keeps every gray level of the histogram:
+ *        1bpp for up to two levels (shown through the BGVR color table), 2bpp when
+ *        all levels are multiples of 4 (the controller keeps 2bpp pixels as v<<6),
+ *        4bpp otherwise or when the rectangle is not aligned for the narrow format.
+ */
+void FramePack_Choose(const UDOUBLE hist[16], const FrameRect *rect, FramePackFormat *format);
+
+/**
+ * @brief Bytes of one rectangle packed at bpp.
+ */
+UDOUBLE FramePack_Size(const FrameRect *rect, UBYTE bpp);
+
+/**
+ * @brief Packs one rectangle of a 4bpp frame into out, FramePack_Size() bytes.
+ *
+ * Rows are packed 16 pixels at a time in 64-bit words, on a little-endian host.
+ */
+void FramePack_Pack(const UBYTE *frame, UWORD width, const FrameRect *rect,
+                    const FramePackFormat *format, UBYTE *out);
+
+#endif // FRAME_PACK_H
@@ -0,0 +1,64 @@
+//frame_rle.c
+#include "frame_rle.h"
+
+#include <string.h>
+
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN 130
+#define RLE_MAX_LITERAL 128
+
+UDOUBLE FrameRle_Encode(const UBYTE *src, UDOUBLE size, UBYTE *dst) {
+    UDOUBLE in = 0, out = 0;
+    UDOUBLE literal = 0;    // Start of the pending literal bytes.
+
+    while (in < size) {
+        UDOUBLE run = 1;
+        while (in + run < size && run < RLE_MAX_RUN && src[in + run] == src[in])
+            run++;
+        if (run >= RLE_MIN_RUN) {
+            while (literal < in) {
+                UDOUBLE n = in - literal > RLE_MAX_LITERAL ? RLE_MAX_LITERAL : in - literal;
+                dst[out++] = (UBYTE)(n - 1);
+                memcpy(dst + out, src + literal, n);
+                out += n;
+                literal += n;
+            }
+            dst[out++] = (UBYTE)(run - RLE_MIN_RUN + 128);
+            dst[out++] = src[in];
+            in += run;
+            literal = in;
+        } else {
+            in += run;
+        }
+    }
+    while (literal < size) {
+        UDOUBLE n = size - literal > RLE_MAX_LITERAL ? RLE_MAX_LITERAL : size - literal;
+        dst[out++] = (UBYTE)(n - 1);
+        memcpy(dst + out, src + literal, n);
+        out += n;
+        literal += n;
+    }
+    return out;
+}
+
+int FrameRle_Decode(const UBYTE *src, UDOUBLE srcSize, UBYTE *dst, UDOUBLE size) {
+    UDOUBLE in = 0, out = 0;
+    while (in < srcSize) {
+        UBYTE c = src[in++];
+        if (c < 128) {
+            UDOUBLE n = (UDOUBLE)c + 1;
+            if (n > srcSize - in || n > size - out)
+                return -1;
+            memcpy(dst + out, src + in, n);
+            in += n;
+            out += n;
+        } else {
+            UDOUBLE n = (UDOUBLE)c - 128 + RLE_MIN_RUN;
+            if (in >= srcSize || n > size - out)
+                return -1;
+            memset(dst + out, src[in++], n);
+            out += n;
+        }
+    }
+    return out == size ? 0 : -1;
+}
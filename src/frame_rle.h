@@ -0,0 +1,32 @@
+//frame_rle.h
+#ifndef FRAME_RLE_H
+#define FRAME_RLE_H
+
+#include "../lib/Config/DEV_Config.h"
+
+/**
+ * @brief Worst case size of FrameRle_Encode() output for size bytes of input.
+ */
+#define FRAME_RLE_MAX_SIZE(size) ((size) + ((size) + 127) / 128)
+
+/**
+ * @brief Compresses a frame with a PackBits-style run-length encoding.
+ *
+ * Every block starts with a control byte c: c < 128 is followed by c + 1 literal
+ * bytes, c >= 128 by one byte that is repeated c - 125 times (3 to 130). A run of
+ * one white byte holds two white pixels, so a mostly white 4bpp frame shrinks
+ * about 60 times.
+ *
+ * @param dst Room for FRAME_RLE_MAX_SIZE(size) bytes.
+ * @return Bytes written to dst.
+ */
+UDOUBLE FrameRle_Encode(const UBYTE *src, UDOUBLE size, UBYTE *dst);
+
+/**
+ * @brief Expands FrameRle_Encode() output straight into a frame.
+ *
+ * @return 0 if src expands to exactly size bytes, -1 if it is damaged.
+ */
+int FrameRle_Decode(const UBYTE *src, UDOUBLE srcSize, UBYTE *dst, UDOUBLE size);
+
+#endif // FRAME_RLE_H
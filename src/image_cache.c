@@ -1,56 +1,373 @@
 #include "image_cache.h"
+#include "image_slots.h"
+#include "frame_rle.h"
+#include "../lib/Config/Debug.h"
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(ImageCacheHeader) == 64, "ImageCacheHeader must stay 64 bytes");
+
+static int compressFiles = 0;
+
+/**
+ * setImageCacheCompression
+ * ------------------------
+ * Selects whether cache files are written run-length encoded.
+ */
+void setImageCacheCompression(int enable) {
+    compressFiles = enable;
+}
+
+/**
+ * makeImageCachePath
+ * ------------------
+ * Builds the cache file path of an image.
+ */
+void makeImageCachePath(const char *imagePath, char *cachePath, size_t len) {
+    const char *base = strrchr(imagePath, '/');
+    base = base ? base + 1 : imagePath;
+    const char *dot = strrchr(base, '.');
+    int nameLen = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(cachePath, len, IMAGE_CACHE_DIR "/%.*s.raw", nameLen, base);
+}
+
+/**
+ * makeImageCacheKey
+ * -----------------
+ * Fills in the key for a frame decoded from sourcePath.
+ */
+int makeImageCacheKey(const char *sourcePath, UWORD width, UWORD height, UBYTE bpp,
+                      UBYTE rotate, UBYTE mirror, ImageCacheKey *key) {
+    struct stat st;
+    memset(key, 0, sizeof(*key));
+    key->width = width;
+    key->height = height;
+    key->bpp = bpp;
+    key->rotate = rotate;
+    key->mirror = mirror;
+    if (stat(sourcePath, &st) != 0) {
+        return -1;
+    }
+    key->sourceSize = (uint64_t)st.st_size;
+    key->sourceMtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+// Checks a cache file header against the file size and the key.
+static int checkHeader(const ImageCacheHeader *header, long size, const ImageCacheKey *key, const char *cachePath) {
+    if (memcmp(header->magic, IMAGE_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IMAGE_CACHE_VERSION || header->headerSize != sizeof(*header) ||
+        header->storedSize != (uint64_t)size - sizeof(*header) ||
+        (header->encoding == IMAGE_CACHE_RAW && header->storedSize != header->dataSize) ||
+        header->encoding > IMAGE_CACHE_RLE) {
+        Debug("Image cache: %s is not a version %d cache file.\n", cachePath, IMAGE_CACHE_VERSION);
+        return -1;
+    }
+    if (header->width != key->width || header->height != key->height || header->bpp != key->bpp ||
+        header->rotate != key->rotate || header->mirror != key->mirror) {
+        Debug("Image cache: %s was decoded for %ux%u %ubpp, rotate %u, mirror %u.\n", cachePath,
+              header->width, header->height, header->bpp, header->rotate, header->mirror);
+        return -1;
+    }
+    if (header->sourceSize != key->sourceSize || header->sourceMtimeNs != key->sourceMtimeNs) {
+        Debug("Image cache: The source of %s has changed.\n", cachePath);
+        return -1;
+    }
+    return 0;
+}
 
 /**
  * loadPreDecodedImage
  * -------------------
  * Loads a pre-decoded image from a cache file.
  */
-UBYTE* loadPreDecodedImage(const char *cachePath, UDOUBLE *buffer_size) {
+UBYTE* loadPreDecodedImage(const char *cachePath, const ImageCacheKey *key, UDOUBLE *buffer_size) {
     FILE *fp = fopen(cachePath, "rb");
     if (!fp) {
         return NULL;
     }
-    
+
     // Determine the file size.
     fseek(fp, 0, SEEK_END);
     long size = ftell(fp);
     fseek(fp, 0, SEEK_SET);
-    
-    UBYTE *buffer = (UBYTE *)malloc(size);
-    if (!buffer) {
+
+    ImageCacheHeader header;
+    if (size < (long)sizeof(header) || fread(&header, sizeof(header), 1, fp) != 1) {
+        Debug("loadPreDecodedImage: %s has no cache header.\n", cachePath);
         fclose(fp);
         return NULL;
     }
-    
-    if (fread(buffer, 1, size, fp) != (size_t)size) {
+    if (checkHeader(&header, size, key, cachePath) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    UBYTE *buffer = (UBYTE *)malloc(header.dataSize);
+    UBYTE *stored = header.encoding == IMAGE_CACHE_RAW ? buffer : (UBYTE *)malloc(header.storedSize);
+    if (!buffer || !stored) {
+        if (stored != buffer) {
+            free(stored);
+        }
         free(buffer);
         fclose(fp);
         return NULL;
     }
-    
+
+    int ok = fread(stored, 1, header.storedSize, fp) == header.storedSize;
     fclose(fp);
-    *buffer_size = (UDOUBLE)size;
+    if (stored != buffer) {
+        ok = ok && FrameRle_Decode(stored, header.storedSize, buffer, header.dataSize) == 0;
+        free(stored);
+    }
+    if (!ok) {
+        Debug("loadPreDecodedImage: Failed to read %s.\n", cachePath);
+        free(buffer);
+        return NULL;
+    }
+
+    if (ImageSlots_Hash(buffer, header.dataSize) != header.dataHash) {
+        Debug("loadPreDecodedImage: %s is damaged, checksum mismatch.\n", cachePath);
+        free(buffer);
+        return NULL;
+    }
+
+    *buffer_size = header.dataSize;
     return buffer;
 }
 
 /**
- * cachePreDecodedImage
+ * loadLegacyImage
+ * ---------------
+ * Loads a headerless cache file holding exactly one frame.
+ */
+UBYTE* loadLegacyImage(const char *cachePath, UDOUBLE buffer_size) {
+    FILE *fp = fopen(cachePath, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size != (long)buffer_size) {
+        Debug("loadLegacyImage: %s is %ld bytes, not a %u byte frame.\n", cachePath, size, buffer_size);
+        fclose(fp);
+        return NULL;
+    }
+
+    UBYTE *buffer = (UBYTE *)malloc(buffer_size);
+    if (!buffer) {
+        fclose(fp);
+        return NULL;
+    }
+    int ok = fread(buffer, 1, buffer_size, fp) == buffer_size;
+    fclose(fp);
+    // A versioned file of a BMP that was removed may happen to be a frame in size.
+    if (!ok || memcmp(buffer, IMAGE_CACHE_MAGIC, strlen(IMAGE_CACHE_MAGIC)) == 0) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+/**
+ * checkPreDecodedImage
  * --------------------
- * Writes a pre-decoded image buffer to a cache file.
+ * Checks only the header of a cache file against the key.
  */
-int cachePreDecodedImage(const char *cachePath, UBYTE *buffer, UDOUBLE buffer_size) {
-    FILE *fp = fopen(cachePath, "wb");
+int checkPreDecodedImage(const char *cachePath, const ImageCacheKey *key) {
+    FILE *fp = fopen(cachePath, "rb");
     if (!fp) {
         return -1;
     }
-    
-    size_t written = fwrite(buffer, 1, buffer_size, fp);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    ImageCacheHeader header;
+    int ret = -1;
+    if (size >= (long)sizeof(header) && fread(&header, sizeof(header), 1, fp) == 1) {
+        ret = checkHeader(&header, size, key, cachePath);
+    }
     fclose(fp);
-    
-    if (written != buffer_size) {
+    return ret;
+}
+
+/**
+ * mapPreDecodedImage
+ * ------------------
+ * Maps a pre-decoded image from a cache file read-only.
+ */
+UBYTE* mapPreDecodedImage(const char *cachePath, const ImageCacheKey *key, UDOUBLE *buffer_size, uint64_t *hash,
+                          int *mapped) {
+    int fd = open(cachePath, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ImageCacheHeader)) {
+        Debug("mapPreDecodedImage: %s has no cache header.\n", cachePath);
+        close(fd);
+        return NULL;
+    }
+
+    // The pages are read in right away, the checksum below touches all of them.
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    void *map = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        Debug("mapPreDecodedImage: Failed to map %s.\n", cachePath);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    const ImageCacheHeader *header = (const ImageCacheHeader *)map;
+    UBYTE *frame = (UBYTE *)map + sizeof(ImageCacheHeader);
+    if (checkHeader(header, st.st_size, key, cachePath) != 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    UDOUBLE size = header->dataSize;
+    uint64_t dataHash = header->dataHash;
+    *mapped = header->encoding == IMAGE_CACHE_RAW;
+    if (!*mapped) {
+        // Expand straight from the page cache into the frame, the mapping is not needed after.
+        UBYTE *expanded = (UBYTE *)malloc(size);
+        if (expanded && FrameRle_Decode(frame, header->storedSize, expanded, size) != 0) {
+            Debug("mapPreDecodedImage: %s is damaged, bad run-length data.\n", cachePath);
+            free(expanded);
+            expanded = NULL;
+        }
+        munmap(map, st.st_size);
+        if (!expanded) {
+            return NULL;
+        }
+        frame = expanded;
+    }
+    if (ImageSlots_Hash(frame, size) != dataHash) {
+        Debug("mapPreDecodedImage: %s is damaged, checksum mismatch.\n", cachePath);
+        if (*mapped) {
+            munmap(map, st.st_size);
+        } else {
+            free(frame);
+        }
+        return NULL;
+    }
+
+    *buffer_size = size;
+    *hash = dataHash;
+    return frame;
+}
+
+/**
+ * unmapPreDecodedImage
+ * --------------------
+ * Unmaps a frame returned by mapPreDecodedImage().
+ */
+void unmapPreDecodedImage(UBYTE *frame, UDOUBLE buffer_size) {
+    if (frame) {
+        munmap(frame - sizeof(ImageCacheHeader), sizeof(ImageCacheHeader) + (size_t)buffer_size);
+    }
+}
+
+// Writes all of len bytes, retrying short writes.
+static int writeAll(int fd, const void *data, size_t len) {
+    const UBYTE *p = (const UBYTE *)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * writePreDecodedImage
+ * --------------------
+ * Writes a cache file under a unique temporary name next to cachePath.
+ */
+int writePreDecodedImage(const char *cachePath, const ImageCacheKey *key, const UBYTE *buffer,
+                         UDOUBLE buffer_size, uint64_t hash, char *tmpPath, size_t tmpPathLen) {
+    ImageCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_CACHE_VERSION;
+    header.headerSize = sizeof(header);
+    header.width = key->width;
+    header.height = key->height;
+    header.bpp = key->bpp;
+    header.rotate = key->rotate;
+    header.mirror = key->mirror;
+    header.dataSize = buffer_size;
+    header.sourceSize = key->sourceSize;
+    header.sourceMtimeNs = key->sourceMtimeNs;
+    header.dataHash = hash;
+
+    const UBYTE *stored = buffer;
+    UBYTE *encoded = NULL;
+    header.encoding = IMAGE_CACHE_RAW;
+    header.storedSize = buffer_size;
+    if (compressFiles) {
+        encoded = (UBYTE *)malloc(FRAME_RLE_MAX_SIZE(buffer_size));
+        UDOUBLE encodedSize = encoded ? FrameRle_Encode(buffer, buffer_size, encoded) : buffer_size;
+        if (encodedSize < buffer_size) {
+            stored = encoded;
+            header.encoding = IMAGE_CACHE_RLE;
+            header.storedSize = encodedSize;
+        }
+    }
+
+    // The temporary name is unique, the cache warmer and the cache writer may
+    // write the same entry.
+    snprintf(tmpPath, tmpPathLen, "%s.XXXXXX", cachePath);
+    int fd = mkstemp(tmpPath);
+    if (fd >= 0) {
+        fchmod(fd, 0644);
+        if (writeAll(fd, &header, sizeof(header)) != 0 || writeAll(fd, stored, header.storedSize) != 0) {
+            close(fd);
+            remove(tmpPath);
+            fd = -1;
+        }
+    }
+    free(encoded);
+    return fd;
+}
+
+/**
+ * cachePreDecodedImage
+ * --------------------
+ * Writes a pre-decoded image buffer with its header to a cache file.
+ */
+int cachePreDecodedImage(const char *cachePath, const ImageCacheKey *key, UBYTE *buffer, UDOUBLE buffer_size) {
+    // Write next to the target, flush and rename, so a crash never leaves half a file behind.
+    char tmpPath[300];
+    int fd = writePreDecodedImage(cachePath, key, buffer, buffer_size,
+                                  ImageSlots_Hash(buffer, buffer_size), tmpPath, sizeof(tmpPath));
+    if (fd < 0) {
         return -1;
     }
-    
+    int ok = fdatasync(fd) == 0;
+    if (close(fd) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(tmpPath, cachePath) != 0) {
+        remove(tmpPath);
+        return -1;
+    }
+
     return 0;
-}
\ No newline at end of file
+}
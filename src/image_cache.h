@@ -3,31 +3,171 @@
 
 #include "../lib/Config/DEV_Config.h"  // Ensure this header defines UBYTE, UWORD, UDOUBLE, etc.
 #include <stdlib.h>
+#include <stdint.h>
+
+#define IMAGE_CACHE_MAGIC    "EPDC"
+#define IMAGE_CACHE_VERSION  2
+
+// How the frame is stored after the header.
+#define IMAGE_CACHE_RAW      0   // As is, the file can be mapped and uploaded from.
+#define IMAGE_CACHE_RLE      1   // FrameRle_Encode() output.
+
+/**
+ * What a cached frame was decoded from and for. A cache file is only used
+ * when all of it matches.
+ */
+typedef struct {
+    UWORD width;            // Frame size in pixels.
+    UWORD height;
+    UBYTE bpp;              // Bits per pixel of the frame.
+    UBYTE rotate;           // Paint rotation and mirroring the frame was decoded with.
+    UBYTE mirror;
+    uint64_t sourceSize;    // Size and modification time of the source BMP.
+    int64_t sourceMtimeNs;
+} ImageCacheKey;
+
+/**
+ * Header in front of the pixel data of a cache file, 64 bytes in host byte order.
+ */
+typedef struct {
+    char magic[4];          // IMAGE_CACHE_MAGIC
+    uint16_t version;       // IMAGE_CACHE_VERSION
+    uint16_t headerSize;    // sizeof(ImageCacheHeader)
+    uint16_t width;
+    uint16_t height;
+    uint8_t bpp;
+    uint8_t rotate;
+    uint8_t mirror;
+    uint8_t encoding;       // IMAGE_CACHE_RAW or IMAGE_CACHE_RLE.
+    uint32_t dataSize;      // Pixel bytes of the frame.
+    uint32_t storedSize;    // Bytes after the header, dataSize when raw.
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint64_t dataHash;      // ImageSlots_Hash() of the pixel data.
+    uint8_t reserved[16];
+} ImageCacheHeader;
+
+#define IMAGE_CACHE_DIR      "./pic/raw"
+
+/**
+ * setImageCacheCompression
+ * ------------------------
+ * Selects whether cache files are written run-length encoded. Files of both
+ * encodings are always read.
+ */
+void setImageCacheCompression(int enable);
+
+/**
+ * makeImageCachePath
+ * ------------------
+ * Builds the cache file path of an image, e.g. "./pic/raw/name.raw" for
+ * "./pic/bmp/name.bmp" or "name.bmp".
+ */
+void makeImageCachePath(const char *imagePath, char *cachePath, size_t len);
+
+/**
+ * makeImageCacheKey
+ * -----------------
+ * Fills in the key for a frame decoded from sourcePath.
+ *
+ * @return: 0 on success, -1 if the source file does not exist.
+ */
+int makeImageCacheKey(const char *sourcePath, UWORD width, UWORD height, UBYTE bpp,
+                      UBYTE rotate, UBYTE mirror, ImageCacheKey *key);
 
 /**
  * loadPreDecodedImage
  * -------------------
  * Loads a pre-decoded image from a cache file.
  *
- * @param cachePath: Path to the cached raw image file.
+ * @param cachePath: Path to the cached image file.
+ * @param key: What the frame must have been decoded from and for.
  * @param buffer_size: Pointer to a UDOUBLE that will receive the size in bytes.
  *
  * @return: Pointer to the allocated buffer containing the image data,
- *          or NULL on failure.
+ *          or NULL if the file is missing, damaged, of another format
+ *          version or does not match the key.
+ */
+UBYTE* loadPreDecodedImage(const char *cachePath, const ImageCacheKey *key, UDOUBLE *buffer_size);
+
+/**
+ * loadLegacyImage
+ * ---------------
+ * Loads a cache file written before cache files had a header: the bare
+ * frame, exactly buffer_size bytes. Such a file says nothing about its
+ * source, so it is only to be used when the source BMP is absent.
+ *
+ * @return: Pointer to the allocated buffer containing the frame, or NULL if
+ *          the file is missing, of another size or has a cache header.
+ */
+UBYTE* loadLegacyImage(const char *cachePath, UDOUBLE buffer_size);
+
+/**
+ * checkPreDecodedImage
+ * --------------------
+ * Checks only the header of a cache file against the key, without reading
+ * the pixel data.
+ *
+ * @return: 0 if the file exists and matches the key, -1 otherwise.
+ */
+int checkPreDecodedImage(const char *cachePath, const ImageCacheKey *key);
+
+/**
+ * mapPreDecodedImage
+ * ------------------
+ * Like loadPreDecodedImage(), but maps the cache file read-only instead of
+ * copying it into a buffer. A raw frame is the mapping itself: it is shared
+ * with the page cache and must not be written to. Files are only ever
+ * replaced by rename(), so a mapping keeps the frame it was made with.
+ * A compressed frame is expanded from the mapping into a malloc()ed buffer.
+ *
+ * @param hash: Receives the checksum of the frame, its ImageSlots_Hash().
+ * @param mapped: Receives 1 if the frame is to be given back with
+ *                unmapPreDecodedImage(), 0 if with free().
+ *
+ * @return: Pointer to the frame, or NULL as with loadPreDecodedImage().
+ */
+UBYTE* mapPreDecodedImage(const char *cachePath, const ImageCacheKey *key, UDOUBLE *buffer_size, uint64_t *hash,
+                          int *mapped);
+
+/**
+ * unmapPreDecodedImage
+ * --------------------
+ * Unmaps a frame returned by mapPreDecodedImage(). NULL is ignored.
+ */
+void unmapPreDecodedImage(UBYTE *frame, UDOUBLE buffer_size);
+
+/**
+ * writePreDecodedImage
+ * --------------------
+ * First half of cachePreDecodedImage(): writes the header and the frame to a
+ * new file named cachePath plus a unique suffix, without flushing it. The
+ * caller flushes the returned descriptor, closes it and renames tmpPath to
+ * cachePath, or removes tmpPath. The frame is compressed when
+ * setImageCacheCompression() enabled it and that makes it smaller.
+ *
+ * @param hash: ImageSlots_Hash() of the buffer.
+ * @param tmpPath: Receives the name of the temporary file.
+ *
+ * @return: The open file descriptor, or -1 on failure.
  */
-UBYTE* loadPreDecodedImage(const char *cachePath, UDOUBLE *buffer_size);
+int writePreDecodedImage(const char *cachePath, const ImageCacheKey *key, const UBYTE *buffer,
+                         UDOUBLE buffer_size, uint64_t hash, char *tmpPath, size_t tmpPathLen);
 
 /**
  * cachePreDecodedImage
  * --------------------
- * Writes a pre-decoded image buffer to a cache file.
+ * Writes a pre-decoded image buffer with its header to a cache file.
+ * The file is flushed and then replaced atomically, readers and a restart
+ * after a crash see the old or the new one.
  *
  * @param cachePath: Path where the image data should be saved.
+ * @param key: What the frame was decoded from and for.
  * @param buffer: Pointer to the image data buffer.
  * @param buffer_size: Size of the buffer in bytes.
  *
  * @return: 0 on success, -1 on failure.
  */
-int cachePreDecodedImage(const char *cachePath, UBYTE *buffer, UDOUBLE buffer_size);
+int cachePreDecodedImage(const char *cachePath, const ImageCacheKey *key, UBYTE *buffer, UDOUBLE buffer_size);
 
 #endif // IMAGE_CACHE_H
@@ -0,0 +1,122 @@
+//image_decode.c
+#include "image_decode.h"
+#include "thread_pool.h"
+#include "../lib/Config/Debug.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static ThreadPool *decodePool = NULL;
+
+typedef struct {
+    const BMP_Decoder *decoder;
+    const BMP_Canvas *canvas;
+    UWORD x;
+    UWORD y;
+    UDOUBLE rows;           // Picture rows that land on the canvas.
+    int bands;
+    BMP_Result *result;     // One per band.
+} DecodeJob;
+
+static void decodeBand(void *arg, int index) {
+    DecodeJob *job = (DecodeJob *)arg;
+    UDOUBLE first = job->rows * index / job->bands;
+    UDOUBLE last = job->rows * (index + 1) / job->bands;
+    job->result[index] = BMP_Decoder_Draw_Rows(job->decoder, job->canvas, job->x, job->y, first, last - first);
+}
+
+void ImageDecode_Init(int threads) {
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    ImageDecode_Exit();
+    if (threads > 1) {
+        decodePool = ThreadPool_Create(threads);
+    }
+    Debug("ImageDecode_Init: Decoding with %d thread(s).\n", ThreadPool_Threads(decodePool));
+}
+
+// Size of the file an opened decoder reads.
+static off_t sourceSize(const BMP_Decoder *decoder) {
+    if (decoder->Data) {
+        return (off_t)decoder->Data_Size;
+    }
+    struct stat st;
+    return fstat(fileno(decoder->fp), &st) == 0 ? st.st_size : -1;
+}
+
+// Decodes an opened picture in row bands on the pool and closes the decoder.
+static BMP_Result decodeOpened(BMP_Decoder *decoder, BMP_Result result, const BMP_Canvas *canvas,
+                               UWORD x, UWORD y, int threads) {
+    if (result != BMP_OK) {
+        BMP_Decoder_Close(decoder);
+        return result;
+    }
+
+    // Rows below the canvas are never converted, so they do not count for the split.
+    UDOUBLE rows = (y >= canvas->Height) ? 0 : (UDOUBLE)canvas->Height - y;
+    if (rows > decoder->Height) {
+        rows = decoder->Height;
+    }
+    int bands = rows / IMAGE_DECODE_MIN_BAND_ROWS;
+    if (bands > threads) {
+        bands = threads;
+    }
+    if (bands < 2) {
+        result = BMP_Decoder_Draw(decoder, canvas, x, y);
+        BMP_Decoder_Close(decoder);
+        return result;
+    }
+
+    BMP_Result *bandResult = malloc(bands * sizeof(BMP_Result));
+    if (!bandResult) {
+        BMP_Decoder_Close(decoder);
+        return BMP_ERR_NOMEM;
+    }
+    DecodeJob job = { decoder, canvas, x, y, rows, bands, bandResult };
+    ThreadPool_Run(decodePool, decodeBand, &job, bands);
+
+    for (int i = 0; i < bands && result == BMP_OK; i++) {
+        result = bandResult[i];
+    }
+    free(bandResult);
+
+    // The serial decoder reads the rows below the canvas too and reports a file
+    // that ends there as truncated; keep the same result.
+    if (result == BMP_OK) {
+        off_t size = sourceSize(decoder);
+        if (size >= 0 &&
+            size < (off_t)decoder->FileHead.bOffset + (off_t)decoder->Height * decoder->Bytes_Per_Line) {
+            result = BMP_ERR_TRUNCATED;
+        }
+    }
+    BMP_Decoder_Close(decoder);
+    return result;
+}
+
+BMP_Result ImageDecode_File(const char *path, const BMP_Canvas *canvas, UWORD x, UWORD y) {
+    int threads = ThreadPool_Threads(decodePool);
+    if (threads == 1) {
+        return BMP_Decode_File(path, canvas, x, y);
+    }
+    BMP_Decoder decoder;
+    BMP_Result result = BMP_Decoder_Open(&decoder, path);
+    return decodeOpened(&decoder, result, canvas, x, y, threads);
+}
+
+BMP_Result ImageDecode_Memory(const UBYTE *data, UDOUBLE size, const BMP_Canvas *canvas, UWORD x, UWORD y) {
+    int threads = ThreadPool_Threads(decodePool);
+    if (threads == 1) {
+        return BMP_Decode_Memory(data, size, canvas, x, y);
+    }
+    BMP_Decoder decoder;
+    BMP_Result result = BMP_Decoder_Open_Memory(&decoder, data, size);
+    return decodeOpened(&decoder, result, canvas, x, y, threads);
+}
+
+void ImageDecode_Exit(void) {
+    ThreadPool_Destroy(decodePool);
+    decodePool = NULL;
+}
@@ -0,0 +1,36 @@
+//image_decode.h
+#ifndef IMAGE_DECODE_H
+#define IMAGE_DECODE_H
+
+#include "../lib/GUI/GUI_BMPfile.h"
+
+#define IMAGE_DECODE_MIN_BAND_ROWS  64   // Smaller bands are not worth a thread.
+
+/**
+ * @brief Starts the decode thread pool. threads <= 0 uses one thread per online core.
+ *
+ * Without ImageDecode_Init(), or with one thread, pictures are decoded serially.
+ */
+void ImageDecode_Init(int threads);
+
+/**
+ * @brief Decodes a BMP file into a 4bpp canvas, split into row bands on the pool.
+ *
+ * The canvas gets the same bytes as with BMP_Decode_File(), which is what runs
+ * for small pictures. Can be called from several threads.
+ */
+BMP_Result ImageDecode_File(const char *path, const BMP_Canvas *canvas, UWORD x, UWORD y);
+
+/**
+ * @brief Like ImageDecode_File(), for a BMP file held in memory.
+ *
+ * The bands are copied straight from data, nothing is written to disk.
+ */
+BMP_Result ImageDecode_Memory(const UBYTE *data, UDOUBLE size, const BMP_Canvas *canvas, UWORD x, UWORD y);
+
+/**
+ * @brief Stops the pool.
+ */
+void ImageDecode_Exit(void);
+
+#endif // IMAGE_DECODE_H
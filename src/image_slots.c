@@ -0,0 +1,85 @@
+//image_slots.c
+#include "image_slots.h"
+#include "../lib/Config/Debug.h"
+#include <string.h>
+
+static ImageSlot slots[IMAGE_SLOTS_MAX];
+static int slotCount = 0;
+static UDOUBLE useTick = 0;
+
+int ImageSlots_Init(IT8951_Dev_Info dev_info, UDOUBLE base_addr, int count) {
+    // The controller keeps one byte per pixel, whatever the load format.
+    UDOUBLE slotSize = (UDOUBLE)dev_info.Panel_W * dev_info.Panel_H;
+    slotSize = (slotSize + IMAGE_SLOT_ALIGN - 1) / IMAGE_SLOT_ALIGN * IMAGE_SLOT_ALIGN;
+
+    if (count < 1)
+        count = 1;
+    if (count > IMAGE_SLOTS_MAX)
+        count = IMAGE_SLOTS_MAX;
+    if (base_addr < IMAGE_MEMORY_END && slotSize > 0 &&
+        (UDOUBLE)count > (IMAGE_MEMORY_END - base_addr) / slotSize) {
+        count = (IMAGE_MEMORY_END - base_addr) / slotSize;
+        if (count < 1)
+            count = 1;
+    }
+
+    memset(slots, 0, sizeof(slots));
+    for (int i = 0; i < count; i++)
+        slots[i].addr = base_addr + (UDOUBLE)i * slotSize;
+    slotCount = count;
+    useTick = 0;
+
+    Debug("ImageSlots_Init: %d slot(s) of %u bytes from 0x%X.\n", count, slotSize, base_addr);
+    return count;
+}
+
+uint64_t ImageSlots_Hash(const UBYTE *frame, UDOUBLE size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (UDOUBLE i = 0; i < size; i++) {
+        hash ^= frame[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+int ImageSlots_Find(uint64_t hash) {
+    for (int i = 1; i < slotCount; i++) {
+        if (slots[i].hash == hash) {
+            slots[i].lastUse = ++useTick;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ImageSlots_Store(const char *name, const UBYTE *frame, UWORD width, UWORD height, uint64_t hash) {
+    int victim = -1;
+
+    for (int i = 1; i < slotCount; i++) {
+        if (slots[i].hash == 0) {
+            victim = i;
+            break;
+        }
+        if (victim < 0 || slots[i].lastUse < slots[victim].lastUse)
+            victim = i;
+    }
+    if (victim < 0)
+        return -1;
+
+    if (slots[victim].hash)
+        Debug("ImageSlots_Store: Evicting %s from slot %d.\n", slots[victim].name, victim);
+    EPD_IT8951_4bp_Write((UBYTE *)frame, 0, 0, width, height, slots[victim].addr, true);
+
+    slots[victim].hash = hash;
+    slots[victim].lastUse = ++useTick;
+    strncpy(slots[victim].name, name ? name : "", sizeof(slots[victim].name) - 1);
+    slots[victim].name[sizeof(slots[victim].name) - 1] = '\0';
+    Debug("ImageSlots_Store: %s in slot %d at 0x%X.\n", slots[victim].name, victim, slots[victim].addr);
+    return victim;
+}
+
+UDOUBLE ImageSlots_Addr(int slot) {
+    if (slot < 0 || slot >= slotCount)
+        return slots[0].addr;
+    return slots[slot].addr;
+}
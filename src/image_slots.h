@@ -0,0 +1,57 @@
+//image_slots.h
+#ifndef IMAGE_SLOTS_H
+#define IMAGE_SLOTS_H
+
+#include "../lib/e-Paper/EPD_IT8951.h"
+#include "../lib/Config/DEV_Config.h"
+
+#define IMAGE_SLOTS_MAX   32          // Slots tracked, the working buffer included.
+#define IMAGE_SLOT_ALIGN  256         // Byte alignment of a slot in controller memory.
+#define IMAGE_MEMORY_END  0x04000000  // End of the IT8951 SDRAM (64MB).
+
+/**
+ * @brief One full frame in the controller memory.
+ */
+typedef struct {
+    UDOUBLE addr;       /**< Image buffer address for LISAR and DPY_BUF_AREA. */
+    uint64_t hash;      /**< ImageSlots_Hash() of the 4bpp frame, 0 when empty. */
+    UDOUBLE lastUse;    /**< Tick of the last store or hit, for eviction. */
+    char name[64];      /**< Image the frame was loaded from, for the log. */
+} ImageSlot;
+
+/**
+ * @brief Splits the controller memory from base_addr on into count frame slots.
+ *
+ * Slot 0 is the image buffer at base_addr, which uploads and partial refreshes work
+ * on. It is never handed out. The other slots keep preloaded frames.
+ *
+ * @return Number of slots that fit, at most count.
+ */
+int ImageSlots_Init(IT8951_Dev_Info dev_info, UDOUBLE base_addr, int count);
+
+/**
+ * @brief 64-bit FNV-1a hash of a frame, never 0.
+ */
+uint64_t ImageSlots_Hash(const UBYTE *frame, UDOUBLE size);
+
+/**
+ * @brief Looks up the slot holding the frame with this hash.
+ *
+ * @return Slot index, or -1 if the frame is not in the controller.
+ */
+int ImageSlots_Find(uint64_t hash);
+
+/**
+ * @brief Uploads a 4bpp frame of width x height into an empty slot, or into the
+ *        least recently used one when all are taken.
+ *
+ * @return Slot index, or -1 if there are no slots besides the working buffer.
+ */
+int ImageSlots_Store(const char *name, const UBYTE *frame, UWORD width, UWORD height, uint64_t hash);
+
+/**
+ * @brief Image buffer address of a slot.
+ */
+UDOUBLE ImageSlots_Addr(int slot);
+
+#endif // IMAGE_SLOTS_H
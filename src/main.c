@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <string.h>
 #include <unistd.h>
 
 // Include headers for your application modules.
@@ -11,6 +12,13 @@
 #include "../lib/Config/DEV_Config.h"  // Hardware initialization routines
 #include "../lib/e-Paper/EPD_IT8951.h"  // Ensure that UDOUBLE is defined
 #include "config.h"
+#include "transfer_profile.h"
+#include "image_decode.h"
+#include "image_cache.h"
+#include "frame_cache.h"
+#include "cache_warmer.h"
+#include "cache_writer.h"
+#include "event_loop.h"
 
 // Define VCOM if not defined elsewhere
 #define VCOM 2010
@@ -30,10 +38,20 @@ void signal_handler(int signo) {
     if (signo == SIGINT) {
         printf("Received SIGINT, shutting down...\n");
         running = 0;
+        // The signal may land on another thread, wake the main loop explicitly.
+        EventLoop_Wake();
     }
 }
 
 int main(int argc, char *argv[]) {
+    // --calibrate re-measures the SPI transfer settings even if a profile exists.
+    int force_calibration = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--calibrate") == 0) {
+            force_calibration = 1;
+        }
+    }
+
     // Set up signal handling so we can exit gracefully.
     if (signal(SIGINT, signal_handler) == SIG_ERR) {
         fprintf(stderr, "Failed to set signal handler\n");
@@ -46,6 +64,12 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    // The main loop sleeps until a message arrives or the default image is due.
+    if (EventLoop_Init() != 0) {
+        fprintf(stderr, "Event loop initialization failed.\n");
+        return EXIT_FAILURE;
+    }
+
     // -------------------------------
     // Hardware and Display Initialization
     // -------------------------------
@@ -66,12 +90,34 @@ int main(int argc, char *argv[]) {
     UDOUBLE init_value = global_dev_info.Memory_Addr_L | (global_dev_info.Memory_Addr_H << 16);
     Init_Target_Memory_Addr = init_value;  // Assign the computed value
 
+    // Pick the transfer strategy, burst geometry and SPI clock for this board and panel,
+    // from the stored profile or by calibrating once.
+    TransferProfile_Init(global_dev_info, Init_Target_Memory_Addr, force_calibration);
+
+    // Decode large pictures in row bands on all cores.
+    ImageDecode_Init(globalConfig.decodeThreads);
+
+    // Keep recently shown frames in memory, so showing them again reads nothing from the SD card.
+    FrameCache_Init(globalConfig.frameCacheMB > 0 ? (uint64_t)globalConfig.frameCacheMB << 20 : 0);
+
+    // Write newly decoded frames to ./pic/raw behind the refresh, not before it.
+    setImageCacheCompression(globalConfig.cacheCompression);
+    CacheWriter_Start();
+
+    // Keep the frames shown most often in the controller memory, so switching
+    // to them needs no upload.
+    Display_PreloadImages(global_dev_info, Init_Target_Memory_Addr);
     
     // Clear the display before starting.
     // (Display_Clear() would be a wrapper inside display_app that calls EPD_IT8951_Clear_Refresh()
     //  using the proper mode and parameters.)
     Display_Clear(global_dev_info, Init_Target_Memory_Addr);
 
+    // Decode pictures copied into ./pic/bmp before they are asked for.
+    if (globalConfig.cacheWarmer) {
+        Display_StartCacheWarmer(global_dev_info);
+    }
+
     // -------------------------------
     // MQTT Initialization and Setup
     // -------------------------------
@@ -84,42 +130,62 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    // Connect to the MQTT broker.
+    // Subscribe to the desired MQTT topic, once connected and again after every reconnect.
+    MQTT_Subscribe(NULL, globalConfig.mqttQos);
+
+    // Start connecting to the MQTT broker. The main loop does not wait for it:
+    // MQTT_Process() shows the default image once connected and retries on failure.
     if (MQTT_Connect() != 0) {
         fprintf(stderr, "MQTT connection failed.\n");
         DEV_Module_Exit();
         return EXIT_FAILURE;
     }
-    
-    // Subscribe to the desired MQTT topic.
-    MQTT_Subscribe(NULL, globalConfig.mqttQos);
+
+    // Stop uploading a frame as soon as a newer message is waiting, at the next telegram.
+    Upload_Abort_Check = MQTT_MessagePending;
 
     // -------------------------------
     // Main Loop
     // -------------------------------
 
-    // In this simple loop, we simply let the MQTT handler process incoming messages.
-    // In a more sophisticated design, you might use a select() loop or a proper MQTT
-    // client library that provides its own event loop.
+    // The MQTT client receives on its own thread and wakes the loop through the
+    // event loop's eventfd; a timerfd wakes it when the default image or the next
+    // reconnect attempt is due. Between the two the loop sleeps, it does not poll.
 
     // Initialize the timestamp so that the default image doesn't load immediately.
     last_image_display_time = time(NULL);
 
     while (running) {
         // Process incoming MQTT messages.
-        // (This function should call your callback to display images via Process_MQTT_Message().)
+        // (This function displays the queued images via Process_MQTT_Message().)
         MQTT_Process();
 
-        // Sleep briefly so we don’t busy-wait.
-        sleep(1);
         // Only switch to the default image if a custom image is currently displayed
         // and the timeout has elapsed.
         if (current_image_type == IMAGE_CUSTOM && (time(NULL) - last_image_display_time >= globalConfig.defaultImageTimeout)) {
             
+            // Sets the flag to indicate default image is now displayed, unless a newer
+            // message superseded it or it failed to load.
             Display_ShowSpecialImage(globalConfig.defaultImagePath, global_dev_info, Init_Target_Memory_Addr);
-            // Set the flag to indicate default image is now displayed.
-            current_image_type = IMAGE_DEFAULT;
             // Do not update last_image_display_time here, so it doesn't keep refreshing default repeatedly.
+            if (current_image_type == IMAGE_CUSTOM && !MQTT_MessagePending()) {
+                // It failed to load: try again after another timeout rather than right away.
+                last_image_display_time = time(NULL);
+            }
+        }
+
+        // Wake when the custom image times out or a reconnect attempt is due,
+        // or on the next message.
+        time_t wake_time = MQTT_RetryTime();
+        if (current_image_type == IMAGE_CUSTOM) {
+            time_t default_time = last_image_display_time + globalConfig.defaultImageTimeout;
+            if (wake_time == 0 || default_time < wake_time) {
+                wake_time = default_time;
+            }
+        }
+        EventLoop_SetTimer(wake_time);
+        if (running) {
+            EventLoop_Wait();
         }
     }
 
@@ -127,6 +193,9 @@ int main(int argc, char *argv[]) {
     // Cleanup
     // -------------------------------
 
+    // The last images are shown in full.
+    Upload_Abort_Check = NULL;
+
     // Disconnect and clean up the MQTT connection.
     MQTT_Disconnect();
     MQTT_Cleanup();
@@ -137,6 +206,12 @@ int main(int argc, char *argv[]) {
     // Put the e-Paper display into sleep mode.
     EPD_IT8951_Sleep();
 
+    CacheWarmer_Stop();
+    CacheWriter_Stop();
+    EventLoop_Exit();
+    ImageDecode_Exit();
+    FrameCache_Exit();
+
     // Clean up any hardware resources.
     DEV_Module_Exit();
 
@@ -1,57 +1,153 @@
 // mqtt_handler.c
 #include "mqtt_handler.h"
 #include "../lib/Config/Debug.h"    // For logging/debugging functions
-#include "display_app.h"            // For calling Process_MQTT_Message() when a message arrives
+#include "display_app.h"            // For calling Process_MQTT_Payload() when a message arrives
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "MQTTClient.h"             // Paho MQTT Client header
+#include <time.h>
+#include "MQTTAsync.h"              // Paho MQTT asynchronous client header
 #include "config.h"
+#include "event_loop.h"
 
 // Maximum sizes for internal storage.
 #define MAX_ADDR_LEN     256
 #define MAX_CLIENTID_LEN 128
 #define MAX_TOPIC_LEN    256
 
+// Seconds a connection attempt may take before it counts as failed.
+#define MQTT_CONNECT_TIMEOUT 5
+
+// Milliseconds the client may take to finish outstanding work when disconnecting.
+#define MQTT_DISCONNECT_TIMEOUT 1000
+
 // Static variables to hold connection parameters and the client.
-static MQTTClient client;
+static MQTTAsync client;
 static char mqtt_address[MAX_ADDR_LEN];
 static char mqtt_clientID[MAX_CLIENTID_LEN];
 static char mqtt_topic[MAX_TOPIC_LEN];
 static int mqtt_qos = 0;  // Default QoS level
 
+// Connection state, written by the client's callbacks and by MQTT_Process().
+static pthread_mutex_t stateLock = PTHREAD_MUTEX_INITIALIZER;
+static int connected = 0;
+static int connecting = 0;               // An attempt is in progress.
+static time_t retryAt = 0;               // When MQTT_Process() starts the next attempt.
+static int disconnectedPosted = 0;       // The disconnected image was asked for since the last connection.
+static int defaultOnConnect = 1;         // Show the default image once connected.
+static int disconnecting = 0;            // MQTT_Disconnect() waits for the client's answer.
+static int disconnectResult = MQTTASYNC_SUCCESS;
+static pthread_cond_t disconnectDone = PTHREAD_COND_INITIALIZER;
+
 // Default reconnect timeout (in seconds); mutable for exponential backoff.
 static int mqtt_reconnect_timeout;
 
-// Flag indicating connection status.
-static int connected = 0;
+typedef enum {
+    MAILBOX_MESSAGE,        // An MQTT message, payload holds it.
+    MAILBOX_DISCONNECTED,   // Show the disconnected image.
+    MAILBOX_CONNECTED       // Show the default image.
+} MailboxKind;
+
+typedef struct {
+    MailboxKind kind;
+    int payloadlen;
+    char payload[];         // Null-terminated, an image payload may hold other nulls.
+} MailboxEntry;
+
+// The newest entry posted on the client thread and not yet handled by MQTT_Process().
+// A newer entry replaces it: only the last requested image is worth a refresh.
+static MailboxEntry *mailbox = NULL;
+
+// Message counters, written with atomics from both threads.
+static unsigned long messagesReceived = 0;
+static unsigned long messagesCoalesced = 0;  // Replaced by a newer one before being shown.
+static unsigned long messagesDropped = 0;    // Lost to a failed allocation.
+static unsigned long messagesRejected = 0;   // Not displayable, see Display_CheckPayload().
+static unsigned long messagesShown = 0;
 
 extern IT8951_Dev_Info global_dev_info;
 extern UDOUBLE Init_Target_Memory_Addr;
 
+/**
+ * @brief The payload of a message for the log: JSON is shown, an image is not.
+ */
+static const char *describePayload(const MailboxEntry *entry) {
+    return Display_IsImagePayload((const UBYTE *)entry->payload, entry->payloadlen) ? "an image payload"
+                                                                                    : entry->payload;
+}
+
+/**
+ * @brief Puts an entry in the mailbox and wakes the main loop.
+ *
+ * A message still waiting there is dropped, the newer entry supersedes it.
+ */
+static void postEntry(MailboxEntry *entry) {
+    MailboxEntry *replaced = __atomic_exchange_n(&mailbox, entry, __ATOMIC_ACQ_REL);
+    if (replaced) {
+        if (replaced->kind == MAILBOX_MESSAGE) {
+            Debug("MQTT: Skipping %s, a newer message arrived before it was shown.\n", describePayload(replaced));
+            __atomic_add_fetch(&messagesCoalesced, 1, __ATOMIC_RELAXED);
+        }
+        free(replaced);
+    }
+    EventLoop_Wake();
+}
+
+/**
+ * @brief Asks MQTT_Process() to show the disconnected or the default image.
+ */
+static void postStatus(MailboxKind kind) {
+    MailboxEntry *entry = malloc(sizeof(MailboxEntry));
+    if (!entry) {
+        Debug("MQTT: Failed to allocate memory for a status change.\n");
+        EventLoop_Wake();
+        return;
+    }
+    entry->kind = kind;
+    entry->payloadlen = 0;
+    postEntry(entry);
+}
+
 /**
  * @brief Callback function invoked when a message arrives.
  *
- * Logs the received message and delegates processing to the display module.
+ * Runs on the client's own thread: logs the received message, puts it in the
+ * mailbox for MQTT_Process() and wakes the main loop. It never waits for the
+ * display, the mailbox is a single pointer swapped atomically.
+ *
+ * A message that cannot be shown is rejected here. Posting it would abandon the
+ * frame being shown and drop the last message that can, for nothing.
  */
-static int messageArrived(void *context, char *topicName, int topicLen, MQTTClient_message *message) {
-    // Allocate a buffer for the payload plus a null terminator.
-    char *payloadStr = malloc(message->payloadlen + 1);
-    if (!payloadStr) {
+static int messageArrived(void *context, char *topicName, int topicLen, MQTTAsync_message *message) {
+    __atomic_add_fetch(&messagesReceived, 1, __ATOMIC_RELAXED);
+
+    // Allocate an entry for the payload plus a null terminator.
+    MailboxEntry *entry = malloc(sizeof(MailboxEntry) + message->payloadlen + 1);
+    if (!entry) {
         Debug("MQTT: Failed to allocate memory for payload.\n");
-        MQTTClient_freeMessage(&message);
-        MQTTClient_free(topicName);
+        __atomic_add_fetch(&messagesDropped, 1, __ATOMIC_RELAXED);
+        MQTTAsync_freeMessage(&message);
+        MQTTAsync_free(topicName);
         return 1;
     }
-    memcpy(payloadStr, message->payload, message->payloadlen);
-    payloadStr[message->payloadlen] = '\0';  // Null-terminate the string
+    entry->kind = MAILBOX_MESSAGE;
+    entry->payloadlen = message->payloadlen;
+    memcpy(entry->payload, message->payload, message->payloadlen);
+    entry->payload[message->payloadlen] = '\0';  // Null-terminate the string
 
-    Debug("MQTT: Message received on topic \"%s\": %s\n", topicName, payloadStr);
-    Process_MQTT_Message(payloadStr);
+    Debug("MQTT: Message received on topic \"%s\" (%d bytes): %s\n", topicName, entry->payloadlen,
+          describePayload(entry));
+    if (Display_CheckPayload((const UBYTE *)entry->payload, entry->payloadlen) != 0) {
+        Debug("MQTT: Ignoring the message, it does not name an image that can be shown.\n");
+        __atomic_add_fetch(&messagesRejected, 1, __ATOMIC_RELAXED);
+        free(entry);
+    } else {
+        postEntry(entry);
+    }
 
-    free(payloadStr);
-    MQTTClient_freeMessage(&message);
-    MQTTClient_free(topicName);
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
     
     return 1;
 }
@@ -59,12 +155,96 @@ static int messageArrived(void *context, char *topicName, int topicLen, MQTTClie
 /**
  * @brief Callback invoked when the MQTT connection is lost.
  *
- * Sets the connection flag to false and displays a "disconnected" image to provide immediate visual feedback.
+ * Only schedules an immediate reconnect and wakes the main loop. The disconnected
+ * image is shown if that attempt fails, so a brief drop costs no refresh.
  */
 static void connectionLost(void *context, char *cause) {
-    Debug("MQTT: Connection lost, cause: %s\n", cause);
+    Debug("MQTT: Connection lost, cause: %s\n", cause ? cause : "unknown");
+    pthread_mutex_lock(&stateLock);
     connected = 0;
-    Display_ShowSpecialImage(globalConfig.disconnectedImagePath, global_dev_info, Init_Target_Memory_Addr);
+    retryAt = 0;
+    pthread_mutex_unlock(&stateLock);
+    EventLoop_Wake();
+}
+
+/**
+ * @brief Schedules the next attempt after a failed one, with exponential backoff.
+ *
+ * The disconnected image is asked for after the first failure only.
+ */
+static void connectFailed(int code) {
+    pthread_mutex_lock(&stateLock);
+    connecting = 0;
+    retryAt = time(NULL) + mqtt_reconnect_timeout;
+    Debug("MQTT_Connect: Failed to connect, return code %d. Reconnecting in %d seconds...\n",
+          code, mqtt_reconnect_timeout);
+    if (mqtt_reconnect_timeout * 2 < globalConfig.maxReconnectTimeout) {
+        mqtt_reconnect_timeout *= 2;  // Exponential backoff.
+    }
+    else {
+        mqtt_reconnect_timeout = globalConfig.maxReconnectTimeout;
+    }
+    int post = !disconnectedPosted;
+    disconnectedPosted = 1;
+    defaultOnConnect = 1;
+    pthread_mutex_unlock(&stateLock);
+
+    if (post) {
+        postStatus(MAILBOX_DISCONNECTED);
+    } else {
+        // Let the main loop arm its timer for the new retry time.
+        EventLoop_Wake();
+    }
+}
+
+static void onConnectFailure(void *context, MQTTAsync_failureData *response) {
+    connectFailed(response ? response->code : MQTTASYNC_FAILURE);
+}
+
+static void onSubscribeFailure(void *context, MQTTAsync_failureData *response) {
+    Debug("MQTT_Subscribe: Failed to subscribe to topic \"%s\", return code %d\n",
+          mqtt_topic, response ? response->code : MQTTASYNC_FAILURE);
+}
+
+/**
+ * @brief Callback invoked once connected.
+ *
+ * Resets the backoff and subscribes again, the session is clean. The default image
+ * is asked for before subscribing, so a retained message delivered right after
+ * replaces it in the mailbox rather than the other way round.
+ */
+static void onConnect(void *context, MQTTAsync_successData *response) {
+    pthread_mutex_lock(&stateLock);
+    connected = 1;
+    connecting = 0;
+    mqtt_reconnect_timeout = globalConfig.initialReconnectTimeout;
+    int post = defaultOnConnect;
+    defaultOnConnect = 0;
+    disconnectedPosted = 0;
+    pthread_mutex_unlock(&stateLock);
+    Debug("MQTT_Connect: Connected to broker at %s\n", mqtt_address);
+
+    if (post) {
+        postStatus(MAILBOX_CONNECTED);
+    }
+    MQTT_Subscribe(NULL, -1);
+}
+
+/**
+ * @brief Starts a connection attempt; the result arrives in onConnect() or onConnectFailure().
+ */
+static void startConnect(void) {
+    MQTTAsync_connectOptions conn_opts = MQTTAsync_connectOptions_initializer;
+    conn_opts.keepAliveInterval = 3;   // Send PINGREQ every 3 seconds
+    conn_opts.cleansession = 1;         // Start with a clean session
+    conn_opts.connectTimeout = MQTT_CONNECT_TIMEOUT;
+    conn_opts.onSuccess = onConnect;
+    conn_opts.onFailure = onConnectFailure;
+
+    int rc = MQTTAsync_connect(client, &conn_opts);
+    if (rc != MQTTASYNC_SUCCESS) {
+        connectFailed(rc);
+    }
 }
 
 /**
@@ -91,76 +271,64 @@ int MQTT_Init(const char *address, const char *clientID, const char *topic) {
     strncpy(mqtt_topic, topic, MAX_TOPIC_LEN - 1);
     mqtt_topic[MAX_TOPIC_LEN - 1] = '\0';
 
-    int rc = MQTTClient_create(&client, mqtt_address, mqtt_clientID, MQTTCLIENT_PERSISTENCE_NONE, NULL);
-    if (rc != MQTTCLIENT_SUCCESS) {
+    int rc = MQTTAsync_create(&client, mqtt_address, mqtt_clientID, MQTTCLIENT_PERSISTENCE_NONE, NULL);
+    if (rc != MQTTASYNC_SUCCESS) {
         Debug("MQTT_Init: Failed to create MQTT client, return code %d.\n", rc);
         return rc;
     }
 
-    MQTTClient_setCallbacks(client, NULL, connectionLost, messageArrived, NULL);
+    MQTTAsync_setCallbacks(client, NULL, connectionLost, messageArrived, NULL);
     return 0;
 }
 
-/**
- * @brief Helper function to encapsulate reconnection.
- *
- * Attempts to reconnect and re-subscribe.
- */
-static void mqttReconnect(void) {
-    Debug("MQTT_Process: Detected lost connection. Attempting to reconnect...\n");
-    MQTT_Connect();
-    MQTT_Subscribe(NULL, globalConfig.mqttQos);
-}
-
 /**
  * @brief Connect to the MQTT broker.
  *
- * Uses an exponential backoff strategy until the connection is successful.
- * Upon connection, the default image is displayed.
+ * Starts the first attempt and returns without waiting for it. Failed attempts
+ * are retried from MQTT_Process() with exponential backoff; once connected, the
+ * default image is displayed.
  */
 int MQTT_Connect(void) {
-    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-    conn_opts.keepAliveInterval = 3;   // Send PINGREQ every 3 seconds
-    conn_opts.cleansession = 1;         // Start with a clean session
-    int rc;
-    
-    // Attempt connection with exponential backoff.
-    while ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS) {
-        Debug("MQTT_Connect: Failed to connect, return code %d. Reconnecting in %d seconds...\n", 
-              rc, mqtt_reconnect_timeout);
-        sleep(mqtt_reconnect_timeout);
-        if (mqtt_reconnect_timeout * 2 < globalConfig.maxReconnectTimeout) {
-            mqtt_reconnect_timeout *= 2;  // Exponential backoff.
-        }
-        else {
-            mqtt_reconnect_timeout = globalConfig.maxReconnectTimeout;
-        }        
+    pthread_mutex_lock(&stateLock);
+    int start = !connected && !connecting;
+    connecting = 1;
+    pthread_mutex_unlock(&stateLock);
+
+    if (start) {
+        startConnect();
     }
-    
-    // Reset reconnect timeout after a successful connection.
-    mqtt_reconnect_timeout = globalConfig.initialReconnectTimeout;
-    connected = 1;
-    Debug("MQTT_Connect: Connected to broker at %s\n", mqtt_address);
-    
-    // Display the default image upon connection.    
-    Display_ShowSpecialImage(globalConfig.defaultImagePath, global_dev_info, Init_Target_Memory_Addr);
-    return rc;
+    return 0;
 }
 
 /**
  * @brief Subscribe to an MQTT topic.
  *
- * Uses the provided topic or defaults to the stored topic if NULL.
+ * Uses the provided topic or defaults to the stored topic if NULL. The topic and
+ * QoS are kept and subscribed to again after every reconnect.
  */
 int MQTT_Subscribe(const char *topic, int qos) {
-    const char *sub_topic = topic ? topic : mqtt_topic;
-    int sub_qos = (qos < 0 ? mqtt_qos : qos);
+    pthread_mutex_lock(&stateLock);
+    if (topic) {
+        strncpy(mqtt_topic, topic, MAX_TOPIC_LEN - 1);
+        mqtt_topic[MAX_TOPIC_LEN - 1] = '\0';
+    }
+    if (qos >= 0) {
+        mqtt_qos = qos;
+    }
+    int now = connected;
+    pthread_mutex_unlock(&stateLock);
+    if (!now) {
+        Debug("MQTT_Subscribe: Subscribing to topic \"%s\" once connected\n", mqtt_topic);
+        return 0;
+    }
 
-    int rc = MQTTClient_subscribe(client, sub_topic, sub_qos);
-    if (rc != MQTTCLIENT_SUCCESS) {
-        Debug("MQTT_Subscribe: Failed to subscribe to topic \"%s\", return code %d\n", sub_topic, rc);
+    MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+    opts.onFailure = onSubscribeFailure;
+    int rc = MQTTAsync_subscribe(client, mqtt_topic, mqtt_qos, &opts);
+    if (rc != MQTTASYNC_SUCCESS) {
+        Debug("MQTT_Subscribe: Failed to subscribe to topic \"%s\", return code %d\n", mqtt_topic, rc);
     } else {
-        Debug("MQTT_Subscribe: Subscribed to topic \"%s\"\n", sub_topic);
+        Debug("MQTT_Subscribe: Subscribed to topic \"%s\"\n", mqtt_topic);
     }
     return rc;
 }
@@ -168,29 +336,138 @@ int MQTT_Subscribe(const char *topic, int qos) {
 /**
  * @brief Process incoming MQTT messages.
  *
- * If the connection is lost, attempts to reconnect.
+ * Starts the next connection attempt when it is due, then handles the newest
+ * mailbox entry, if any, on the caller's thread: a message, or the disconnected
+ * or default image after a change of the connection.
  */
 void MQTT_Process(void) {
-    if (!connected) {
-        mqttReconnect();
+    pthread_mutex_lock(&stateLock);
+    int start = !connected && !connecting && time(NULL) >= retryAt;
+    if (start) {
+        connecting = 1;
+        Debug("MQTT_Process: Not connected. Attempting to reconnect...\n");
+    }
+    pthread_mutex_unlock(&stateLock);
+    if (start) {
+        startConnect();
+    }
+
+    // Entries posted during the refresh replace each other in the mailbox,
+    // the loop then handles only the last of them.
+    MailboxEntry *entry;
+    while ((entry = __atomic_exchange_n(&mailbox, NULL, __ATOMIC_ACQ_REL)) != NULL) {
+        if (entry->kind == MAILBOX_DISCONNECTED) {
+            Display_ShowSpecialImage(globalConfig.disconnectedImagePath, global_dev_info, Init_Target_Memory_Addr);
+            free(entry);
+            continue;
+        }
+        if (entry->kind == MAILBOX_CONNECTED) {
+            Display_ShowSpecialImage(globalConfig.defaultImagePath, global_dev_info, Init_Target_Memory_Addr);
+            free(entry);
+            continue;
+        }
+
+        Process_MQTT_Payload((const UBYTE *)entry->payload, entry->payloadlen);
+        free(entry);
+
+        unsigned long shown = __atomic_add_fetch(&messagesShown, 1, __ATOMIC_RELAXED);
+        Debug("MQTT_Process: Messages received %lu, shown %lu, skipped for newer %lu, rejected %lu, dropped %lu.\n",
+              __atomic_load_n(&messagesReceived, __ATOMIC_RELAXED), shown,
+              __atomic_load_n(&messagesCoalesced, __ATOMIC_RELAXED),
+              __atomic_load_n(&messagesRejected, __ATOMIC_RELAXED),
+              __atomic_load_n(&messagesDropped, __ATOMIC_RELAXED));
     }
-    MQTTClient_yield();
+}
+
+/**
+ * @brief Whether a message is waiting to be shown.
+ *
+ * Lock-free, used as Upload_Abort_Check to drop uploads of frames a newer message supersedes.
+ */
+bool MQTT_MessagePending(void) {
+    return __atomic_load_n(&mailbox, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/**
+ * @brief When MQTT_Process() starts the next connection attempt.
+ */
+time_t MQTT_RetryTime(void) {
+    pthread_mutex_lock(&stateLock);
+    time_t when = (connected || connecting) ? 0 : retryAt;
+    pthread_mutex_unlock(&stateLock);
+    return when;
+}
+
+/**
+ * @brief Wakes MQTT_Disconnect() once the client reports the outcome of the disconnect.
+ */
+static void disconnectFinished(int code) {
+    pthread_mutex_lock(&stateLock);
+    disconnecting = 0;
+    disconnectResult = code;
+    pthread_cond_signal(&disconnectDone);
+    pthread_mutex_unlock(&stateLock);
+}
+
+static void onDisconnect(void *context, MQTTAsync_successData *response) {
+    disconnectFinished(MQTTASYNC_SUCCESS);
+}
+
+static void onDisconnectFailure(void *context, MQTTAsync_failureData *response) {
+    disconnectFinished(response ? response->code : MQTTASYNC_FAILURE);
 }
 
 /**
  * @brief Disconnect from the MQTT broker.
+ *
+ * MQTTAsync_disconnect() only queues the disconnect, so this waits for the client's
+ * callback before returning: MQTT_Cleanup() must not destroy the client under it.
+ * The client takes at most the timeout, the wait gives up half a second later.
  */
 void MQTT_Disconnect(void) {
-    MQTTClient_disconnect(client, 1000);
+    MQTTAsync_disconnectOptions opts = MQTTAsync_disconnectOptions_initializer;
+    opts.timeout = MQTT_DISCONNECT_TIMEOUT;
+    opts.onSuccess = onDisconnect;
+    opts.onFailure = onDisconnectFailure;
+
+    pthread_mutex_lock(&stateLock);
+    disconnecting = 1;
+    pthread_mutex_unlock(&stateLock);
+    int rc = MQTTAsync_disconnect(client, &opts);
+
+    pthread_mutex_lock(&stateLock);
+    if (rc == MQTTASYNC_SUCCESS) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long ns = deadline.tv_nsec + (MQTT_DISCONNECT_TIMEOUT + 500) * 1000000L;
+        deadline.tv_sec += ns / 1000000000L;
+        deadline.tv_nsec = ns % 1000000000L;
+        while (disconnecting && pthread_cond_timedwait(&disconnectDone, &stateLock, &deadline) == 0) {
+        }
+        rc = disconnecting ? MQTTASYNC_FAILURE : disconnectResult;
+    }
+    int timedOut = disconnecting;
+    disconnecting = 0;
     connected = 0;
-    Debug("MQTT_Disconnect: Disconnected from broker.\n");
+    pthread_mutex_unlock(&stateLock);
+
+    if (timedOut) {
+        Debug("MQTT_Disconnect: No answer from the client within %d ms.\n", MQTT_DISCONNECT_TIMEOUT + 500);
+    } else if (rc != MQTTASYNC_SUCCESS) {
+        Debug("MQTT_Disconnect: Failed to disconnect cleanly, return code %d.\n", rc);
+    } else {
+        Debug("MQTT_Disconnect: Disconnected from broker.\n");
+    }
 }
 
 /**
  * @brief Clean up the MQTT client.
  */
 void MQTT_Cleanup(void) {
-    MQTTClient_destroy(&client);
+    MQTTAsync_destroy(&client);
+
+    // Drop an entry that arrived after the last MQTT_Process().
+    free(__atomic_exchange_n(&mailbox, NULL, __ATOMIC_ACQ_REL));
 }
 
 /**
@@ -200,6 +477,8 @@ void MQTT_Cleanup(void) {
  */
 void MQTT_SetReconnectTimeout(int timeout) {
     if (timeout > 0) {
+        pthread_mutex_lock(&stateLock);
         mqtt_reconnect_timeout = timeout;
+        pthread_mutex_unlock(&stateLock);
     }
 }
\ No newline at end of file
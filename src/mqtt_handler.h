@@ -2,6 +2,9 @@
 #ifndef MQTT_HANDLER_H
 #define MQTT_HANDLER_H
 
+#include <stdbool.h>
+#include <time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -21,6 +24,9 @@ int MQTT_Init(const char *address, const char *clientID, const char *topic);
 /**
  * @brief Connect to the MQTT broker.
  *
+ * Starts the first connection attempt and returns without waiting for it.
+ * MQTT_Process() retries failed attempts and reconnects after a lost connection.
+ *
  * @return 0 on success, or an error code on failure.
  */
 int MQTT_Connect(void);
@@ -28,6 +34,9 @@ int MQTT_Connect(void);
 /**
  * @brief Subscribe to an MQTT topic.
  *
+ * The subscription is made again after every reconnect. Before the client is
+ * connected, the topic and QoS are only stored.
+ *
  * @param topic The topic to subscribe to.
  * @param qos The Quality of Service level (typically 0, 1, or 2).
  * @return 0 on success, or an error code on failure.
@@ -37,13 +46,36 @@ int MQTT_Subscribe(const char *topic, int qos);
 /**
  * @brief Process incoming MQTT messages.
  *
- * This function should be called periodically (or inside the main loop) to let the MQTT client
- * process incoming messages. With asynchronous callbacks, it may simply yield control.
+ * Messages arrive on the MQTT client's own thread and wake the main loop through
+ * EventLoop_Wake(). A message that arrives before the previous one was shown replaces it,
+ * unless Display_CheckPayload() finds it cannot be shown; such a message is dropped on arrival.
+ * This function displays the newest message on the calling thread, so all display work
+ * happens on the main loop and the panel always ends on the last requested image.
+ * It also starts reconnect attempts when they are due, and shows the disconnected image
+ * after a failed attempt and the default image once connected again.
  */
 void MQTT_Process(void);
 
+/**
+ * @brief Check whether a message arrived that MQTT_Process() has not shown yet.
+ *
+ * A pending disconnected or default image counts as well. Safe to call from any thread.
+ *
+ * @return true if a message is waiting.
+ */
+bool MQTT_MessagePending(void);
+
+/**
+ * @brief Time of the next reconnect attempt, for the main loop's timer.
+ *
+ * @return Absolute time as from time(NULL), 0 if no attempt is scheduled.
+ */
+time_t MQTT_RetryTime(void);
+
 /**
  * @brief Disconnect from the MQTT broker.
+ *
+ * Returns once the client has disconnected, or after its timeout has passed.
  */
 void MQTT_Disconnect(void);
 
@@ -0,0 +1,137 @@
+//thread_pool.c
+#include "thread_pool.h"
+#include "../lib/Config/Debug.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct ThreadPool {
+    pthread_t *workers;
+    int workerCount;
+    pthread_mutex_t runLock;    // One job at a time.
+    pthread_mutex_t lock;       // Everything below.
+    pthread_cond_t start;
+    pthread_cond_t done;
+    ThreadPool_Task task;
+    void *arg;
+    int count;                  // Parts of the current job.
+    int next;                   // Next part to hand out.
+    int remaining;              // Parts not finished yet.
+    unsigned long generation;   // Counts jobs, wakes the workers for a new one.
+    int stop;
+};
+
+// Runs parts of the current job until none are left. Called with lock held.
+static void runParts(ThreadPool *pool) {
+    while (pool->next < pool->count) {
+        int index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->arg, index);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->remaining == 0) {
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+}
+
+static void *workerMain(void *arg) {
+    ThreadPool *pool = (ThreadPool *)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        runParts(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool *ThreadPool_Create(int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->workers = calloc(threads, sizeof(pthread_t));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->runLock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&pool->workers[pool->workerCount], NULL, workerMain, pool) != 0) {
+            Debug("ThreadPool_Create: Started %d of %d workers.\n", pool->workerCount, threads - 1);
+            break;
+        }
+        pool->workerCount++;
+    }
+    return pool;
+}
+
+int ThreadPool_Threads(const ThreadPool *pool) {
+    return pool ? pool->workerCount + 1 : 1;
+}
+
+void ThreadPool_Run(ThreadPool *pool, ThreadPool_Task task, void *arg, int count) {
+    if (count <= 0) {
+        return;
+    }
+    if (!pool || pool->workerCount == 0 || count == 1) {
+        for (int i = 0; i < count; i++) {
+            task(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->runLock);
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->remaining = count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+
+    // The caller works on the job too, then waits for the parts still running.
+    runParts(pool);
+    while (pool->remaining > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pool->task = NULL;
+    pool->arg = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->runLock);
+}
+
+void ThreadPool_Destroy(ThreadPool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->workerCount; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->runLock);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,40 @@
+//thread_pool.h
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/**
+ * @brief Persistent worker threads that run the parts of one job at a time.
+ */
+typedef struct ThreadPool ThreadPool;
+
+/**
+ * @brief One part of a job, index runs from 0 to the part count - 1.
+ */
+typedef void (*ThreadPool_Task)(void *arg, int index);
+
+/**
+ * @brief Starts threads - 1 workers; the thread calling ThreadPool_Run() is the last one.
+ *
+ * @return The pool, or NULL if it could not be allocated. Workers that fail to start
+ *         are left out, so check ThreadPool_Threads() for how many there are.
+ */
+ThreadPool *ThreadPool_Create(int threads);
+
+/**
+ * @brief Threads that work on a job, the caller included.
+ */
+int ThreadPool_Threads(const ThreadPool *pool);
+
+/**
+ * @brief Runs task(arg, 0) to task(arg, count - 1) on the pool and returns when all are done.
+ *
+ * Jobs from several threads run one after the other.
+ */
+void ThreadPool_Run(ThreadPool *pool, ThreadPool_Task task, void *arg, int count);
+
+/**
+ * @brief Stops and joins the workers.
+ */
+void ThreadPool_Destroy(ThreadPool *pool);
+
+#endif // THREAD_POOL_H
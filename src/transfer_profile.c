@@ -0,0 +1,319 @@
+//transfer_profile.c
+#include "transfer_profile.h"
+#include "config.h"
+#include "../lib/Config/Debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+
+#define CALIBRATION_ROWS   200   // Height of the test band, as high as the largest telegram.
+#define CALIBRATION_REPEAT 2     // Uploads per candidate, the fastest one counts.
+#define LINK_CHECKS        3     // Clean read backs needed before a faster SPI clock is kept.
+
+static const char *strategyNames[IT8951_WRITE_STRATEGY_NUM] = {
+    "packed", "per_row", "telegram", "whole_image", "one_chunk",
+};
+
+static const UWORD telegramRowCandidates[] = { 25, 50, 100, 200 };
+static const UWORD burstSizeCandidates[] = { 2046, 4094, 8190, IT8951_BURST_SIZE_MAX };
+static const UDOUBLE spiHzCandidates[] = { 10000000, 12500000, 16000000, 20000000, 25000000, 32000000 };
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+void TransferProfile_Key(IT8951_Dev_Info dev_info, char *key, size_t len) {
+    char model[128] = "unknown board";
+
+    FILE *fp = fopen("/proc/device-tree/model", "rb");
+    if (fp) {
+        size_t n = fread(model, 1, sizeof(model) - 1, fp);
+        fclose(fp);
+        model[n] = '\0';
+        // The device tree string is NUL terminated, some kernels add a newline.
+        model[strcspn(model, "\n")] = '\0';
+        if (model[0] == '\0')
+            strcpy(model, "unknown board");
+    }
+    snprintf(key, len, "%ux%u %s", dev_info.Panel_W, dev_info.Panel_H, model);
+}
+
+static cJSON *readJsonFile(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    long filesize = ftell(fp);
+    rewind(fp);
+    if (filesize < 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    char *data = (char *)malloc(filesize + 1);
+    if (!data) {
+        fclose(fp);
+        return NULL;
+    }
+    size_t n = fread(data, 1, filesize, fp);
+    data[n] = '\0';
+    fclose(fp);
+
+    cJSON *json = cJSON_Parse(data);
+    free(data);
+    return json;
+}
+
+int TransferProfile_Load(const char *path, const char *key, TransferProfile *profile) {
+    cJSON *json = readJsonFile(path);
+    if (!json)
+        return -1;
+
+    cJSON *entry = cJSON_GetObjectItemCaseSensitive(json, key);
+    if (!cJSON_IsObject(entry)) {
+        cJSON_Delete(json);
+        return -1;
+    }
+
+    TransferProfile p = { Write_Strategy, Telegram_Rows, Burst_Size, 0, 0.0 };
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(entry, "STRATEGY");
+    if (cJSON_IsString(item) && item->valuestring != NULL) {
+        for (int i = 0; i < IT8951_WRITE_STRATEGY_NUM; i++) {
+            if (strcmp(item->valuestring, strategyNames[i]) == 0)
+                p.strategy = (IT8951_Write_Strategy)i;
+        }
+    }
+    item = cJSON_GetObjectItemCaseSensitive(entry, "TELEGRAM_ROWS");
+    if (cJSON_IsNumber(item) && item->valueint > 0 && item->valueint <= 0xFFFF) {
+        p.telegramRows = item->valueint;
+    }
+    item = cJSON_GetObjectItemCaseSensitive(entry, "BURST_SIZE");
+    if (cJSON_IsNumber(item) && item->valueint > 0 && item->valueint <= IT8951_BURST_SIZE_MAX) {
+        p.burstSize = item->valueint;
+    }
+    item = cJSON_GetObjectItemCaseSensitive(entry, "SPI_HZ");
+    if (cJSON_IsNumber(item) && item->valuedouble >= 0) {
+        p.spiHz = (UDOUBLE)item->valuedouble;
+    }
+    item = cJSON_GetObjectItemCaseSensitive(entry, "UPLOAD_MS");
+    if (cJSON_IsNumber(item)) {
+        p.uploadMs = item->valuedouble;
+    }
+
+    cJSON_Delete(json);
+    *profile = p;
+    return 0;
+}
+
+int TransferProfile_Save(const char *path, const char *key, const TransferProfile *profile) {
+    cJSON *json = readJsonFile(path);
+    if (!cJSON_IsObject(json)) {
+        cJSON_Delete(json);
+        json = cJSON_CreateObject();
+        if (!json)
+            return -1;
+    }
+
+    cJSON *entry = cJSON_CreateObject();
+    if (!entry) {
+        cJSON_Delete(json);
+        return -1;
+    }
+    cJSON_AddStringToObject(entry, "STRATEGY", strategyNames[profile->strategy]);
+    cJSON_AddNumberToObject(entry, "TELEGRAM_ROWS", profile->telegramRows);
+    cJSON_AddNumberToObject(entry, "BURST_SIZE", profile->burstSize);
+    cJSON_AddNumberToObject(entry, "SPI_HZ", profile->spiHz);
+    cJSON_AddNumberToObject(entry, "UPLOAD_MS", profile->uploadMs);
+
+    if (cJSON_GetObjectItemCaseSensitive(json, key))
+        cJSON_ReplaceItemInObjectCaseSensitive(json, key, entry);
+    else
+        cJSON_AddItemToObject(json, key, entry);
+
+    char *text = cJSON_Print(json);
+    cJSON_Delete(json);
+    if (!text)
+        return -1;
+
+    // Write next to the profile and rename, so a power cut never leaves half a file.
+    char tmpPath[MAX_STR_LEN + 8];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        Debug("TransferProfile_Save: Failed to open %s\n", tmpPath);
+        free(text);
+        return -1;
+    }
+    int ok = fputs(text, fp) >= 0 && fputc('\n', fp) != EOF;
+    ok = (fclose(fp) == 0) && ok;
+    free(text);
+    if (!ok || rename(tmpPath, path) != 0) {
+        Debug("TransferProfile_Save: Failed to write %s\n", path);
+        remove(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+void TransferProfile_Apply(const TransferProfile *profile) {
+    Write_Strategy = profile->strategy;
+    Telegram_Rows = profile->telegramRows;
+    Burst_Size = profile->burstSize;
+    if (profile->spiHz != 0)
+        DEV_SPI_SetSpeed(profile->spiHz);
+
+    Debug("Transfer profile: %s, %u rows, %u words/burst, SPI %u Hz\n",
+          strategyNames[profile->strategy], profile->telegramRows, profile->burstSize,
+          DEV_SPI_GetSpeed());
+}
+
+// Fastest of CALIBRATION_REPEAT uploads with the current driver settings, in ms.
+static double timeUpload(UBYTE *buffer, UWORD width, UWORD height, UDOUBLE addr) {
+    double best = -1.0;
+
+    for (int i = 0; i < CALIBRATION_REPEAT; i++) {
+        EPD_IT8951_WaitForDisplayReady();
+        uint64_t start = DEV_Clock_ns();
+        EPD_IT8951_4bp_Write(buffer, 0, 0, width, height, addr, true);
+        double ms = (DEV_Clock_ns() - start) / 1e6;
+        if (best < 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+static void tryCandidate(TransferProfile *best, TransferProfile candidate,
+                         UBYTE *buffer, UWORD width, UWORD height, UDOUBLE addr) {
+    TransferProfile_Apply(&candidate);
+    candidate.uploadMs = timeUpload(buffer, width, height, addr);
+    Debug("  %-11s rows %3u burst %5u: %.1f ms\n", strategyNames[candidate.strategy],
+          candidate.telegramRows, candidate.burstSize, candidate.uploadMs);
+    if (best->uploadMs <= 0 || candidate.uploadMs < best->uploadMs)
+        *best = candidate;
+}
+
+static int linkIsClean(IT8951_Dev_Info dev_info) {
+    for (int i = 0; i < LINK_CHECKS; i++) {
+        if (!EPD_IT8951_Check_Link(dev_info))
+            return 0;
+    }
+    return 1;
+}
+
+int TransferProfile_Calibrate(IT8951_Dev_Info dev_info, UDOUBLE target_memory_addr,
+                              UDOUBLE max_spi_hz, TransferProfile *best) {
+    UWORD width = dev_info.Panel_W - (dev_info.Panel_W % 32);
+    UWORD height = dev_info.Panel_H < CALIBRATION_ROWS ? dev_info.Panel_H : CALIBRATION_ROWS;
+    UDOUBLE size = (UDOUBLE)width / 2 * height;
+
+    if (width == 0 || height == 0)
+        return -1;
+
+    UBYTE *buffer = (UBYTE *)malloc(size);
+    if (!buffer) {
+        Debug("TransferProfile_Calibrate: Memory allocation failed\n");
+        return -1;
+    }
+    // Noise rather than a flat colour, like a real image on the wire.
+    UDOUBLE seed = 0x2545F491;
+    for (UDOUBLE i = 0; i < size; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        buffer[i] = (UBYTE)seed;
+    }
+
+    TransferProfile saved = { Write_Strategy, Telegram_Rows, Burst_Size, DEV_SPI_GetSpeed(), 0.0 };
+    TransferProfile result = saved;
+    TransferProfile candidate = saved;
+
+    printf("Calibrating SPI transfer on %ux%u, this takes a few seconds...\n", width, height);
+
+    candidate.strategy = IT8951_WRITE_TELEGRAM;
+    for (size_t r = 0; r < COUNT_OF(telegramRowCandidates); r++) {
+        for (size_t b = 0; b < COUNT_OF(burstSizeCandidates); b++) {
+            candidate.telegramRows = telegramRowCandidates[r];
+            candidate.burstSize = burstSizeCandidates[b];
+            tryCandidate(&result, candidate, buffer, width, height, target_memory_addr);
+        }
+    }
+    candidate.telegramRows = saved.telegramRows;
+    candidate.strategy = IT8951_WRITE_WHOLE_IMAGE;
+    for (size_t b = 0; b < COUNT_OF(burstSizeCandidates); b++) {
+        candidate.burstSize = burstSizeCandidates[b];
+        tryCandidate(&result, candidate, buffer, width, height, target_memory_addr);
+    }
+    // These do not use the burst geometry.
+    candidate.burstSize = saved.burstSize;
+    candidate.strategy = IT8951_WRITE_ONE_CHUNK;
+    tryCandidate(&result, candidate, buffer, width, height, target_memory_addr);
+    candidate.strategy = IT8951_WRITE_PER_ROW;
+    tryCandidate(&result, candidate, buffer, width, height, target_memory_addr);
+    candidate.strategy = IT8951_WRITE_PACKED;
+    tryCandidate(&result, candidate, buffer, width, height, target_memory_addr);
+
+    // Faster clocks for the winner, as long as the controller still answers correctly.
+    for (size_t s = 0; s < COUNT_OF(spiHzCandidates); s++) {
+        if (spiHzCandidates[s] <= saved.spiHz || spiHzCandidates[s] > max_spi_hz)
+            continue;
+
+        candidate = result;
+        candidate.spiHz = DEV_SPI_SetSpeed(spiHzCandidates[s]);
+        if (candidate.spiHz <= result.spiHz)
+            continue;
+        if (!linkIsClean(dev_info)) {
+            Debug("  SPI %u Hz: read back failed, stopping at %u Hz\n", candidate.spiHz, result.spiHz);
+            break;
+        }
+        TransferProfile_Apply(&candidate);
+        candidate.uploadMs = timeUpload(buffer, width, height, target_memory_addr);
+        Debug("  SPI %u Hz: %.1f ms\n", candidate.spiHz, candidate.uploadMs);
+        if (candidate.uploadMs < result.uploadMs)
+            result = candidate;
+    }
+
+    free(buffer);
+    TransferProfile_Apply(&saved);
+    if (result.uploadMs <= 0)
+        return -1;
+
+    printf("Transfer calibrated: %s, %u rows, %u words/burst, SPI %u Hz, %.1f ms per %ux%u\n",
+           strategyNames[result.strategy], result.telegramRows, result.burstSize,
+           result.spiHz, result.uploadMs, width, height);
+    *best = result;
+    return 0;
+}
+
+int TransferProfile_Init(IT8951_Dev_Info dev_info, UDOUBLE target_memory_addr, int force_calibration) {
+    char key[192];
+    TransferProfile profile;
+    const char *path = globalConfig.transferProfilePath;
+
+    TransferProfile_Key(dev_info, key, sizeof(key));
+
+    if (!force_calibration && TransferProfile_Load(path, key, &profile) == 0) {
+        UDOUBLE defaultHz = DEV_SPI_GetSpeed();
+        TransferProfile_Apply(&profile);
+        if (profile.spiHz != 0 && !EPD_IT8951_Check_Link(dev_info)) {
+            // Board or wiring changed since the profile was made.
+            printf("Transfer profile: SPI %u Hz read back failed, using %u Hz\n", profile.spiHz, defaultHz);
+            DEV_SPI_SetSpeed(defaultHz);
+        }
+        return 0;
+    }
+
+    if (!force_calibration && !globalConfig.calibrateTransfer) {
+        Debug("No transfer profile for \"%s\", using the built-in defaults\n", key);
+        return 0;
+    }
+
+    if (TransferProfile_Calibrate(dev_info, target_memory_addr, globalConfig.calibrationMaxSpiHz, &profile) != 0) {
+        fprintf(stderr, "Transfer calibration failed, using the built-in defaults\n");
+        return -1;
+    }
+    TransferProfile_Apply(&profile);
+    if (TransferProfile_Save(path, key, &profile) != 0) {
+        fprintf(stderr, "Failed to save the transfer profile to %s\n", path);
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+//transfer_profile.h
+#ifndef TRANSFER_PROFILE_H
+#define TRANSFER_PROFILE_H
+
+#include "../lib/e-Paper/EPD_IT8951.h"
+#include "../lib/Config/DEV_Config.h"
+#include <stddef.h>
+
+/**
+ * @brief SPI transfer settings that gave the fastest upload on one board and panel.
+ */
+typedef struct {
+    IT8951_Write_Strategy strategy;  /**< 4bpp uploader, see Write_Strategy. */
+    UWORD telegramRows;              /**< Rows per load image command (telegram strategy). */
+    UWORD burstSize;                 /**< 16-bit words per CS period. */
+    UDOUBLE spiHz;                   /**< SPI clock, 0 keeps the DEV_Config default. */
+    double uploadMs;                 /**< Upload time of the calibration band. */
+} TransferProfile;
+
+/**
+ * @brief Builds the profile key for a panel on this board, e.g.
+ *        "1872x1404 Raspberry Pi 4 Model B Rev 1.4".
+ */
+void TransferProfile_Key(IT8951_Dev_Info dev_info, char *key, size_t len);
+
+/**
+ * @brief Reads the profile stored under key.
+ *
+ * @return 0 on success, -1 if the file or the key does not exist.
+ */
+int TransferProfile_Load(const char *path, const char *key, TransferProfile *profile);
+
+/**
+ * @brief Stores the profile under key, keeping the profiles of other boards and panels.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int TransferProfile_Save(const char *path, const char *key, const TransferProfile *profile);
+
+/**
+ * @brief Makes the driver use the profile (Write_Strategy, Telegram_Rows, Burst_Size, SPI clock).
+ */
+void TransferProfile_Apply(const TransferProfile *profile);
+
+/**
+ * @brief Times test uploads for each strategy and burst geometry and returns the fastest.
+ *
+ * The uploads go to the image buffer at target_memory_addr without a refresh, so the
+ * panel keeps what it shows. If max_spi_hz is above the current SPI clock, faster
+ * clocks are tried as well and kept as long as the controller still reads back correctly.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int TransferProfile_Calibrate(IT8951_Dev_Info dev_info, UDOUBLE target_memory_addr,
+                              UDOUBLE max_spi_hz, TransferProfile *best);
+
+/**
+ * @brief Startup entry point: applies the stored profile for this board and panel,
+ *        or calibrates and stores one when there is none (CALIBRATE_TRANSFER) or
+ *        when force_calibration is set (--calibrate).
+ *
+ * @return 0 on success, -1 if calibration failed and the defaults stay in use.
+ */
+int TransferProfile_Init(IT8951_Dev_Info dev_info, UDOUBLE target_memory_addr, int force_calibration);
+
+#endif // TRANSFER_PROFILE_H